@@ -123,6 +123,18 @@
 			     !__builtin_types_compatible_p(typeof(arr), \
 							   typeof(&(arr)[0])))
 
+/**
+ * Hint to the compiler that a condition is almost always true (or
+ * false), so the common path is laid out as straight-line code.
+ *
+ * :param condition: The condition.
+ * :return: The condition, as 0 or 1.
+ */
+#undef likely
+#define likely(condition) __builtin_expect(!!(condition), 1)
+#undef unlikely
+#define unlikely(condition) __builtin_expect(!!(condition), 0)
+
 /**
  * Attributes
  * ==========
@@ -14,6 +14,9 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 
 #include "util/reallocating_buffer.h"
@@ -31,6 +34,28 @@
 	__error_if_used("This function may only be used in unit tests.")
 #endif
 
+/**
+ * How a test is isolated from the test runner and other tests.
+ */
+enum li_unit_isolation {
+	/**
+	 * Run the test in its own child process (the default).
+	 */
+	LI_UNIT_ISOLATION_PROCESS,
+
+	/**
+	 * Run the test on a thread inside the runner process, in a
+	 * job slot of its own, alongside test processes (which are
+	 * then always spawned by the zygote). This avoids a fork per
+	 * test, but is only suitable for trusted tests which do not
+	 * crash, modify global state, or write output other than
+	 * through assertions: a crash takes down the runner, and every
+	 * result with it, and timeouts are not enforced, so a test
+	 * which hangs keeps the run from ever finishing.
+	 */
+	LI_UNIT_ISOLATION_THREAD,
+};
+
 /**
  * Optional parameters for a test. Default values are always zero,
  * since this is used for static variables.
@@ -52,6 +77,118 @@ struct li_unit_test_options {
 	 * timeouts if -1.
 	 */
 	int timeout_multiplier;
+
+	/**
+	 * If positive, the timeout of the test in milliseconds, used
+	 * instead of a multiple of the default timeout.
+	 */
+	long timeout_ms;
+
+	/**
+	 * How the test is isolated from the runner.
+	 */
+	enum li_unit_isolation isolation;
+
+	/**
+	 * Fail the test if its peak resident set size exceeds this many
+	 * KiB. 0 for no limit. Not checked with thread isolation.
+	 */
+	long max_rss_kb;
+
+	/**
+	 * Fail the test if it uses more than this many milliseconds of
+	 * CPU time (user and system). 0 for no limit.
+	 */
+	long max_cpu_ms;
+
+	/**
+	 * Fail the test if it runs more than this many user space
+	 * instructions, which are counted with hardware counters (see
+	 * ``perf_counters`` in :c:type:`struct li_unit_runner_options`)
+	 * whenever this is set. 0 for no limit. Not checked if the
+	 * hardware has no counters.
+	 */
+	uint64_t max_instructions;
+
+	/**
+	 * True if no other tests should run at the same time as this
+	 * one. Always the case for benchmarks.
+	 */
+	bool exclusive;
+};
+
+/**
+ * Output kept from a test. This is private to the test runner.
+ */
+struct li_unit_output {
+	/* The start of the output (or all of it, without a limit) */
+	struct li_reallocating_buffer head;
+
+	/* The latest output, once the head is full */
+	struct li_reallocating_buffer tail;
+
+	/* Number of bytes dropped between the head and the tail */
+	size_t elided;
+
+	/* True if counted against the memory budget */
+	bool retained;
+
+	/* True if moved to the spill file, at this offset */
+	bool spilled;
+	off_t spill_offset;
+	size_t spill_length;
+};
+
+/**
+ * A named value reported by a test.
+ */
+struct li_unit_metric {
+	char *name;
+	double value;
+
+	/**
+	 * True if this is a benchmark sample (a duration in
+	 * nanoseconds), rather than a custom metric.
+	 */
+	bool sample;
+};
+
+/**
+ * What a test reported to the runner, apart from its output.
+ */
+struct li_unit_result {
+	/**
+	 * True if the test got as far as reporting its assertion
+	 * counts (a crashed test does not).
+	 */
+	bool has_assertions;
+	uint64_t successful_assertions;
+	uint64_t failed_assertions;
+
+	/**
+	 * The message of the first failed assertion, or NULL.
+	 */
+	char *failure_site;
+
+	struct li_unit_metric *metrics;
+	size_t n_metrics;
+	size_t metrics_allocation;
+};
+
+/**
+ * The state of a running benchmark (see :c:macro:`DEFBENCH`).
+ */
+struct li_unit_bench {
+	/**
+	 * The number of iterations :c:macro:`BENCH_LOOP` runs for in
+	 * this call.
+	 */
+	uint64_t iterations;
+
+	/* Private to the harness */
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+	bool looped;
 };
 
 /**
@@ -74,6 +211,52 @@ struct li_unit_test {
 	 */
 	void (*func)(void);
 
+	/**
+	 * If non-NULL, the test is a benchmark, and this is called
+	 * instead of ``func``, repeatedly, by the benchmark harness.
+	 * Benchmarks always run in their own process, with no other
+	 * tests running.
+	 */
+	void (*bench)(struct li_unit_bench *bench);
+
+	/**
+	 * If non-NULL, the test is parameterized (see
+	 * :c:macro:`DEFTEST_P`), and this is called instead of ``func``
+	 * with a pointer to its parameter. The registry replaces a
+	 * parameterized test with one test for each of its
+	 * ``n_params`` parameters (each ``param_size`` bytes, starting
+	 * at ``params``), which has just that parameter.
+	 */
+	void (*param_func)(const void *param);
+	const void *params;
+	size_t n_params;
+	size_t param_size;
+
+	/**
+	 * If non-NULL, the test is a fuzz target (see
+	 * :c:macro:`DEFFUZZ`), and this is called instead of ``func``
+	 * with each input to try.
+	 */
+	void (*fuzz)(const uint8_t *data, size_t size);
+
+	/**
+	 * If non-NULL, the test is run by executing this
+	 * NULL-terminated argument list (the first element being the
+	 * path to the program) instead of calling ``func``. The test
+	 * succeeds if the program exits with a status of 0. Used by
+	 * :c:func:`li_unit_meta_runner_main` to run tests which live in
+	 * other binaries.
+	 */
+	const char *const *argv;
+
+	/**
+	 * True if the result of the test should never be cached, as
+	 * for benchmarks and fuzz targets. Set by
+	 * :c:func:`li_unit_meta_runner_main` for those in other
+	 * binaries, whose ``bench`` and ``fuzz`` are not set here.
+	 */
+	bool uncacheable;
+
 	/**
 	 * Private state used by the test runner.
 	 */
@@ -86,12 +269,25 @@ struct li_unit_test {
 		       _LI_UNIT_DEADLINE_EXCEEDED,
 		} state;
 		pid_t pid;
+		int pidfd;
+		unsigned int slot;
 		bool has_deadline;
+		size_t deadline_index;
 		struct timespec start_time;
 		struct timespec elapsed_time;
+		struct rusage rusage;
 		struct timespec deadline;
 		int output_pipe[2];
-		struct li_reallocating_buffer output;
+		int output_file;
+		struct li_unit_output output;
+		uint32_t job;
+		struct li_unit_result result;
+		int cgroup_fd;
+		unsigned int cgroup_id;
+		uint64_t memory_peak_kb;
+		bool has_cache_key;
+		uint64_t cache_key;
+		bool cached;
 	} priv;
 
 	/**
@@ -101,9 +297,33 @@ struct li_unit_test {
 };
 
 /**
- * The linked list of tests to run.
+ * Get the tests defined with :c:macro:`DEFTEST`, sorted by name. They
+ * are also linked in that order through ``rest``. The index is built
+ * on the first call.
+ *
+ * :param n_tests: Set to the number of tests.
+ * :return: The array of tests, or NULL if there are none (or it could
+ *          not be allocated).
  */
-extern struct li_unit_test *li_unit_test_list;
+struct li_unit_test *const *li_unit_registered_tests(size_t *n_tests);
+
+/**
+ * Find a test defined with :c:macro:`DEFTEST` by name, with a binary
+ * search.
+ *
+ * :return: The test, or NULL if there is none by that name.
+ */
+struct li_unit_test *li_unit_find_test(const char *name);
+
+/**
+ * Register the tests in one module (the executable, or a shared
+ * library): the pointers between the start and end of its
+ * ``li_unit_tests`` section. This is called before ``main`` from each
+ * file which includes this header, and repeated calls for the same
+ * module are ignored.
+ */
+void li_unit_register_tests(struct li_unit_test *const *start,
+			    struct li_unit_test *const *stop);
 
 /**
  * Should be called by the main function for the unit tests.
@@ -113,6 +333,18 @@ extern struct li_unit_test *li_unit_test_list;
  */
 int li_unit_run_tests_main(const char *const *argv);
 
+/**
+ * Should be called by the main function of a meta-runner: a program
+ * which runs the tests of several test binaries (each calling
+ * :c:func:`li_unit_run_tests_main`) from a single queue, so that the
+ * limit on parallelism applies across all of them.
+ *
+ * :param argv: The ``argv`` passed to main. Arguments following the
+ *              options are the paths to the test binaries.
+ * :return: 0 on success, 1 if any test failed.
+ */
+int li_unit_meta_runner_main(const char *const *argv);
+
 /**
  * Options struct for :c:func:`li_unit_run_tests`.
  */
@@ -123,6 +355,12 @@ struct li_unit_runner_options {
 	 */
 	int default_timeout;
 
+	/**
+	 * If non-zero, the default timeout in milliseconds, used
+	 * instead of ``default_timeout``. -1 for no timeouts.
+	 */
+	long default_timeout_ms;
+
 	/**
 	 * Number of jobs to run in parallel.
 	 */
@@ -133,6 +371,147 @@ struct li_unit_runner_options {
 	 */
 	unsigned int status_update_frequency;
 
+	/**
+	 * True if test processes should be forked from a zygote: a
+	 * small process forked when the run starts, before the runner
+	 * gathers any state. This keeps the cost of spawning a test
+	 * constant over the course of a run.
+	 */
+	bool use_zygote;
+
+	/**
+	 * True if each test should write its output straight into a
+	 * memfd (or an unlinked temporary file, if memfds are not
+	 * supported), rather than a pipe read by the runner. The
+	 * runner only reads the output of tests which fail.
+	 */
+	bool capture_to_memfd;
+
+	/**
+	 * True if each test should count instructions, cycles, cache
+	 * misses and branch misses with hardware counters, which are
+	 * reported as metrics of the test. Benchmarks also report them
+	 * per operation. Counts are much less noisy than times.
+	 */
+	bool perf_counters;
+
+	/**
+	 * The most bytes of output kept from each test, split between
+	 * the start and end of its output, or 0 for no limit. Output
+	 * is only kept from tests which fail.
+	 */
+	size_t output_limit;
+
+	/**
+	 * The most bytes of output from failed tests kept in memory
+	 * until the end of the run, or 0 for no limit. Past this,
+	 * output is moved to a temporary file.
+	 */
+	size_t output_budget;
+
+	/**
+	 * If non-NULL, files to write reports in JSON Lines, JUnit XML
+	 * and TAP formats to ("-" for stdout). Each test's record is
+	 * written as soon as it completes, with its output if it was
+	 * read (see ``capture_to_memfd``).
+	 */
+	const char *report_jsonl;
+	const char *report_junit;
+	const char *report_tap;
+
+	/**
+	 * If non-NULL, a file which records how long each test took.
+	 * Tests are started longest first, based on the times from
+	 * previous runs, and the file is updated after the run.
+	 */
+	const char *history_file;
+
+	/**
+	 * If non-NULL, a file which caches the tests which passed. A
+	 * test is skipped, and reported as cached, if it passed before
+	 * with the same binary (by content), name, options and limits.
+	 * For tests in this process, the binary includes every shared
+	 * object loaded into it; for tests in another executable
+	 * (``argv``), only that executable is hashed, not its shared
+	 * libraries.
+	 * Benchmarks and fuzz targets are always run. Only the
+	 * ``cache_size`` (default 10000) most recently used tests are
+	 * kept. With ``no_cache``, every test is run, but the cache is
+	 * still updated.
+	 */
+	const char *cache_file;
+	size_t cache_size;
+	bool no_cache;
+
+	/**
+	 * The number of shards a run is split into (for example, across
+	 * several machines), or 0 to run all tests.
+	 */
+	unsigned int total_shards;
+
+	/**
+	 * The index of the shard to run, from 0 to ``total_shards - 1``.
+	 * Shards are balanced by the durations in ``history_file``, so
+	 * every shard should be given the same history.
+	 */
+	unsigned int shard_index;
+
+	/**
+	 * If non-NULL, a file to save the samples of each benchmark in,
+	 * as a baseline to compare later runs with.
+	 */
+	const char *save_baseline;
+
+	/**
+	 * If non-NULL, a baseline file to compare the samples of each
+	 * benchmark with. A benchmark fails if it is significantly
+	 * slower than its baseline: if the Mann-Whitney U test gives a
+	 * p-value below ``baseline_alpha`` (default 0.01) for it being
+	 * slower, and its median is more than ``baseline_threshold``
+	 * (default 0.05, for 5%) higher.
+	 */
+	const char *compare_baseline;
+	double baseline_alpha;
+	double baseline_threshold;
+
+	/**
+	 * True to fuzz the selected fuzz targets, rather than run the
+	 * tests. Each target is fuzzed by ``parallelism`` worker
+	 * processes for ``fuzz_seconds`` (or until interrupted, if 0),
+	 * keeping the inputs which reach new code in
+	 * ``fuzz_dir/<name>/corpus`` and those which fail in
+	 * ``fuzz_dir/<name>/crashes``.
+	 */
+	bool fuzz;
+	unsigned int fuzz_seconds;
+
+	/**
+	 * If non-NULL, the directory fuzz targets keep their inputs
+	 * in. When running tests, each fuzz target is run on the
+	 * inputs saved there, which replays any crashes.
+	 */
+	const char *fuzz_dir;
+
+	/**
+	 * Limits on each test process, or 0 for no limit: the memory
+	 * it may use in KiB (its address space, unless ``cgroup`` is
+	 * set), the file descriptors it may have open, and the
+	 * processes it may have (which needs ``cgroup``). Tests run in
+	 * threads are not limited.
+	 */
+	size_t memory_limit_kb;
+	unsigned int fd_limit;
+	unsigned int process_limit;
+
+	/**
+	 * If non-NULL, a cgroup v2 directory delegated to the runner.
+	 * Each test runs in a new cgroup under it, which applies the
+	 * memory and process limits to the test as a whole and records
+	 * its peak memory use. Anything the test leaves running is
+	 * killed when it exits.
+	 */
+	const char *cgroup;
+
 	/**
 	 * Filter function to determine which tests to run. Takes a
 	 * :c:type:`struct li_unit_test *` and a user-defined
@@ -166,6 +545,40 @@ int li_unit_run_tests(struct li_unit_runner_options *options);
  */
 void __noreturn li_unit_run_test(const struct li_unit_test *test);
 
+/**
+ * Run a single test in the calling thread, and return when it
+ * completes. A failed assertion unwinds the test instead of exiting
+ * the process.
+ *
+ * :param test: The test to run.
+ * :param out: The stream to write messages from the test to.
+ * :param result: If non-NULL, where to store what the test reported.
+ * :return: True if the test succeeded, false otherwise.
+ */
+bool li_unit_run_test_in_thread(const struct li_unit_test *test, FILE *out,
+				struct li_unit_result *result);
+
+/**
+ * Report a custom metric from the running test to the test runner.
+ * Metrics are not compared with a baseline, as there is no telling
+ * whether higher or lower is better.
+ *
+ * :param name: The name of the metric.
+ * :param value: The value of the metric.
+ */
+void li_unit_report_metric(const char *name, double value);
+
+/**
+ * Report one sample of a benchmark from the running test to the test
+ * runner. With a baseline, the test fails if its samples are
+ * significantly higher than those of the baseline.
+ *
+ * :param name: The name of the measurement.
+ * :param ns_per_op: The time per operation over the sample, in
+ *                   nanoseconds.
+ */
+void li_unit_report_bench_sample(const char *name, double ns_per_op);
+
 /**
  * Macro used to define a test.
  *
@@ -189,28 +602,296 @@ void __noreturn li_unit_run_test(const struct li_unit_test *test);
 #define _LI_DEFTEST(name, function_id, options) \
 	_LI_DEFTEST2(name, function_id, options)
 
-#define _LI_DEFTEST2(NAME, FUNCTION_ID, OPTIONS)            \
-	static void FUNCTION_ID(void);                      \
-	static __constructor void setup_##FUNCTION_ID(void) \
-	{                                                   \
-		static struct li_unit_test this_test = {    \
-			.name = NAME,                       \
-			.func = FUNCTION_ID,                \
-			.options = OPTIONS,                 \
-		};                                          \
-		this_test.rest = li_unit_test_list;         \
-		li_unit_test_list = &this_test;             \
-	}                                                   \
+/*
+ * Each test is a static entry, with a pointer to it in the
+ * li_unit_tests section. The linker gathers the pointers from every
+ * file into one array, between __start_li_unit_tests and
+ * __stop_li_unit_tests, so registering tests costs nothing at
+ * startup. (Pointers are used rather than the entries themselves, as
+ * the compiler may pad between larger objects.)
+ */
+#define _LI_UNIT_TEST_SECTION \
+	__attribute__((used, section("li_unit_tests"), aligned(sizeof(void *))))
+
+#define _LI_DEFTEST2(NAME, FUNCTION_ID, OPTIONS)                            \
+	static void FUNCTION_ID(void);                                      \
+	static struct li_unit_test test_##FUNCTION_ID = {                   \
+		.name = NAME,                                               \
+		.func = FUNCTION_ID,                                        \
+		.options = OPTIONS,                                         \
+	};                                                                  \
+	static struct li_unit_test *const _LI_UNIT_TEST_SECTION             \
+		entry_##FUNCTION_ID = &test_##FUNCTION_ID;                  \
 	static void FUNCTION_ID(void)
 
-void _li_unit_test_assert(bool result, const char *fail_msg);
-bool _li_unit_test_expect(bool result, const char *fail_msg);
+/**
+ * Macro used to define a test for each element of an array. The body
+ * is a function of ``param``, a pointer to one element::
+
+    static const struct { const char *input; int expected; } cases[] = {
+        { "0", 0 },
+        { "-17", -17 },
+    };
+
+    DEFTEST_P("myproject.utils.parse_int", {}, cases)
+    {
+        EXPECT(parse_int(param->input) == param->expected);
+    }
+
+ * Each element becomes its own test, named after its index in the
+ * array (``myproject.utils.parse_int/0`` and so on), which is
+ * scheduled, filtered and reported separately. The tests are created
+ * when the registry is first used, so thousands of cases cost nothing
+ * at startup.
+ *
+ * :param name: The name of the tests, as for :c:macro:`DEFTEST`.
+ * :param options: A :c:type:`struct li_unit_test_options` literal,
+ *                 which applies to every test.
+ * :param params: A static array of parameters.
+ */
+#ifdef LITHIUM_TEST_BUILD
+#define DEFTEST_P(name, options, params) \
+	_LI_DEFTEST_P(name, CONCAT2(li_testfunc_, __LINE__), options, params)
+#else
+#define DEFTEST_P(name, options, params)                                \
+	static void __maybe_unused __discard CONCAT2(                   \
+		li_discarded_testfunc_,                                 \
+		__LINE__)(const typeof((params)[0]) *param)
+#endif
 
-void _li_unit_test_assert_null(const void *ptr, const char *fail_msg);
-bool _li_unit_test_expect_null(const void *ptr, const char *fail_msg);
+#define _LI_DEFTEST_P(name, function_id, options, params) \
+	_LI_DEFTEST_P2(name, function_id, options, params)
+
+#define _LI_DEFTEST_P2(NAME, FUNCTION_ID, OPTIONS, PARAMS)                  \
+	static void FUNCTION_ID(const typeof((PARAMS)[0]) *param);          \
+	static void FUNCTION_ID##_param(const void *param)                  \
+	{                                                                   \
+		FUNCTION_ID(param);                                         \
+	}                                                                   \
+	static struct li_unit_test test_##FUNCTION_ID = {                   \
+		.name = NAME,                                               \
+		.param_func = FUNCTION_ID##_param,                          \
+		.params = PARAMS,                                           \
+		.n_params = ARRAY_SIZE(PARAMS),                             \
+		.param_size = sizeof((PARAMS)[0]),                          \
+		.options = OPTIONS,                                         \
+	};                                                                  \
+	static struct li_unit_test *const _LI_UNIT_TEST_SECTION             \
+		entry_##FUNCTION_ID = &test_##FUNCTION_ID;                  \
+	static void FUNCTION_ID(const typeof((PARAMS)[0]) *param)
 
-void _li_unit_test_assert_not_null(const void *ptr, const char *fail_msg);
-bool _li_unit_test_expect_not_null(const void *ptr, const char *fail_msg);
+/**
+ * Macro used to define a benchmark. The body is a function of
+ * ``struct li_unit_bench *bench``, which should do any setup, then
+ * run the code to measure in a :c:macro:`BENCH_LOOP`::
+
+    DEFBENCH("myproject.utils.math.fibonacci", {})
+    {
+        int n = 20;
+
+        BENCH_LOOP(bench) {
+            DO_NOT_OPTIMIZE(n);
+            DO_NOT_OPTIMIZE(fibonacci(n));
+        }
+    }
+
+ * The harness calls the body with growing iteration counts until a
+ * call takes long enough to time accurately, warms up, and then times
+ * a series of samples. It reports the time per operation (as the
+ * median, mean, standard deviation, minimum and maximum over the
+ * samples) and throughput as metrics of the test, along with each
+ * sample.
+ *
+ * :param name: The name of the benchmark, as for :c:macro:`DEFTEST`.
+ * :param options: A :c:type:`struct li_unit_test_options` literal.
+ */
+#ifdef LITHIUM_TEST_BUILD
+#define DEFBENCH(name, options) \
+	_LI_DEFBENCH(name, CONCAT2(li_benchfunc_, __LINE__), options)
+#else
+#define DEFBENCH(name, options)                         \
+	static void __maybe_unused __discard CONCAT2(   \
+		li_discarded_benchfunc_,                \
+		__LINE__)(struct li_unit_bench * bench)
+#endif
+
+#define _LI_DEFBENCH(name, function_id, options) \
+	_LI_DEFBENCH2(name, function_id, options)
+
+#define _LI_DEFBENCH2(NAME, FUNCTION_ID, OPTIONS)                           \
+	static void FUNCTION_ID(struct li_unit_bench *bench);               \
+	static struct li_unit_test test_##FUNCTION_ID = {                   \
+		.name = NAME,                                               \
+		.bench = FUNCTION_ID,                                       \
+		.options = OPTIONS,                                         \
+	};                                                                  \
+	static struct li_unit_test *const _LI_UNIT_TEST_SECTION             \
+		entry_##FUNCTION_ID = &test_##FUNCTION_ID;                  \
+	static void FUNCTION_ID(struct li_unit_bench *bench)
+
+/**
+ * Macro used to define a fuzz target. The body is a function of
+ * ``const uint8_t *data`` and ``size_t size``, which should feed the
+ * input to the code under test, and check what it can with
+ * :c:macro:`EXPECT`::
+
+    DEFFUZZ("myproject.utils.parse_int", {})
+    {
+        char buf[32];
+        int value;
+
+        if (size >= sizeof(buf))
+            return;
+        memcpy(buf, data, size);
+        buf[size] = '\0';
+        if (parse_int(buf, &value) == 0)
+            EXPECT(value == atoi(buf));
+    }
+
+ * Run as a test, the target is tried on the empty input and every
+ * input saved for it in the fuzz directory, if any. With ``--fuzz``,
+ * the runner instead mutates inputs for it in a loop, guided by
+ * coverage when built with ``make fuzz``, and saves any that crash or
+ * fail an assertion.
+ *
+ * :param name: The name of the fuzz target, as for :c:macro:`DEFTEST`.
+ * :param options: A :c:type:`struct li_unit_test_options` literal.
+ */
+#ifdef LITHIUM_TEST_BUILD
+#define DEFFUZZ(name, options) \
+	_LI_DEFFUZZ(name, CONCAT2(li_fuzzfunc_, __LINE__), options)
+#else
+#define DEFFUZZ(name, options)                                   \
+	static void __maybe_unused __discard CONCAT2(            \
+		li_discarded_fuzzfunc_,                          \
+		__LINE__)(const uint8_t * data, size_t size)
+#endif
+
+#define _LI_DEFFUZZ(name, function_id, options) \
+	_LI_DEFFUZZ2(name, function_id, options)
+
+#define _LI_DEFFUZZ2(NAME, FUNCTION_ID, OPTIONS)                            \
+	static void FUNCTION_ID(const uint8_t *data, size_t size);          \
+	static struct li_unit_test test_##FUNCTION_ID = {                   \
+		.name = NAME,                                               \
+		.fuzz = FUNCTION_ID,                                        \
+		.options = OPTIONS,                                         \
+	};                                                                  \
+	static struct li_unit_test *const _LI_UNIT_TEST_SECTION             \
+		entry_##FUNCTION_ID = &test_##FUNCTION_ID;                  \
+	static void FUNCTION_ID(const uint8_t *data, size_t size)
+
+/**
+ * Run the following statement ``bench->iterations`` times, timing
+ * only the loop.
+ */
+#define BENCH_LOOP(bench)                                          \
+	for (uint64_t _li_bench_left = _li_unit_bench_start(bench); \
+	     _li_bench_left || _li_unit_bench_stop(bench); _li_bench_left--)
+
+uint64_t _li_unit_bench_start(struct li_unit_bench *bench);
+bool _li_unit_bench_stop(struct li_unit_bench *bench);
+
+/* Private to the timing assertions: per-iteration timings of one or
+   two blocks, which take turns */
+struct li_unit_timing {
+	uint64_t *samples[2];
+	uint64_t iterations;
+	uint64_t done;
+	uint64_t start_ns;
+	uint64_t overhead_ns;
+	unsigned int n_blocks;
+	unsigned int block;
+	bool running;
+	bool failed_alloc;
+};
+
+struct li_unit_timing _li_unit_timing_begin(uint64_t iterations,
+					    unsigned int n_blocks);
+bool _li_unit_timing_next(struct li_unit_timing *timing);
+void _li_unit_timing_check_within(struct li_unit_timing *timing,
+				  uint64_t limit_ns, double percentile,
+				  bool fatal, const char *fail_msg);
+void _li_unit_timing_check_faster(struct li_unit_timing *timing,
+				  double factor, bool fatal,
+				  const char *fail_msg);
+
+/**
+ * Make the compiler assume that ``value`` is used, so the code which
+ * computes it is not optimized away. ``value`` should fit in a
+ * register, or be an lvalue.
+ */
+#define DO_NOT_OPTIMIZE(value) __asm__ volatile("" : : "r,m"(value) : "memory")
+
+/**
+ * Make the compiler assume that all memory is read and written here,
+ * so that stores before it are not optimized away.
+ */
+#define CLOBBER_MEMORY() __asm__ volatile("" : : : "memory")
+
+#ifdef LITHIUM_TEST_BUILD
+/* Defined by the linker in each module with tests. They are hidden, so
+   each module sees its own section, and weak, so they are NULL in a
+   module without any. */
+extern struct li_unit_test *const __start_li_unit_tests[]
+	__attribute__((weak, visibility("hidden")));
+extern struct li_unit_test *const __stop_li_unit_tests[]
+	__attribute__((weak, visibility("hidden")));
+
+static __constructor void _li_unit_register_module(void)
+{
+	li_unit_register_tests(__start_li_unit_tests, __stop_li_unit_tests);
+}
+#endif
+
+/* Assertions are checked inline, and passing ones only bump this
+   count, so that they are cheap in hot loops. Failures are handled
+   out of line. */
+extern _Thread_local size_t _li_unit_successful_assertions;
+
+void __noreturn _li_unit_test_assert_failed(const char *fail_msg);
+bool _li_unit_test_expect_failed(const char *fail_msg);
+
+static inline void _li_unit_test_assert(bool result, const char *fail_msg)
+{
+	if (likely(result))
+		_li_unit_successful_assertions++;
+	else
+		_li_unit_test_assert_failed(fail_msg);
+}
+
+static inline bool _li_unit_test_expect(bool result, const char *fail_msg)
+{
+	if (likely(result)) {
+		_li_unit_successful_assertions++;
+		return true;
+	}
+	return _li_unit_test_expect_failed(fail_msg);
+}
+
+static inline void _li_unit_test_assert_null(const void *ptr,
+					     const char *fail_msg)
+{
+	_li_unit_test_assert(!ptr, fail_msg);
+}
+
+static inline bool _li_unit_test_expect_null(const void *ptr,
+					     const char *fail_msg)
+{
+	return _li_unit_test_expect(!ptr, fail_msg);
+}
+
+static inline void _li_unit_test_assert_not_null(const void *ptr,
+						 const char *fail_msg)
+{
+	_li_unit_test_assert(ptr, fail_msg);
+}
+
+static inline bool _li_unit_test_expect_not_null(const void *ptr,
+						 const char *fail_msg)
+{
+	return _li_unit_test_expect(ptr, fail_msg);
+}
 
 void __test_only _li_unit_test_error_assert(bool discarded_expr);
 bool __test_only _li_unit_test_error_expect(bool discarded_expr);
@@ -255,6 +936,73 @@ bool __test_only _li_unit_test_error_expect(bool discarded_expr);
 		ptr,                                                   \
 		_LI_UNIT_FORMAT_FAIL_STRING(EXPECT_NOT_NULL, __FILE__, \
 					    __LINE__, "pointer is NULL", ptr))
+
+#define _LI_UNIT_WITHIN_NS(macro, fatal, limit_ns, percentile, iterations) \
+	for (struct li_unit_timing _li_timing =                            \
+		     _li_unit_timing_begin(iterations, 1);                 \
+	     _li_unit_timing_next(&_li_timing) ||                          \
+	     (_li_unit_timing_check_within(                                \
+		      &_li_timing, limit_ns, percentile, fatal,            \
+		      _LI_UNIT_FORMAT_FAIL_STRING(macro, __FILE__,         \
+						  __LINE__,                \
+						  "block is too slow",     \
+						  limit_ns)),              \
+	      false);)
+
+/**
+ * Run the following block ``iterations`` times, timing each run, and
+ * check that the given percentile (from 0 to 100) of the times is at
+ * most ``limit_ns`` nanoseconds. For example, to check that parsing a
+ * message takes under 2 microseconds at the 99th percentile::
+
+    EXPECT_WITHIN_NS(2000, 99, 10000) {
+        DO_NOT_OPTIMIZE(parse_message(msg));
+    }
+
+ * The overhead of reading the clock is subtracted from each time, but
+ * the block should still take much longer than that (tens of
+ * nanoseconds), or else be measured by a :c:macro:`DEFBENCH`. On
+ * failure, the distribution of times is printed.
+ */
+#define EXPECT_WITHIN_NS(limit_ns, percentile, iterations) \
+	_LI_UNIT_WITHIN_NS(EXPECT_WITHIN_NS, false, limit_ns, percentile, \
+			   iterations)
+#define ASSERT_WITHIN_NS(limit_ns, percentile, iterations) \
+	_LI_UNIT_WITHIN_NS(ASSERT_WITHIN_NS, true, limit_ns, percentile, \
+			   iterations)
+
+#define _LI_UNIT_FASTER_THAN(macro, fatal, factor, iterations)             \
+	for (struct li_unit_timing _li_timing =                            \
+		     _li_unit_timing_begin(iterations, 2);                 \
+	     _li_unit_timing_next(&_li_timing) ||                          \
+	     (_li_unit_timing_check_faster(                                \
+		      &_li_timing, factor, fatal,                          \
+		      _LI_UNIT_FORMAT_FAIL_STRING(macro, __FILE__,         \
+						  __LINE__,                \
+						  "block is not faster by", \
+						  factor)),                \
+	      false);)                                                     \
+		if (_li_timing.block == 0)
+
+/**
+ * Run two blocks ``iterations`` times each, taking turns so that both
+ * see the same conditions, and check that the median time of the first
+ * is at least ``factor`` times faster than that of the second, which is
+ * given after an ``else``::
+
+    EXPECT_FASTER_THAN(1.5, 10000) {
+        DO_NOT_OPTIMIZE(new_parse(msg));
+    } else {
+        DO_NOT_OPTIMIZE(old_parse(msg));
+    }
+
+ * As for :c:macro:`EXPECT_WITHIN_NS`, each block should take much
+ * longer than reading the clock.
+ */
+#define EXPECT_FASTER_THAN(factor, iterations) \
+	_LI_UNIT_FASTER_THAN(EXPECT_FASTER_THAN, false, factor, iterations)
+#define ASSERT_FASTER_THAN(factor, iterations) \
+	_LI_UNIT_FASTER_THAN(ASSERT_FASTER_THAN, true, factor, iterations)
 #else
 #define ASSERT(expr) _li_unit_test_error_assert(expr)
 #define EXPECT(expr) _li_unit_test_error_expect(expr)
@@ -262,6 +1010,14 @@ bool __test_only _li_unit_test_error_expect(bool discarded_expr);
 #define EXPECT_NULL(expr) _li_unit_test_error_expect(expr)
 #define ASSERT_NOT_NULL(expr) _li_unit_test_error_assert(expr)
 #define EXPECT_NOT_NULL(expr) _li_unit_test_error_expect(expr)
+#define EXPECT_WITHIN_NS(limit_ns, percentile, iterations) \
+	if (_li_unit_test_error_expect(false))
+#define ASSERT_WITHIN_NS(limit_ns, percentile, iterations) \
+	if (_li_unit_test_error_expect(false))
+#define EXPECT_FASTER_THAN(factor, iterations) \
+	if (_li_unit_test_error_expect(false))
+#define ASSERT_FASTER_THAN(factor, iterations) \
+	if (_li_unit_test_error_expect(false))
 #endif
 
 #endif /* LITHIUM_UNIT_H_ */
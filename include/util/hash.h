@@ -0,0 +1,28 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_UTIL_HASH_H_
+#define LITHIUM_UTIL_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Initial value for :c:func:`li_util_fnv1a_64`.
+ */
+#define LI_UTIL_FNV1A_64_INIT 0xcbf29ce484222325ULL
+
+/**
+ * Compute the 64-bit FNV-1a hash of some data.
+ *
+ * :param hash: :c:macro:`LI_UTIL_FNV1A_64_INIT`, or the result of a
+ *              previous call to continue hashing.
+ * :param data: The data to hash.
+ * :param len: The length of the data, in bytes.
+ * :return: The updated hash.
+ */
+uint64_t li_util_fnv1a_64(uint64_t hash, const void *data, size_t len);
+
+#endif /* LITHIUM_UTIL_HASH_H_ */
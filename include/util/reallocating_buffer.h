@@ -17,4 +17,13 @@ struct li_reallocating_buffer {
 ssize_t li_reallocating_buffer_read(int fd, struct li_reallocating_buffer *buf,
 				    size_t n_bytes);
 
+/**
+ * Append ``len`` bytes of ``data`` to the buffer, growing it as
+ * needed.
+ *
+ * :return: 0 on success, -1 if memory could not be allocated.
+ */
+int li_reallocating_buffer_append(struct li_reallocating_buffer *buf,
+				  const void *data, size_t len);
+
 #endif /* LITHIUM_UTIL_REALLOCATING_BUFFER_H_ */
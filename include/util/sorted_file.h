@@ -0,0 +1,59 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_UTIL_SORTED_FILE_H_
+#define LITHIUM_UTIL_SORTED_FILE_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Helpers for the text files the test runner keeps between runs (the
+ * history, baselines and the cache). Each is loaded into an array of
+ * entries, sorted so that it can be searched. Entries recorded during
+ * the run are appended after the sorted ones, and merged in when the
+ * file is saved. Files are saved sorted, but may have been edited by
+ * hand, so what was loaded is always sorted again.
+ */
+
+/**
+ * Read a file line by line. A missing file has no lines.
+ *
+ * :param parse_line: Called with each line, less its newline. Returns
+ *                    0 on success, 1 if the line is malformed (and
+ *                    should be skipped with a warning), or -1 to stop
+ *                    with an error.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_util_sorted_file_load(const char *path,
+			     int (*parse_line)(char *line, void *data),
+			     void *data);
+
+/**
+ * Merge the entries after the first ``n_sorted``, which were recorded
+ * since the file was loaded, into the sorted ones. Of entries which
+ * compare equal, the last one recorded is kept.
+ *
+ * :param n_merged: Set to the number of entries in the result.
+ * :return: A newly allocated sorted array of copies of the entries
+ *          (which keep pointing to whatever the originals did), or NULL
+ *          on failure.
+ */
+void *li_util_sorted_merge(const void *entries, size_t n_sorted,
+			   size_t n_entries, size_t size,
+			   int (*cmp)(const void *a, const void *b),
+			   size_t *n_merged);
+
+/**
+ * Atomically replace a file with one line per entry, written by
+ * ``write_entry``.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_util_sorted_file_save(const char *path, const void *entries,
+			     size_t n_entries, size_t size,
+			     void (*write_entry)(FILE *f, const void *entry));
+
+#endif /* LITHIUM_UTIL_SORTED_FILE_H_ */
@@ -16,4 +16,6 @@ void li_util_timespec_subtract(const struct timespec *a,
 
 bool li_util_timespec_lt(const struct timespec *a, const struct timespec *b);
 
+void li_util_timespec_add_ms(struct timespec *ts, long ms);
+
 #endif /* LITHIUM_UTIL_TIMESPEC_H_ */
@@ -0,0 +1,11 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include "unit.h"
+
+int main(int argc, const char *const argv[])
+{
+	return li_unit_meta_runner_main(argv);
+}
@@ -65,6 +65,26 @@ DEFTEST("lithium.cmdline.internals.parse_from_format",
 	EXPECT(!parse_from_format("%u", "-123", &uint_dest));
 }
 
+DEFFUZZ("lithium.cmdline.internals.parse_from_format.fuzz", {})
+{
+	char value[64], printed[32];
+	int int_dest, reparsed;
+	double double_dest;
+
+	if (size >= sizeof(value))
+		return;
+	memcpy(value, data, size);
+	value[size] = '\0';
+
+	/* Whatever parses should print and parse back the same */
+	if (parse_from_format("%d", value, &int_dest)) {
+		snprintf(printed, sizeof(printed), "%d", int_dest);
+		EXPECT(parse_from_format("%d", printed, &reparsed));
+		EXPECT(reparsed == int_dest);
+	}
+	parse_from_format("%lf", value, &double_dest);
+}
+
 static bool complete_action(struct li_cmdline_action *action, const char *value)
 {
 	switch (action->type) {
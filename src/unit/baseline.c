@@ -0,0 +1,337 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "baseline.h"
+#include "unit.h"
+#include "util/sorted_file.h"
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct li_unit_baseline_entry *ea = a;
+	const struct li_unit_baseline_entry *eb = b;
+	int cmp = strcmp(ea->test, eb->test);
+
+	return cmp ? cmp : strcmp(ea->name, eb->name);
+}
+
+static void free_entry(struct li_unit_baseline_entry *entry)
+{
+	free(entry->test);
+	free(entry->name);
+	free(entry->samples);
+}
+
+/*
+ * Takes ownership of the strings and samples of the entry, freeing
+ * them on failure.
+ */
+static int append_entry(struct li_unit_baseline *baseline,
+			struct li_unit_baseline_entry *entry)
+{
+	if (baseline->n_entries == baseline->entries_allocation) {
+		size_t new_allocation = baseline->entries_allocation * 2 + 16;
+		struct li_unit_baseline_entry *new_entries =
+			realloc(baseline->entries,
+				new_allocation * sizeof(*new_entries));
+
+		if (!new_entries) {
+			free_entry(entry);
+			return -1;
+		}
+		baseline->entries = new_entries;
+		baseline->entries_allocation = new_allocation;
+	}
+
+	baseline->entries[baseline->n_entries++] = *entry;
+	return 0;
+}
+
+/*
+ * Parse "<test>\t<name>\t<samples...>", modifying the line.
+ */
+static int parse_entry(char *line, struct li_unit_baseline_entry *entry)
+{
+	char *name = strchr(line, '\t');
+	char *samples = name ? strchr(name + 1, '\t') : NULL;
+	size_t allocation = 0;
+
+	if (!samples || name == line || samples == name + 1)
+		return -1;
+	*name++ = '\0';
+	*samples++ = '\0';
+
+	memset(entry, 0, sizeof(*entry));
+	for (char *end, *s = samples;; s = end) {
+		double value = strtod(s, &end);
+
+		if (end == s)
+			break;
+
+		if (entry->n_samples == allocation) {
+			double *new_samples;
+
+			allocation = allocation * 2 + 16;
+			new_samples = realloc(entry->samples,
+					      allocation * sizeof(double));
+			if (!new_samples) {
+				free(entry->samples);
+				return -1;
+			}
+			entry->samples = new_samples;
+		}
+		entry->samples[entry->n_samples++] = value;
+	}
+
+	entry->test = strdup(line);
+	entry->name = strdup(name);
+	if (!entry->n_samples || !entry->test || !entry->name) {
+		free_entry(entry);
+		return -1;
+	}
+	return 0;
+}
+
+static int parse_line(char *line, void *data)
+{
+	struct li_unit_baseline *baseline = data;
+	struct li_unit_baseline_entry entry;
+
+	if (parse_entry(line, &entry) < 0)
+		return 1;
+
+	if (append_entry(baseline, &entry) < 0) {
+		perror("failed to load baseline");
+		return -1;
+	}
+	return 0;
+}
+
+int li_unit_baseline_load(struct li_unit_baseline *baseline,
+			  const char *path)
+{
+	if (li_util_sorted_file_load(path, parse_line, baseline) < 0)
+		return -1;
+
+	qsort(baseline->entries, baseline->n_entries,
+	      sizeof(*baseline->entries), entry_cmp);
+	baseline->n_sorted = baseline->n_entries;
+	return 0;
+}
+
+const struct li_unit_baseline_entry *
+li_unit_baseline_lookup(const struct li_unit_baseline *baseline,
+			const char *test, const char *name)
+{
+	struct li_unit_baseline_entry key = {
+		.test = (char *)test,
+		.name = (char *)name,
+	};
+
+	return bsearch(&key, baseline->entries, baseline->n_sorted,
+		       sizeof(*baseline->entries), entry_cmp);
+}
+
+int li_unit_baseline_record(struct li_unit_baseline *baseline,
+			    const char *test, const char *name,
+			    const double *samples, size_t n_samples)
+{
+	struct li_unit_baseline_entry entry = {
+		.test = strdup(test),
+		.name = strdup(name),
+		.samples = calloc(n_samples, sizeof(*samples)),
+		.n_samples = n_samples,
+	};
+
+	if (!entry.test || !entry.name || !entry.samples) {
+		free_entry(&entry);
+		perror("failed to record baseline");
+		return -1;
+	}
+
+	memcpy(entry.samples, samples, n_samples * sizeof(*samples));
+	if (append_entry(baseline, &entry) < 0) {
+		perror("failed to record baseline");
+		return -1;
+	}
+	return 0;
+}
+
+static void write_entry(FILE *f, const void *data)
+{
+	const struct li_unit_baseline_entry *entry = data;
+
+	fprintf(f, "%s\t%s\t", entry->test, entry->name);
+	for (size_t i = 0; i < entry->n_samples; i++)
+		fprintf(f, "%s%.17g", i ? " " : "", entry->samples[i]);
+	fprintf(f, "\n");
+}
+
+int li_unit_baseline_save(struct li_unit_baseline *baseline,
+			  const char *path)
+{
+	size_t n_merged;
+	struct li_unit_baseline_entry *merged = li_util_sorted_merge(
+		baseline->entries, baseline->n_sorted, baseline->n_entries,
+		sizeof(*baseline->entries), entry_cmp, &n_merged);
+	int rv;
+
+	if (!merged)
+		return -1;
+
+	rv = li_util_sorted_file_save(path, merged, n_merged, sizeof(*merged),
+				      write_entry);
+	free(merged);
+	return rv;
+}
+
+void li_unit_baseline_free(struct li_unit_baseline *baseline)
+{
+	for (size_t i = 0; i < baseline->n_entries; i++)
+		free_entry(&baseline->entries[i]);
+	free(baseline->entries);
+	memset(baseline, 0, sizeof(*baseline));
+}
+
+struct ranked_sample {
+	double value;
+	bool from_b;
+};
+
+static int ranked_sample_cmp(const void *a, const void *b)
+{
+	const struct ranked_sample *sa = a;
+	const struct ranked_sample *sb = b;
+
+	return (sa->value > sb->value) - (sa->value < sb->value);
+}
+
+double li_unit_mann_whitney_p(const double *a, size_t n_a, const double *b,
+			      size_t n_b)
+{
+	size_t n = n_a + n_b;
+	struct ranked_sample *all;
+	double rank_sum_b = 0;
+	double tie_term = 0;
+
+	if (!n_a || !n_b)
+		return 1;
+
+	all = calloc(n, sizeof(*all));
+	if (!all) {
+		perror("calloc failed");
+		return 1;
+	}
+
+	for (size_t i = 0; i < n_a; i++)
+		all[i].value = a[i];
+	for (size_t i = 0; i < n_b; i++)
+		all[n_a + i] = (struct ranked_sample){ b[i], true };
+	qsort(all, n, sizeof(*all), ranked_sample_cmp);
+
+	/* Tied samples share the mean of the ranks they span */
+	for (size_t i = 0, j; i < n; i = j) {
+		double rank, ties;
+
+		for (j = i; j < n && all[j].value == all[i].value; j++)
+			;
+		rank = (i + 1 + j) / 2.0;
+		ties = j - i;
+		tie_term += ties * ties * ties - ties;
+
+		for (size_t k = i; k < j; k++) {
+			if (all[k].from_b)
+				rank_sum_b += rank;
+		}
+	}
+	free(all);
+
+	double u_b = rank_sum_b - n_b * (n_b + 1) / 2.0;
+	double mean = n_a * n_b / 2.0;
+	double variance = n_a * n_b / 12.0 *
+			  ((n + 1) - tie_term / ((double)n * (n - 1)));
+
+	/* Every sample is the same */
+	if (variance <= 0)
+		return 1;
+
+	double z = (u_b - mean - 0.5) / sqrt(variance);
+
+	return 0.5 * erfc(z / M_SQRT2);
+}
+
+DEFTEST("lithium.unit.baseline.mann_whitney",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	const double fast[] = { 10.1, 9.8, 10.3, 10.0, 9.9, 10.2, 10.1, 9.7,
+				10.0, 10.4 };
+	const double slow[] = { 11.2, 11.0, 10.9, 11.5, 11.1, 10.8, 11.3,
+				11.0, 11.4, 10.9 };
+	const double mixed[] = { 10.0, 10.2, 9.9, 10.1, 10.3, 9.8, 10.0,
+				 10.2, 9.9, 10.1 };
+
+	EXPECT(li_unit_mann_whitney_p(fast, ARRAY_SIZE(fast), slow,
+				      ARRAY_SIZE(slow)) < 0.001);
+	EXPECT(li_unit_mann_whitney_p(slow, ARRAY_SIZE(slow), fast,
+				      ARRAY_SIZE(fast)) > 0.999);
+	EXPECT(li_unit_mann_whitney_p(fast, ARRAY_SIZE(fast), mixed,
+				      ARRAY_SIZE(mixed)) > 0.1);
+	EXPECT(li_unit_mann_whitney_p(fast, ARRAY_SIZE(fast), fast,
+				      ARRAY_SIZE(fast)) > 0.4);
+	EXPECT(li_unit_mann_whitney_p(fast, 1, fast, 1) == 1);
+}
+
+DEFTEST("lithium.unit.baseline.save_and_load",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	char path[] = "/tmp/lithium_baseline_XXXXXX";
+	int fd = mkstemp(path);
+	struct li_unit_baseline baseline = { 0 };
+	const struct li_unit_baseline_entry *entry;
+	const double samples[] = { 1.5, 2.25, 3 };
+
+	ASSERT(fd >= 0);
+	close(fd);
+
+	EXPECT(li_unit_baseline_load(&baseline, path) == 0);
+	EXPECT(li_unit_baseline_record(&baseline, "b", "ns_per_op", samples,
+				       3) == 0);
+	EXPECT(li_unit_baseline_record(&baseline, "a", "ns_per_op", samples,
+				       2) == 0);
+	EXPECT(li_unit_baseline_save(&baseline, path) == 0);
+	li_unit_baseline_free(&baseline);
+
+	EXPECT(li_unit_baseline_load(&baseline, path) == 0);
+	EXPECT_NULL(li_unit_baseline_lookup(&baseline, "a", "other"));
+	entry = li_unit_baseline_lookup(&baseline, "b", "ns_per_op");
+	ASSERT_NOT_NULL(entry);
+	EXPECT(entry->n_samples == 3 && entry->samples[0] == 1.5 &&
+	       entry->samples[1] == 2.25 && entry->samples[2] == 3);
+
+	/* Newer samples replace older ones, and others are kept */
+	EXPECT(li_unit_baseline_record(&baseline, "b", "ns_per_op", samples,
+				       1) == 0);
+	EXPECT(li_unit_baseline_save(&baseline, path) == 0);
+	li_unit_baseline_free(&baseline);
+
+	EXPECT(li_unit_baseline_load(&baseline, path) == 0);
+	EXPECT(baseline.n_entries == 2);
+	entry = li_unit_baseline_lookup(&baseline, "a", "ns_per_op");
+	EXPECT(entry && entry->n_samples == 2);
+	entry = li_unit_baseline_lookup(&baseline, "b", "ns_per_op");
+	EXPECT(entry && entry->n_samples == 1);
+	li_unit_baseline_free(&baseline);
+
+	unlink(path);
+}
@@ -0,0 +1,85 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_BASELINE_H_
+#define LITHIUM_SRC_UNIT_BASELINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Benchmark samples from a previous run, to compare later runs with,
+ * keyed by test and sample name. On disk, this is a text file with one
+ * line per test and sample name: the test name, a tab, the sample
+ * name, a tab, and the samples separated by spaces.
+ */
+struct li_unit_baseline {
+	struct li_unit_baseline_entry {
+		char *test;
+		char *name;
+		double *samples;
+		size_t n_samples;
+	} * entries;
+	size_t n_entries;
+	size_t entries_allocation;
+
+	/* Number of entries (from the start) which are sorted. Entries
+	   after these were recorded during this run. */
+	size_t n_sorted;
+};
+
+/**
+ * Load a baseline from a file. A missing file is treated as an empty
+ * baseline.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_baseline_load(struct li_unit_baseline *baseline,
+			  const char *path);
+
+/**
+ * Look up the samples of a test in the baseline, as loaded.
+ *
+ * :return: The entry, or NULL if there is none.
+ */
+const struct li_unit_baseline_entry *
+li_unit_baseline_lookup(const struct li_unit_baseline *baseline,
+			const char *test, const char *name);
+
+/**
+ * Record the samples of a test. This does not affect lookups until the
+ * baseline is saved.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_baseline_record(struct li_unit_baseline *baseline,
+			    const char *test, const char *name,
+			    const double *samples, size_t n_samples);
+
+/**
+ * Merge the recorded samples into the baseline, and atomically replace
+ * the file with the result.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_baseline_save(struct li_unit_baseline *baseline,
+			  const char *path);
+
+void li_unit_baseline_free(struct li_unit_baseline *baseline);
+
+/**
+ * The Mann-Whitney U test, which compares two sets of samples by
+ * their ranks rather than their means, so it is not thrown off by
+ * outliers or by timings not being normally distributed. The normal
+ * approximation is used, with corrections for ties and continuity,
+ * which is accurate from about 8 samples each.
+ *
+ * :return: The one-sided p-value for the samples in ``b`` tending to
+ *          be larger than those in ``a``.
+ */
+double li_unit_mann_whitney_p(const double *a, size_t n_a, const double *b,
+			      size_t n_b);
+
+#endif /* LITHIUM_SRC_UNIT_BASELINE_H_ */
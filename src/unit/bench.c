@@ -0,0 +1,389 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "constants.h"
+#include "perf.h"
+#include "unit.h"
+
+/* How long each sample should take, to time it accurately */
+#define BENCH_SAMPLE_NS (10 * NSEC_PER_MSEC)
+
+/* How long to run the benchmark before timing it, so that caches and
+   branch predictors are warm and the CPU frequency has settled */
+#define BENCH_WARMUP_NS (50 * NSEC_PER_MSEC)
+
+#define BENCH_SAMPLES 20
+
+/* The most the iteration count grows by between calibration runs */
+#define BENCH_MAX_GROWTH 10
+#define BENCH_MAX_ITERATIONS (UINT64_C(1) << 40)
+
+/* How many times to read the clock to find its overhead, for the
+   timing assertions */
+#define TIMING_OVERHEAD_READS 64
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * NSEC_PER_SEC + now.tv_nsec;
+}
+
+uint64_t _li_unit_bench_start(struct li_unit_bench *bench)
+{
+	bench->looped = true;
+	bench->start_ns = now_ns();
+	return bench->iterations;
+}
+
+bool _li_unit_bench_stop(struct li_unit_bench *bench)
+{
+	bench->elapsed_ns = now_ns() - bench->start_ns;
+	return false;
+}
+
+static uint64_t run_sample(const struct li_unit_test *test,
+			   struct li_unit_bench *bench, uint64_t iterations)
+{
+	bench->iterations = iterations;
+	bench->elapsed_ns = 0;
+	bench->looped = false;
+	test->bench(bench);
+
+	/* Not counted as an assertion when it succeeds */
+	if (!bench->looped)
+		_li_unit_test_assert(false, "Benchmark failure, the body did "
+					    "not run BENCH_LOOP");
+	return bench->elapsed_ns;
+}
+
+/*
+ * Find an iteration count which takes about BENCH_SAMPLE_NS, aiming a
+ * little past it so that the next run should be long enough.
+ */
+static uint64_t calibrate(const struct li_unit_test *test,
+			  struct li_unit_bench *bench)
+{
+	uint64_t iterations = 1;
+
+	for (;;) {
+		uint64_t elapsed_ns = run_sample(test, bench, iterations);
+		uint64_t next = iterations * BENCH_MAX_GROWTH;
+
+		if (elapsed_ns >= BENCH_SAMPLE_NS ||
+		    iterations >= BENCH_MAX_ITERATIONS)
+			return iterations;
+
+		if (elapsed_ns &&
+		    (double)iterations * BENCH_SAMPLE_NS * 1.2 / elapsed_ns <
+			    next)
+			next = (double)iterations * BENCH_SAMPLE_NS * 1.2 /
+			       elapsed_ns;
+		if (next <= iterations)
+			next = iterations + 1;
+		iterations = next;
+	}
+}
+
+/*
+ * Read every counter the test is counting with. Returns false if there
+ * are none.
+ */
+static bool read_counters(uint64_t counts[LI_UNIT_PERF_N_COUNTERS],
+			  bool available[LI_UNIT_PERF_N_COUNTERS])
+{
+	const struct li_unit_perf_counters *counters =
+		li_unit_perf_test_counters();
+
+	if (!counters)
+		return false;
+
+	for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++)
+		available[i] = li_unit_perf_read(counters, i, &counts[i]);
+	return true;
+}
+
+/*
+ * Report the events counted over the samples, per operation. This
+ * includes the harness's own work between samples, which is small
+ * next to a sample's worth of iterations.
+ */
+static void report_counts_per_op(
+	const uint64_t before[LI_UNIT_PERF_N_COUNTERS],
+	const uint64_t after[LI_UNIT_PERF_N_COUNTERS],
+	const bool available[LI_UNIT_PERF_N_COUNTERS], uint64_t operations)
+{
+	char name[64];
+
+	for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++) {
+		if (!available[i])
+			continue;
+
+		snprintf(name, sizeof(name), "%s_per_op",
+			 li_unit_perf_counter_names[i]);
+		li_unit_report_metric(name,
+				      (double)(after[i] - before[i]) /
+					      operations);
+	}
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+void li_unit_run_bench(const struct li_unit_test *test)
+{
+	struct li_unit_bench bench = { 0 };
+	double samples[BENCH_SAMPLES];
+	double mean = 0, variance = 0, median;
+	uint64_t iterations = calibrate(test, &bench);
+	uint64_t counts_before[LI_UNIT_PERF_N_COUNTERS];
+	uint64_t counts_after[LI_UNIT_PERF_N_COUNTERS];
+	bool available[LI_UNIT_PERF_N_COUNTERS];
+	bool counting;
+
+	for (uint64_t warmup_ns = 0; warmup_ns < BENCH_WARMUP_NS;)
+		warmup_ns += run_sample(test, &bench, iterations);
+
+	counting = read_counters(counts_before, available);
+
+	for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+		samples[i] = (double)run_sample(test, &bench, iterations) /
+			     iterations;
+		li_unit_report_bench_sample("ns_per_op", samples[i]);
+		mean += samples[i];
+	}
+	mean /= BENCH_SAMPLES;
+
+	if (counting && read_counters(counts_after, available))
+		report_counts_per_op(counts_before, counts_after, available,
+				     iterations * BENCH_SAMPLES);
+
+	for (size_t i = 0; i < BENCH_SAMPLES; i++)
+		variance += (samples[i] - mean) * (samples[i] - mean);
+	variance /= BENCH_SAMPLES - 1;
+
+	qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), compare_doubles);
+	median = (samples[(BENCH_SAMPLES - 1) / 2] +
+		  samples[BENCH_SAMPLES / 2]) /
+		 2;
+
+	li_unit_report_metric("ns_per_op", median);
+	li_unit_report_metric("ns_per_op_mean", mean);
+	li_unit_report_metric("ns_per_op_stddev", sqrt(variance));
+	li_unit_report_metric("ns_per_op_min", samples[0]);
+	li_unit_report_metric("ns_per_op_max", samples[BENCH_SAMPLES - 1]);
+	li_unit_report_metric("ops_per_sec",
+			      median ? NSEC_PER_SEC / median : 0);
+	li_unit_report_metric("iterations", iterations);
+
+	printf("%s: %.3f ns/op (mean %.3f, stddev %.3f, min %.3f, "
+	       "max %.3f), over %d samples of %llu iterations\n",
+	       test->name, median, mean, sqrt(variance), samples[0],
+	       samples[BENCH_SAMPLES - 1], BENCH_SAMPLES,
+	       (unsigned long long)iterations);
+}
+
+struct li_unit_timing _li_unit_timing_begin(uint64_t iterations,
+					    unsigned int n_blocks)
+{
+	struct li_unit_timing timing = {
+		.iterations = iterations,
+		.overhead_ns = UINT64_MAX,
+		.n_blocks = n_blocks,
+	};
+
+	for (unsigned int i = 0; i < n_blocks && iterations; i++) {
+		timing.samples[i] = calloc(iterations, sizeof(uint64_t));
+		if (!timing.samples[i]) {
+			perror("calloc failed");
+			timing.failed_alloc = true;
+			timing.iterations = 0;
+		}
+	}
+
+	/* The clock is read twice around each run, so the least time
+	   between two reads is taken off each */
+	for (int i = 0; i < TIMING_OVERHEAD_READS; i++) {
+		uint64_t start_ns = now_ns();
+		uint64_t elapsed_ns = now_ns() - start_ns;
+
+		if (elapsed_ns < timing.overhead_ns)
+			timing.overhead_ns = elapsed_ns;
+	}
+	return timing;
+}
+
+bool _li_unit_timing_next(struct li_unit_timing *timing)
+{
+	uint64_t end_ns = now_ns();
+
+	if (timing->running) {
+		uint64_t elapsed_ns = end_ns - timing->start_ns;
+
+		timing->samples[timing->block][timing->done /
+					       timing->n_blocks] =
+			elapsed_ns > timing->overhead_ns ?
+				elapsed_ns - timing->overhead_ns :
+				0;
+		timing->done++;
+	}
+
+	timing->running = timing->done < timing->iterations * timing->n_blocks;
+	if (!timing->running)
+		return false;
+
+	timing->block = timing->done % timing->n_blocks;
+	timing->start_ns = now_ns();
+	return true;
+}
+
+static int compare_uint64s(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * The nearest-rank percentile of sorted samples.
+ */
+static uint64_t percentile_of(const uint64_t *samples, uint64_t n,
+			      double percentile)
+{
+	double rank = ceil(percentile / 100 * n);
+
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return samples[(uint64_t)rank - 1];
+}
+
+static void describe_distribution(char *buf, size_t size,
+				  const uint64_t *samples, uint64_t n)
+{
+	snprintf(buf, size,
+		 "min %llu, p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, "
+		 "max %llu ns",
+		 (unsigned long long)samples[0],
+		 (unsigned long long)percentile_of(samples, n, 50),
+		 (unsigned long long)percentile_of(samples, n, 90),
+		 (unsigned long long)percentile_of(samples, n, 99),
+		 (unsigned long long)percentile_of(samples, n, 99.9),
+		 (unsigned long long)samples[n - 1]);
+}
+
+static void finish_timing(struct li_unit_timing *timing, bool passed,
+			  bool fatal, const char *fail_msg)
+{
+	for (unsigned int i = 0; i < timing->n_blocks; i++)
+		free(timing->samples[i]);
+	memset(timing, 0, sizeof(*timing));
+
+	if (fatal)
+		_li_unit_test_assert(passed, fail_msg);
+	else
+		_li_unit_test_expect(passed, fail_msg);
+}
+
+void _li_unit_timing_check_within(struct li_unit_timing *timing,
+				  uint64_t limit_ns, double percentile,
+				  bool fatal, const char *fail_msg)
+{
+	uint64_t n = timing->iterations;
+	char distribution[128];
+	char msg[512];
+	uint64_t value_ns;
+
+	if (timing->failed_alloc || !n) {
+		snprintf(msg, sizeof(msg), "%s (nothing was timed)", fail_msg);
+		finish_timing(timing, false, fatal, msg);
+		return;
+	}
+
+	qsort(timing->samples[0], n, sizeof(uint64_t), compare_uint64s);
+	value_ns = percentile_of(timing->samples[0], n, percentile);
+	describe_distribution(distribution, sizeof(distribution),
+			      timing->samples[0], n);
+	snprintf(msg, sizeof(msg),
+		 "%s (p%g was %llu ns over %llu iterations: %s)", fail_msg,
+		 percentile, (unsigned long long)value_ns,
+		 (unsigned long long)n, distribution);
+	finish_timing(timing, value_ns <= limit_ns, fatal, msg);
+}
+
+void _li_unit_timing_check_faster(struct li_unit_timing *timing,
+				  double factor, bool fatal,
+				  const char *fail_msg)
+{
+	uint64_t n = timing->iterations;
+	char distributions[2][128];
+	char msg[512];
+	uint64_t medians[2];
+
+	if (timing->failed_alloc || !n) {
+		snprintf(msg, sizeof(msg), "%s (nothing was timed)", fail_msg);
+		finish_timing(timing, false, fatal, msg);
+		return;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		qsort(timing->samples[i], n, sizeof(uint64_t),
+		      compare_uint64s);
+		medians[i] = percentile_of(timing->samples[i], n, 50);
+		describe_distribution(distributions[i],
+				      sizeof(distributions[i]),
+				      timing->samples[i], n);
+	}
+
+	/* A block too fast to time is as fast as anything */
+	double speedup = medians[0] ? (double)medians[1] / medians[0] :
+				      INFINITY;
+
+	snprintf(msg, sizeof(msg),
+		 "%s (%.2fx faster over %llu iterations: %s; against %s)",
+		 fail_msg, speedup, (unsigned long long)n, distributions[0],
+		 distributions[1]);
+	finish_timing(timing, speedup >= factor, fatal, msg);
+}
+
+DEFTEST("lithium.unit.bench.timing_assertions",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	unsigned int runs[2] = { 0 };
+
+	EXPECT_WITHIN_NS(NSEC_PER_SEC, 99, 100) {
+		runs[0]++;
+		CLOBBER_MEMORY();
+	}
+	EXPECT(runs[0] == 100);
+
+	runs[0] = 0;
+	EXPECT_FASTER_THAN(2, 50) {
+		runs[0]++;
+	} else {
+		struct timespec pause = { .tv_nsec = 50 * NSEC_PER_USEC };
+
+		runs[1]++;
+		nanosleep(&pause, NULL);
+	}
+	EXPECT(runs[0] == 50 && runs[1] == 50);
+}
@@ -0,0 +1,17 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_BENCH_H_
+#define LITHIUM_SRC_UNIT_BENCH_H_
+
+#include "unit.h"
+
+/**
+ * Run a benchmark in the calling process: calibrate the iteration
+ * count, warm up, then time the samples and report the results.
+ */
+void li_unit_run_bench(const struct li_unit_test *test);
+
+#endif /* LITHIUM_SRC_UNIT_BENCH_H_ */
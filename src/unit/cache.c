@@ -0,0 +1,299 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <link.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "unit.h"
+#include "util/hash.h"
+#include "util/sorted_file.h"
+
+static int key_cmp(const void *a, const void *b)
+{
+	const struct li_unit_cache_entry *ea = a;
+	const struct li_unit_cache_entry *eb = b;
+
+	return (ea->key > eb->key) - (ea->key < eb->key);
+}
+
+static int recent_cmp(const void *a, const void *b)
+{
+	const struct li_unit_cache_entry *ea = a;
+	const struct li_unit_cache_entry *eb = b;
+
+	return (ea->last_used < eb->last_used) -
+	       (ea->last_used > eb->last_used);
+}
+
+static int append_entry(struct li_unit_cache *cache, uint64_t key,
+			uint64_t elapsed_ns, time_t last_used)
+{
+	if (cache->n_entries == cache->entries_allocation) {
+		size_t new_allocation = cache->entries_allocation * 2 + 64;
+		struct li_unit_cache_entry *new_entries =
+			realloc(cache->entries,
+				new_allocation * sizeof(*new_entries));
+
+		if (!new_entries)
+			return -1;
+		cache->entries = new_entries;
+		cache->entries_allocation = new_allocation;
+	}
+
+	cache->entries[cache->n_entries] = (struct li_unit_cache_entry){
+		.key = key,
+		.elapsed_ns = elapsed_ns,
+		.last_used = last_used,
+	};
+	cache->n_entries++;
+	return 0;
+}
+
+static int parse_line(char *line, void *data)
+{
+	struct li_unit_cache *cache = data;
+	uint64_t key, elapsed_ns;
+	int64_t last_used;
+
+	if (sscanf(line, "%" SCNx64 " %" SCNu64 " %" SCNd64, &key, &elapsed_ns,
+		   &last_used) != 3)
+		return 1;
+
+	if (append_entry(cache, key, elapsed_ns, last_used) < 0) {
+		perror("failed to load test cache");
+		return -1;
+	}
+	return 0;
+}
+
+int li_unit_cache_load(struct li_unit_cache *cache, const char *path)
+{
+	if (li_util_sorted_file_load(path, parse_line, cache) < 0)
+		return -1;
+
+	qsort(cache->entries, cache->n_entries, sizeof(*cache->entries),
+	      key_cmp);
+	cache->n_sorted = cache->n_entries;
+	return 0;
+}
+
+bool li_unit_cache_lookup(struct li_unit_cache *cache, uint64_t key,
+			  uint64_t *elapsed_ns)
+{
+	struct li_unit_cache_entry needle = { .key = key };
+	struct li_unit_cache_entry *entry =
+		bsearch(&needle, cache->entries, cache->n_sorted,
+			sizeof(*cache->entries), key_cmp);
+
+	if (!entry)
+		return false;
+
+	entry->last_used = time(NULL);
+	*elapsed_ns = entry->elapsed_ns;
+	return true;
+}
+
+int li_unit_cache_record(struct li_unit_cache *cache, uint64_t key,
+			 uint64_t elapsed_ns)
+{
+	if (append_entry(cache, key, elapsed_ns, time(NULL)) < 0) {
+		perror("failed to record test cache");
+		return -1;
+	}
+	return 0;
+}
+
+static void write_entry(FILE *f, const void *data)
+{
+	const struct li_unit_cache_entry *entry = data;
+
+	fprintf(f, "%016" PRIx64 " %" PRIu64 " %" PRId64 "\n", entry->key,
+		entry->elapsed_ns, (int64_t)entry->last_used);
+}
+
+int li_unit_cache_save(struct li_unit_cache *cache, const char *path,
+		       size_t max_entries)
+{
+	size_t n_entries;
+	struct li_unit_cache_entry *entries = li_util_sorted_merge(
+		cache->entries, cache->n_sorted, cache->n_entries,
+		sizeof(*cache->entries), key_cmp, &n_entries);
+
+	if (!entries)
+		return -1;
+
+	if (n_entries > max_entries) {
+		qsort(entries, n_entries, sizeof(*entries), recent_cmp);
+		n_entries = max_entries;
+		qsort(entries, n_entries, sizeof(*entries), key_cmp);
+	}
+
+	free(cache->entries);
+	cache->entries = entries;
+	cache->entries_allocation = cache->n_entries ?: 1;
+	cache->n_entries = n_entries;
+	cache->n_sorted = n_entries;
+
+	return li_util_sorted_file_save(path, entries, n_entries,
+					sizeof(*entries), write_entry);
+}
+
+void li_unit_cache_free(struct li_unit_cache *cache)
+{
+	free(cache->entries);
+	memset(cache, 0, sizeof(*cache));
+}
+
+int li_unit_cache_hash_file(const char *path, uint64_t *hash)
+{
+	struct stat st;
+	void *data;
+	int rv = -1;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0)
+		goto exit;
+
+	*hash = LI_UTIL_FNV1A_64_INIT;
+	if (!st.st_size) {
+		rv = 0;
+		goto exit;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		goto exit;
+
+	*hash = li_util_fnv1a_64(*hash, data, st.st_size);
+	munmap(data, st.st_size);
+	rv = 0;
+
+exit:
+	close(fd);
+	return rv;
+}
+
+struct hash_objects_state {
+	uint64_t hash;
+	bool first;
+	bool failed;
+};
+
+static int hash_object(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct hash_objects_state *state = data;
+	const char *path = info->dlpi_name;
+	uint64_t object_hash;
+
+	(void)size;
+
+	/* The program itself comes first, and has no name */
+	if (state->first) {
+		state->first = false;
+		if (!path || !path[0])
+			path = "/proc/self/exe";
+	}
+	if (!path || !path[0])
+		return 0;
+
+	if (li_unit_cache_hash_file(path, &object_hash) < 0) {
+		if (path == info->dlpi_name)
+			return 0;
+		state->failed = true;
+		return 1;
+	}
+
+	state->hash = li_util_fnv1a_64(state->hash, path, strlen(path) + 1);
+	state->hash = li_util_fnv1a_64(state->hash, &object_hash,
+				       sizeof(object_hash));
+	return 0;
+}
+
+int li_unit_cache_hash_loaded_objects(uint64_t *hash)
+{
+	struct hash_objects_state state = {
+		.hash = LI_UTIL_FNV1A_64_INIT,
+		.first = true,
+	};
+
+	dl_iterate_phdr(hash_object, &state);
+	if (state.failed)
+		return -1;
+
+	*hash = state.hash;
+	return 0;
+}
+
+DEFTEST("lithium.unit.cache.save_and_load",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	char path[] = "/tmp/lithium_cache_XXXXXX";
+	int fd = mkstemp(path);
+	struct li_unit_cache cache = { 0 };
+	uint64_t elapsed_ns;
+
+	ASSERT(fd >= 0);
+	ASSERT(dprintf(fd, "0000000000000001 100 1\n"
+			   "0000000000000002 200 2\n"
+			   "0000000000000003 300 3\n") > 0);
+	close(fd);
+
+	EXPECT(li_unit_cache_load(&cache, path) == 0);
+	EXPECT(cache.n_entries == 3);
+	EXPECT(!li_unit_cache_lookup(&cache, 4, &elapsed_ns));
+	EXPECT(li_unit_cache_lookup(&cache, 1, &elapsed_ns) &&
+	       elapsed_ns == 100);
+	EXPECT(li_unit_cache_record(&cache, 4, 400) == 0);
+	EXPECT(li_unit_cache_record(&cache, 2, 250) == 0);
+
+	/* Not visible until saved */
+	EXPECT(li_unit_cache_lookup(&cache, 2, &elapsed_ns) &&
+	       elapsed_ns == 200);
+
+	/* The least recently used entry is evicted */
+	EXPECT(li_unit_cache_save(&cache, path, 3) == 0);
+	li_unit_cache_free(&cache);
+
+	EXPECT(li_unit_cache_load(&cache, path) == 0);
+	EXPECT(cache.n_entries == 3);
+	EXPECT(li_unit_cache_lookup(&cache, 1, &elapsed_ns) &&
+	       elapsed_ns == 100);
+	EXPECT(li_unit_cache_lookup(&cache, 2, &elapsed_ns) &&
+	       elapsed_ns == 250);
+	EXPECT(!li_unit_cache_lookup(&cache, 3, &elapsed_ns));
+	EXPECT(li_unit_cache_lookup(&cache, 4, &elapsed_ns) &&
+	       elapsed_ns == 400);
+	li_unit_cache_free(&cache);
+
+	unlink(path);
+}
+
+DEFTEST("lithium.unit.cache.loaded_objects",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	uint64_t objects_hash;
+	uint64_t again;
+
+	ASSERT(li_unit_cache_hash_loaded_objects(&objects_hash) == 0);
+	ASSERT(li_unit_cache_hash_loaded_objects(&again) == 0);
+	EXPECT(objects_hash == again);
+}
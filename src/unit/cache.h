@@ -0,0 +1,92 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_CACHE_H_
+#define LITHIUM_SRC_UNIT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * A cache of the tests which passed, keyed by a hash of everything
+ * which decides whether they pass (see :c:func:`li_unit_run_tests`).
+ * On disk, this is a text file with one test per line: the key in
+ * hex, the elapsed time in nanoseconds, and the time the entry was
+ * last used in seconds since the epoch, separated by spaces.
+ */
+struct li_unit_cache {
+	struct li_unit_cache_entry {
+		uint64_t key;
+		uint64_t elapsed_ns;
+		time_t last_used;
+	} * entries;
+	size_t n_entries;
+	size_t entries_allocation;
+
+	/* Number of entries (from the start) which are sorted by key.
+	   Entries after these were recorded during this run. */
+	size_t n_sorted;
+};
+
+/**
+ * Load the cache from a file. A missing file is treated as an empty
+ * cache.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_cache_load(struct li_unit_cache *cache, const char *path);
+
+/**
+ * Look up a test which passed before, and mark its entry as used, so
+ * that it is kept over others when the cache is full.
+ *
+ * :return: True if the key was found, false otherwise.
+ */
+bool li_unit_cache_lookup(struct li_unit_cache *cache, uint64_t key,
+			  uint64_t *elapsed_ns);
+
+/**
+ * Record that a test passed. This does not affect lookups until the
+ * cache is saved.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_cache_record(struct li_unit_cache *cache, uint64_t key,
+			 uint64_t elapsed_ns);
+
+/**
+ * Merge the recorded tests into the cache, evict the least recently
+ * used entries beyond ``max_entries``, and atomically replace the file
+ * with the result.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_cache_save(struct li_unit_cache *cache, const char *path,
+		       size_t max_entries);
+
+/**
+ * Free the memory used by the cache.
+ */
+void li_unit_cache_free(struct li_unit_cache *cache);
+
+/**
+ * Hash the contents of a file.
+ *
+ * :return: 0 on success, -1 if the file could not be read.
+ */
+int li_unit_cache_hash_file(const char *path, uint64_t *hash);
+
+/**
+ * Hash the contents of the running program and every shared object
+ * loaded into it. Objects with no file to read (such as the vDSO) are
+ * skipped.
+ *
+ * :return: 0 on success, -1 if the program could not be read.
+ */
+int li_unit_cache_hash_loaded_objects(uint64_t *hash);
+
+#endif /* LITHIUM_SRC_UNIT_CACHE_H_ */
@@ -0,0 +1,142 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "deadline.h"
+#include "unit.h"
+#include "util/timespec.h"
+
+static bool earlier(const struct li_unit_deadline_heap *heap, size_t a,
+		    size_t b)
+{
+	return li_util_timespec_lt(&heap->tests[a]->priv.deadline,
+				   &heap->tests[b]->priv.deadline);
+}
+
+static void swap(struct li_unit_deadline_heap *heap, size_t a, size_t b)
+{
+	struct li_unit_test *test = heap->tests[a];
+
+	heap->tests[a] = heap->tests[b];
+	heap->tests[b] = test;
+	heap->tests[a]->priv.deadline_index = a;
+	heap->tests[b]->priv.deadline_index = b;
+}
+
+static void sift_up(struct li_unit_deadline_heap *heap, size_t i)
+{
+	while (i > 0 && earlier(heap, i, (i - 1) / 2)) {
+		swap(heap, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void sift_down(struct li_unit_deadline_heap *heap, size_t i)
+{
+	for (;;) {
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = 2 * i + 2;
+
+		if (left < heap->n_tests && earlier(heap, left, smallest))
+			smallest = left;
+		if (right < heap->n_tests && earlier(heap, right, smallest))
+			smallest = right;
+		if (smallest == i)
+			return;
+
+		swap(heap, i, smallest);
+		i = smallest;
+	}
+}
+
+int li_unit_deadline_heap_init(struct li_unit_deadline_heap *heap,
+			       size_t capacity)
+{
+	heap->n_tests = 0;
+	heap->tests = calloc(capacity, sizeof(*heap->tests));
+	if (!heap->tests) {
+		perror("calloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+void li_unit_deadline_heap_free(struct li_unit_deadline_heap *heap)
+{
+	free(heap->tests);
+	heap->tests = NULL;
+	heap->n_tests = 0;
+}
+
+void li_unit_deadline_heap_push(struct li_unit_deadline_heap *heap,
+				struct li_unit_test *test)
+{
+	size_t i = heap->n_tests++;
+
+	heap->tests[i] = test;
+	test->priv.deadline_index = i;
+	sift_up(heap, i);
+}
+
+void li_unit_deadline_heap_remove(struct li_unit_deadline_heap *heap,
+				  struct li_unit_test *test)
+{
+	size_t i = test->priv.deadline_index;
+	size_t last = --heap->n_tests;
+
+	if (i == last)
+		return;
+
+	/* Move the last test into the hole, then restore the heap
+	   property in whichever direction it was broken */
+	swap(heap, i, last);
+	sift_up(heap, i);
+	sift_down(heap, i);
+}
+
+struct li_unit_test *
+li_unit_deadline_heap_peek(const struct li_unit_deadline_heap *heap)
+{
+	return heap->n_tests ? heap->tests[0] : NULL;
+}
+
+DEFTEST("lithium.unit.deadline.heap",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	static const long deadlines[] = { 5, 3, 9, 1, 7, 4, 8, 2, 6, 0 };
+	struct li_unit_test tests[ARRAY_SIZE(deadlines)] = { 0 };
+	struct li_unit_deadline_heap heap;
+
+	ASSERT(li_unit_deadline_heap_init(&heap, ARRAY_SIZE(tests)) == 0);
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+		tests[i].priv.deadline.tv_sec = deadlines[i];
+		li_unit_deadline_heap_push(&heap, &tests[i]);
+	}
+
+	/* Remove from the middle, then the rest in order */
+	li_unit_deadline_heap_remove(&heap, &tests[4]);
+	li_unit_deadline_heap_remove(&heap, &tests[0]);
+
+	for (long expected = 0; expected < 10; expected++) {
+		struct li_unit_test *test;
+
+		if (expected == 5 || expected == 7)
+			continue;
+
+		test = li_unit_deadline_heap_peek(&heap);
+		ASSERT_NOT_NULL(test);
+		EXPECT(test->priv.deadline.tv_sec == expected);
+		li_unit_deadline_heap_remove(&heap, test);
+	}
+
+	EXPECT(li_unit_deadline_heap_peek(&heap) == NULL);
+	li_unit_deadline_heap_free(&heap);
+}
@@ -0,0 +1,55 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_DEADLINE_H_
+#define LITHIUM_SRC_UNIT_DEADLINE_H_
+
+#include <stddef.h>
+
+#include "unit.h"
+
+/**
+ * A min-heap of running tests, ordered by their deadlines, so the
+ * next deadline is found in constant time, and tests are added and
+ * removed in logarithmic time. Each test records its position in
+ * ``priv.deadline_index``.
+ */
+struct li_unit_deadline_heap {
+	struct li_unit_test **tests;
+	size_t n_tests;
+};
+
+/**
+ * Allocate a heap.
+ *
+ * :param capacity: The most tests the heap will hold at once.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_deadline_heap_init(struct li_unit_deadline_heap *heap,
+			       size_t capacity);
+
+void li_unit_deadline_heap_free(struct li_unit_deadline_heap *heap);
+
+/**
+ * Add a test, which must not already be in the heap. There must be
+ * room for it.
+ */
+void li_unit_deadline_heap_push(struct li_unit_deadline_heap *heap,
+				struct li_unit_test *test);
+
+/**
+ * Remove a test from the heap.
+ */
+void li_unit_deadline_heap_remove(struct li_unit_deadline_heap *heap,
+				  struct li_unit_test *test);
+
+/**
+ * :return: The test with the earliest deadline, or NULL if the heap is
+ *          empty.
+ */
+struct li_unit_test *
+li_unit_deadline_heap_peek(const struct li_unit_deadline_heap *heap);
+
+#endif /* LITHIUM_SRC_UNIT_DEADLINE_H_ */
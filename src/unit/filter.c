@@ -0,0 +1,315 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "filter.h"
+#include "unit.h"
+
+/* What a pattern ending at a trie node does */
+#define FILTER_EXACT_INCLUDE (1 << 0)
+#define FILTER_EXACT_EXCLUDE (1 << 1)
+#define FILTER_PREFIX_INCLUDE (1 << 2)
+#define FILTER_PREFIX_EXCLUDE (1 << 3)
+
+/*
+ * A node of the trie, for one character of a pattern. The children
+ * of a node form a list, linked by index. The root is node 0, which
+ * is never a child, so 0 ends a list.
+ */
+struct li_unit_filter_node {
+	char c;
+	unsigned int flags;
+	size_t first_child;
+	size_t next_sibling;
+};
+
+static size_t find_child(const struct li_unit_filter *filter, size_t node,
+			 char c)
+{
+	for (size_t child = filter->nodes[node].first_child; child;
+	     child = filter->nodes[child].next_sibling) {
+		if (filter->nodes[child].c == c)
+			return child;
+	}
+	return 0;
+}
+
+static ssize_t new_node(struct li_unit_filter *filter, char c)
+{
+	if (filter->n_nodes == filter->nodes_allocation) {
+		size_t allocation = filter->nodes_allocation * 2;
+		struct li_unit_filter_node *nodes;
+
+		if (!allocation)
+			allocation = 64;
+
+		nodes = reallocarray(filter->nodes, allocation,
+				     sizeof(*nodes));
+		if (!nodes) {
+			perror("reallocarray failed");
+			return -1;
+		}
+		filter->nodes = nodes;
+		filter->nodes_allocation = allocation;
+	}
+
+	filter->nodes[filter->n_nodes] = (struct li_unit_filter_node){
+		.c = c,
+	};
+	return filter->n_nodes++;
+}
+
+static ssize_t add_child(struct li_unit_filter *filter, size_t node, char c)
+{
+	ssize_t child = new_node(filter, c);
+
+	if (child < 0)
+		return -1;
+
+	filter->nodes[child].next_sibling = filter->nodes[node].first_child;
+	filter->nodes[node].first_child = child;
+	return child;
+}
+
+static int add_to_trie(struct li_unit_filter *filter, const char *pattern,
+		       size_t len, unsigned int flags)
+{
+	size_t node = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		size_t child = find_child(filter, node, pattern[i]);
+
+		if (!child) {
+			ssize_t added = add_child(filter, node, pattern[i]);
+
+			if (added < 0)
+				return -1;
+			child = added;
+		}
+		node = child;
+	}
+
+	filter->nodes[node].flags |= flags;
+	return 0;
+}
+
+static int add_glob(struct li_unit_filter *filter, const char *pattern,
+		    size_t len, bool exclude)
+{
+	size_t n = filter->n_globs + 1;
+	char **globs = reallocarray(filter->globs, n, sizeof(*globs));
+
+	if (!globs) {
+		perror("reallocarray failed");
+		return -1;
+	}
+	filter->globs = globs;
+
+	bool *globs_exclude =
+		reallocarray(filter->globs_exclude, n, sizeof(*globs_exclude));
+	if (!globs_exclude) {
+		perror("reallocarray failed");
+		return -1;
+	}
+	filter->globs_exclude = globs_exclude;
+
+	filter->globs[filter->n_globs] = strndup(pattern, len);
+	if (!filter->globs[filter->n_globs]) {
+		perror("strndup failed");
+		return -1;
+	}
+	filter->globs_exclude[filter->n_globs++] = exclude;
+	return 0;
+}
+
+static int add_pattern(struct li_unit_filter *filter, const char *pattern,
+		       size_t len, bool exclude)
+{
+	size_t wildcard = strcspn(pattern, "*?");
+
+	if (!exclude)
+		filter->has_includes = true;
+
+	if (wildcard >= len)
+		return add_to_trie(filter, pattern, len,
+				   exclude ? FILTER_EXACT_EXCLUDE :
+					     FILTER_EXACT_INCLUDE);
+
+	if (wildcard == len - 1 && pattern[wildcard] == '*')
+		return add_to_trie(filter, pattern, wildcard,
+				   exclude ? FILTER_PREFIX_EXCLUDE :
+					     FILTER_PREFIX_INCLUDE);
+
+	return add_glob(filter, pattern, len, exclude);
+}
+
+int li_unit_filter_compile(struct li_unit_filter *filter, const char *expr)
+{
+	memset(filter, 0, sizeof(*filter));
+
+	/* The root */
+	if (new_node(filter, '\0') < 0)
+		goto fail;
+
+	for (const char *term = expr;; term++) {
+		size_t len = strcspn(term, ",");
+		bool exclude = false;
+
+		while (len && *term == ' ') {
+			term++;
+			len--;
+		}
+		while (len && term[len - 1] == ' ')
+			len--;
+
+		if (len && (*term == '-' || *term == '!')) {
+			exclude = true;
+			term++;
+			len--;
+		}
+
+		if (!len) {
+			fprintf(stderr, "Empty pattern in filter: %s\n", expr);
+			goto fail;
+		}
+
+		if (add_pattern(filter, term, len, exclude) < 0)
+			goto fail;
+
+		term += strcspn(term, ",");
+		if (!*term)
+			return 0;
+	}
+
+fail:
+	li_unit_filter_free(filter);
+	return -1;
+}
+
+/*
+ * Match a glob by moving forward through the name, going back only to
+ * the most recent '*'. This takes O(nm) time at worst, rather than the
+ * exponential time of trying every way of matching each '*'.
+ */
+static bool glob_match(const char *pattern, const char *name)
+{
+	const char *star = NULL;
+	const char *resume = NULL;
+
+	while (*name) {
+		if (*pattern == '*') {
+			star = pattern++;
+			resume = name;
+		} else if (*pattern == '?' || *pattern == *name) {
+			pattern++;
+			name++;
+		} else if (star) {
+			pattern = star + 1;
+			name = ++resume;
+		} else {
+			return false;
+		}
+	}
+
+	while (*pattern == '*')
+		pattern++;
+	return !*pattern;
+}
+
+bool li_unit_filter_match(const struct li_unit_filter *filter,
+			  const char *name)
+{
+	unsigned int flags = 0;
+	size_t node = 0;
+
+	/* Prefix patterns match at any node along the way, and exact
+	   patterns only at the end of the name */
+	for (const char *c = name;; c++) {
+		flags |= filter->nodes[node].flags &
+			 (FILTER_PREFIX_INCLUDE | FILTER_PREFIX_EXCLUDE);
+
+		if (!*c) {
+			flags |= filter->nodes[node].flags;
+			break;
+		}
+
+		node = find_child(filter, node, *c);
+		if (!node)
+			break;
+	}
+
+	if (flags & (FILTER_EXACT_EXCLUDE | FILTER_PREFIX_EXCLUDE))
+		return false;
+
+	bool included = !filter->has_includes ||
+			(flags &
+			 (FILTER_EXACT_INCLUDE | FILTER_PREFIX_INCLUDE));
+
+	for (size_t i = 0; i < filter->n_globs; i++) {
+		if (included && !filter->globs_exclude[i])
+			continue;
+		if (!glob_match(filter->globs[i], name))
+			continue;
+		if (filter->globs_exclude[i])
+			return false;
+		included = true;
+	}
+
+	return included;
+}
+
+bool li_unit_filter_test(struct li_unit_test *test, void *filter)
+{
+	return li_unit_filter_match(filter, test->name);
+}
+
+void li_unit_filter_free(struct li_unit_filter *filter)
+{
+	for (size_t i = 0; i < filter->n_globs; i++)
+		free(filter->globs[i]);
+	free(filter->globs);
+	free(filter->globs_exclude);
+	free(filter->nodes);
+	memset(filter, 0, sizeof(*filter));
+}
+
+DEFTEST("lithium.unit.filter.match",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_filter filter;
+
+	ASSERT(li_unit_filter_compile(&filter,
+				      "lithium.cmdline.*, lithium.unit.runner,"
+				      "*.output.?imit,-lithium.cmdline.bad") ==
+	       0);
+	EXPECT(li_unit_filter_match(&filter, "lithium.cmdline.parse"));
+	EXPECT(li_unit_filter_match(&filter, "lithium.cmdline."));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.cmdline.bad"));
+	EXPECT(li_unit_filter_match(&filter, "lithium.cmdline.bad.not"));
+	EXPECT(li_unit_filter_match(&filter, "lithium.unit.runner"));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.unit.runner.exec"));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.unit"));
+	EXPECT(li_unit_filter_match(&filter, "lithium.unit.output.limit"));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.unit.output.limits"));
+	li_unit_filter_free(&filter);
+
+	/* Only exclusions: everything else is selected */
+	ASSERT(li_unit_filter_compile(&filter, "!*.slow.*,-lithium.a*") == 0);
+	EXPECT(li_unit_filter_match(&filter, "lithium.b"));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.abc"));
+	EXPECT(!li_unit_filter_match(&filter, "lithium.b.slow.c"));
+	li_unit_filter_free(&filter);
+
+	EXPECT(li_unit_filter_compile(&filter, "lithium.*,,x") < 0);
+	EXPECT(li_unit_filter_compile(&filter, "-") < 0);
+}
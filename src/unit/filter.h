@@ -0,0 +1,73 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_FILTER_H_
+#define LITHIUM_SRC_UNIT_FILTER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "unit.h"
+
+/**
+ * A compiled filter expression: a comma-separated list of patterns
+ * over test names. A ``*`` in a pattern matches any run of
+ * characters (including dots), and a ``?`` matches any one
+ * character. Patterns starting with ``-`` or ``!`` exclude the tests
+ * they match.
+ *
+ * A test is selected if it matches none of the excluding patterns,
+ * and any of the others (or there are no others).
+ *
+ * Patterns with no wildcards, or just a ``*`` at the end (such as
+ * ``lithium.cmdline.*``), are kept in a trie, which matches a name
+ * against all of them in one pass. Only other patterns are matched
+ * one by one.
+ */
+struct li_unit_filter {
+	struct li_unit_filter_node *nodes;
+	size_t n_nodes;
+	size_t nodes_allocation;
+
+	char **globs;
+	bool *globs_exclude;
+	size_t n_globs;
+
+	bool has_includes;
+};
+
+/**
+ * Describes filter expressions, for help messages.
+ */
+#define LI_UNIT_FILTER_HELP                                                    \
+	"Filter expressions are comma-separated patterns over test names, "  \
+	"where * matches any characters, and ? any one character. Patterns " \
+	"starting with - or ! exclude the tests they match. A test runs if " \
+	"it matches no exclusions, and any other pattern (if there are "     \
+	"others)."
+
+/**
+ * Compile a filter expression.
+ *
+ * :return: 0 on success, -1 on failure (including a malformed
+ *          expression, which is described on stderr).
+ */
+int li_unit_filter_compile(struct li_unit_filter *filter, const char *expr);
+
+/**
+ * :return: True if the filter selects the test named ``name``.
+ */
+bool li_unit_filter_match(const struct li_unit_filter *filter,
+			  const char *name);
+
+/**
+ * Suitable for the ``filter`` of :c:type:`struct li_unit_runner_options`,
+ * with the compiled filter as the data.
+ */
+bool li_unit_filter_test(struct li_unit_test *test, void *filter);
+
+void li_unit_filter_free(struct li_unit_filter *filter);
+
+#endif /* LITHIUM_SRC_UNIT_FILTER_H_ */
@@ -0,0 +1,809 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "constants.h"
+#include "fuzz.h"
+#include "unit.h"
+#include "util/hash.h"
+
+/* Edges are hashed into a map of hit counts, as in AFL */
+#define FUZZ_MAP_SIZE (1 << 16)
+
+#define FUZZ_MAX_INPUT 4096
+#define FUZZ_MAX_MUTATIONS 4
+
+/* How often a worker looks for inputs found by the others */
+#define FUZZ_RESCAN_EXECS 4096
+
+/* How long a worker may go without finishing an input before it is
+   killed, and its input saved as a hang */
+#define FUZZ_HANG_MS 2000
+
+#define FUZZ_POLL_MS 100
+
+static uint8_t coverage[FUZZ_MAP_SIZE];
+static uintptr_t previous_location;
+
+/*
+ * Called on every edge by code built with
+ * -fsanitize-coverage=trace-pc (GCC and Clang).
+ */
+void __attribute__((no_sanitize_coverage)) __sanitizer_cov_trace_pc(void)
+{
+	uintptr_t location = (uintptr_t)__builtin_return_address(0);
+
+	location = (location ^ (location >> 16)) % FUZZ_MAP_SIZE;
+	coverage[location ^ previous_location]++;
+	previous_location = location >> 1;
+}
+
+/*
+ * Called once per module by code built with
+ * -fsanitize-coverage=trace-pc-guard (Clang), to number its guards.
+ */
+void __attribute__((no_sanitize_coverage))
+__sanitizer_cov_trace_pc_guard_init(uint32_t *start, uint32_t *stop)
+{
+	static uint32_t next_guard;
+
+	if (start == stop || *start)
+		return;
+
+	for (uint32_t *guard = start; guard < stop; guard++)
+		*guard = ++next_guard % FUZZ_MAP_SIZE ?: 1;
+}
+
+void __attribute__((no_sanitize_coverage))
+__sanitizer_cov_trace_pc_guard(uint32_t *guard)
+{
+	coverage[(*guard ^ previous_location) % FUZZ_MAP_SIZE]++;
+	previous_location = *guard >> 1;
+}
+
+/*
+ * State shared between the driver and its workers.
+ */
+struct fuzz_shared {
+	/* Each bit is a bucket of hit counts seen for an edge, on any
+	   input so far */
+	uint8_t seen[FUZZ_MAP_SIZE];
+	uint64_t corpus_added;
+
+	struct fuzz_worker {
+		uint64_t execs;
+
+		/* The input being run, saved if the worker dies */
+		uint32_t input_size;
+		uint8_t input[FUZZ_MAX_INPUT];
+	} workers[];
+};
+
+struct corpus {
+	struct corpus_entry {
+		char *name;
+		const uint8_t *data;
+		size_t size;
+	} * entries;
+	size_t n_entries;
+	size_t entries_allocation;
+	struct timespec mtime;
+};
+
+static uint64_t next_random(uint64_t *state)
+{
+	/* xorshift64* */
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * UINT64_C(2685821657736338717);
+}
+
+static bool have_entry(const struct corpus *corpus, const char *name)
+{
+	for (size_t i = 0; i < corpus->n_entries; i++) {
+		if (!strcmp(corpus->entries[i].name, name))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Map a file into the corpus. Inputs are never modified once saved,
+ * so they are shared with the page cache rather than copied.
+ */
+static int add_entry(struct corpus *corpus, int dir_fd, const char *name)
+{
+	struct corpus_entry entry = { 0 };
+	struct stat st;
+	int rv = -1;
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		goto exit;
+
+	entry.size = st.st_size;
+	if (entry.size) {
+		entry.data = mmap(NULL, entry.size, PROT_READ, MAP_PRIVATE, fd,
+				  0);
+		if (entry.data == MAP_FAILED)
+			goto exit;
+	}
+
+	entry.name = strdup(name);
+	if (!entry.name)
+		goto unmap;
+
+	if (corpus->n_entries == corpus->entries_allocation) {
+		size_t new_allocation = corpus->entries_allocation * 2 + 64;
+		struct corpus_entry *new_entries =
+			reallocarray(corpus->entries, new_allocation,
+				     sizeof(*new_entries));
+
+		if (!new_entries) {
+			free(entry.name);
+			goto unmap;
+		}
+		corpus->entries = new_entries;
+		corpus->entries_allocation = new_allocation;
+	}
+
+	corpus->entries[corpus->n_entries++] = entry;
+	rv = 0;
+	goto exit;
+
+unmap:
+	if (entry.size)
+		munmap((void *)entry.data, entry.size);
+exit:
+	close(fd);
+	return rv;
+}
+
+/*
+ * Add any inputs in the corpus directory which are not in the corpus
+ * yet. Only done when the directory has changed.
+ */
+static void load_corpus(struct corpus *corpus, const char *path)
+{
+	struct stat st;
+	struct dirent *dirent;
+	DIR *dir;
+
+	if (stat(path, &st) < 0 ||
+	    (st.st_mtim.tv_sec == corpus->mtime.tv_sec &&
+	     st.st_mtim.tv_nsec == corpus->mtime.tv_nsec))
+		return;
+	corpus->mtime = st.st_mtim;
+
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((dirent = readdir(dir))) {
+		/* Skips temporary files too */
+		if (dirent->d_name[0] == '.' ||
+		    have_entry(corpus, dirent->d_name))
+			continue;
+
+		add_entry(corpus, dirfd(dir), dirent->d_name);
+	}
+	closedir(dir);
+}
+
+static void free_corpus(struct corpus *corpus)
+{
+	for (size_t i = 0; i < corpus->n_entries; i++) {
+		free(corpus->entries[i].name);
+		if (corpus->entries[i].size)
+			munmap((void *)corpus->entries[i].data,
+			       corpus->entries[i].size);
+	}
+	free(corpus->entries);
+	memset(corpus, 0, sizeof(*corpus));
+}
+
+/*
+ * Write an input into a directory, named by its hash, through a
+ * temporary file so that readers never see part of it. Returns the
+ * name in ``name``, or -1 on failure. With ``exclusive``, an existing
+ * input is left alone, and 1 is returned.
+ */
+static int save_input(const char *dir, const uint8_t *data, size_t size,
+		      const char *prefix, bool exclusive, char *name,
+		      size_t name_size)
+{
+	char *tmp_path = NULL, *path = NULL;
+	uint64_t hash = li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, data, size);
+	int rv = -1;
+	int fd;
+
+	snprintf(name, name_size, "%s%016" PRIx64, prefix, hash);
+	if (asprintf(&tmp_path, "%s/.tmp-%d", dir, getpid()) < 0) {
+		tmp_path = NULL;
+		goto exit;
+	}
+	if (asprintf(&path, "%s/%s", dir, name) < 0) {
+		path = NULL;
+		goto exit;
+	}
+
+	if (exclusive && access(path, F_OK) == 0) {
+		rv = 1;
+		goto exit;
+	}
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto exit;
+	if (write(fd, data, size) != (ssize_t)size) {
+		close(fd);
+		unlink(tmp_path);
+		goto exit;
+	}
+	close(fd);
+
+	if (rename(tmp_path, path) < 0) {
+		unlink(tmp_path);
+		goto exit;
+	}
+	rv = 0;
+
+exit:
+	free(tmp_path);
+	free(path);
+	return rv;
+}
+
+/*
+ * A byte which is likely to be treated specially by a parser.
+ */
+static uint8_t interesting_byte(uint64_t r)
+{
+	static const uint8_t interesting[] = { 0,   1,   0x7f, 0x80, 0xff,
+					       '0', '9', '-',  '+',  '%',
+					       ' ', '=', '.',  'x',  '\n' };
+
+	return interesting[r % ARRAY_SIZE(interesting)];
+}
+
+/*
+ * Replace the input from ``pos`` with the tail of another input,
+ * returning its new size.
+ */
+static size_t splice_tail(uint8_t *input, size_t pos,
+			  const struct corpus_entry *other, uint64_t r)
+{
+	size_t from = other->size ? r % other->size : 0;
+	size_t len = other->size - from;
+
+	if (pos + len > FUZZ_MAX_INPUT)
+		len = FUZZ_MAX_INPUT - pos;
+	memcpy(input + pos, other->data + from, len);
+	return pos + len;
+}
+
+/*
+ * Mutate an input in place, returning its new size.
+ */
+static size_t mutate(uint8_t *input, size_t size, const struct corpus *corpus,
+		     uint64_t *rng)
+{
+	unsigned int n_mutations = 1 + next_random(rng) % FUZZ_MAX_MUTATIONS;
+
+	for (unsigned int i = 0; i < n_mutations; i++) {
+		uint64_t r = next_random(rng);
+		size_t pos = size ? (r >> 8) % size : 0;
+		const struct corpus_entry *other;
+		size_t len;
+
+		switch (size ? r % 8 : 3) {
+		case 0:
+			input[pos] ^= 1 << (r >> 32) % 8;
+			break;
+		case 1:
+			input[pos] = r >> 32;
+			break;
+		case 2:
+			input[pos] = interesting_byte(r >> 32);
+			break;
+		case 3:
+			/* Insert a byte */
+			if (size == FUZZ_MAX_INPUT)
+				break;
+			memmove(input + pos + 1, input + pos, size - pos);
+			input[pos] = r & 1 ? (uint8_t)(r >> 32) :
+					     interesting_byte(r >> 32);
+			size++;
+			break;
+		case 4:
+			/* Delete a range */
+			len = 1 + (r >> 32) % (size - pos);
+			memmove(input + pos, input + pos + len,
+				size - pos - len);
+			size -= len;
+			break;
+		case 5:
+			/* Copy a range over another part of the input */
+			len = 1 + (r >> 32) % (size - pos);
+			memmove(input + (r >> 48) % (size - len + 1),
+				input + pos, len);
+			break;
+		case 6:
+			input[pos] += (int8_t)((r >> 32) % 35) - 17;
+			break;
+		case 7:
+			/* Splice in the tail of another input */
+			if (!corpus->n_entries)
+				break;
+			other = &corpus->entries[(r >> 32) % corpus->n_entries];
+			size = splice_tail(input, pos, other, r >> 48);
+			break;
+		}
+	}
+	return size;
+}
+
+static uint8_t bucket(uint8_t hits)
+{
+	if (hits < 4)
+		return hits == 3 ? 4 : hits;
+	if (hits < 8)
+		return 8;
+	if (hits < 16)
+		return 16;
+	if (hits < 32)
+		return 32;
+	return hits < 128 ? 64 : 128;
+}
+
+/*
+ * Merge the coverage of the last input into what has been seen, and
+ * return true if it reached an edge, or hit one a number of times, not
+ * seen before.
+ */
+static bool merge_coverage(struct fuzz_shared *shared)
+{
+	const uint64_t *words = (const uint64_t *)coverage;
+	bool new_coverage = false;
+
+	for (size_t w = 0; w < FUZZ_MAP_SIZE / sizeof(*words); w++) {
+		if (!words[w])
+			continue;
+
+		for (size_t i = w * sizeof(*words);
+		     i < (w + 1) * sizeof(*words); i++) {
+			uint8_t bits = bucket(coverage[i]);
+
+			if (bits && (shared->seen[i] & bits) != bits &&
+			    (__atomic_fetch_or(&shared->seen[i], bits,
+					       __ATOMIC_RELAXED) &
+			     bits) != bits)
+				new_coverage = true;
+		}
+	}
+	return new_coverage;
+}
+
+static void __noreturn run_worker(const struct li_unit_test *test,
+				  struct fuzz_shared *shared,
+				  struct fuzz_worker *worker,
+				  const char *corpus_dir, uint64_t seed)
+{
+	struct corpus corpus = { 0 };
+	uint8_t input[FUZZ_MAX_INPUT];
+	uint64_t rng = seed | 1;
+	char name[64];
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+	/* The target's output would only slow it down */
+	if (null_fd >= 0) {
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+	}
+
+	for (uint64_t execs = 0;; execs++) {
+		size_t size = 0;
+
+		if (execs % FUZZ_RESCAN_EXECS == 0)
+			load_corpus(&corpus, corpus_dir);
+
+		if (corpus.n_entries) {
+			const struct corpus_entry *entry =
+				&corpus.entries[next_random(&rng) %
+						corpus.n_entries];
+
+			size = entry->size < FUZZ_MAX_INPUT ? entry->size :
+							      FUZZ_MAX_INPUT;
+			memcpy(input, entry->data, size);
+		}
+		size = mutate(input, size, &corpus, &rng);
+
+		memcpy(worker->input, input, size);
+		worker->input_size = size;
+
+		memset(coverage, 0, sizeof(coverage));
+		previous_location = 0;
+		test->fuzz(input, size);
+
+		/* A failed expectation is as good as a crash */
+		if (li_unit_failed_assertions())
+			_exit(1);
+
+		__atomic_store_n(&worker->execs, execs + 1, __ATOMIC_RELAXED);
+
+		if (merge_coverage(shared) &&
+		    save_input(corpus_dir, input, size, "", false, name,
+			       sizeof(name)) == 0) {
+			int dir_fd = open(corpus_dir, O_RDONLY | O_DIRECTORY |
+							      O_CLOEXEC);
+
+			if (dir_fd >= 0) {
+				if (!have_entry(&corpus, name))
+					add_entry(&corpus, dir_fd, name);
+				close(dir_fd);
+			}
+			__atomic_fetch_add(&shared->corpus_added, 1,
+					   __ATOMIC_RELAXED);
+		}
+	}
+
+	free_corpus(&corpus);
+	_exit(0);
+}
+
+static char *make_dir(const char *parent, const char *name)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%s", parent, name) < 0) {
+		perror("asprintf failed");
+		return NULL;
+	}
+
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %m\n", path);
+		free(path);
+		return NULL;
+	}
+	return path;
+}
+
+static pid_t start_worker(const struct li_unit_test *test,
+			  struct fuzz_shared *shared, unsigned int index,
+			  const char *corpus_dir)
+{
+	struct timespec now;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		return -1;
+	}
+
+	if (pid == 0)
+		run_worker(test, shared, &shared->workers[index], corpus_dir,
+			   (uint64_t)getpid() << 32 ^ now.tv_nsec);
+
+	shared->workers[index].input_size = 0;
+	return pid;
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * MSEC_PER_SEC + now.tv_nsec / NSEC_PER_MSEC;
+}
+
+/*
+ * Save the input a worker died on, and say how to replay it. Returns
+ * true if it was not seen before.
+ */
+static bool save_crash(const struct li_unit_runner_options *options,
+		       const struct li_unit_test *test, const char *dir,
+		       const struct fuzz_worker *worker, const char *kind,
+		       const char *reason)
+{
+	char name[64];
+	uint32_t size = worker->input_size;
+
+	if (size > FUZZ_MAX_INPUT)
+		size = FUZZ_MAX_INPUT;
+
+	switch (save_input(dir, worker->input, size, kind, true, name,
+			   sizeof(name))) {
+	case 0:
+		fprintf(stderr,
+			"\n%s: %s, input saved to %s/%s\n"
+			"Replay it with --single %s --fuzz-dir %s\n",
+			test->name, reason, dir, name, test->name,
+			options->fuzz_dir);
+		return true;
+	case 1:
+		return false;
+	default:
+		fprintf(stderr, "\n%s: %s, and failed to save the input: %m\n",
+			test->name, reason);
+		return true;
+	}
+}
+
+static int fuzz_test(const struct li_unit_runner_options *options,
+		     const struct li_unit_test *test)
+{
+	unsigned int n_workers = options->parallelism ?: 1;
+	size_t shared_size = sizeof(struct fuzz_shared) +
+			     n_workers * sizeof(struct fuzz_worker);
+	char *test_dir = NULL, *corpus_dir = NULL, *crash_dir = NULL;
+	struct fuzz_shared *shared = MAP_FAILED;
+	pid_t *pids = NULL;
+	uint64_t *last_execs = NULL, *last_progress_ms = NULL;
+	bool *hung = NULL;
+	unsigned int crashes = 0;
+	int rv = -1;
+
+	test_dir = make_dir(options->fuzz_dir, test->name);
+	if (!test_dir)
+		goto exit;
+	corpus_dir = make_dir(test_dir, "corpus");
+	crash_dir = make_dir(test_dir, "crashes");
+	if (!corpus_dir || !crash_dir)
+		goto exit;
+
+	shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	pids = calloc(n_workers, sizeof(*pids));
+	last_execs = calloc(n_workers, sizeof(*last_execs));
+	last_progress_ms = calloc(n_workers, sizeof(*last_progress_ms));
+	hung = calloc(n_workers, sizeof(*hung));
+	if (shared == MAP_FAILED || !pids || !last_execs ||
+	    !last_progress_ms || !hung) {
+		perror("failed to set up fuzzing");
+		goto exit;
+	}
+
+	uint64_t start_ms = now_ms();
+	uint64_t status_ms = start_ms;
+	uint64_t execs_at_status = 0;
+
+	for (unsigned int i = 0; i < n_workers; i++) {
+		pids[i] = start_worker(test, shared, i, corpus_dir);
+		last_progress_ms[i] = start_ms;
+	}
+
+	fprintf(stderr, "Fuzzing %s with %u workers, corpus in %s.\n",
+		test->name, n_workers, corpus_dir);
+
+	for (;;) {
+		uint64_t now = now_ms();
+		uint64_t execs = 0;
+
+		for (unsigned int i = 0; i < n_workers; i++) {
+			struct fuzz_worker *worker = &shared->workers[i];
+			uint64_t worker_execs = __atomic_load_n(
+				&worker->execs, __ATOMIC_RELAXED);
+			int status;
+
+			execs += worker_execs;
+			if (worker_execs != last_execs[i]) {
+				last_execs[i] = worker_execs;
+				last_progress_ms[i] = now;
+			} else if (pids[i] > 0 && !hung[i] &&
+				   now - last_progress_ms[i] > FUZZ_HANG_MS) {
+				kill(pids[i], SIGKILL);
+				hung[i] = true;
+			}
+
+			if (pids[i] > 0 &&
+			    waitpid(pids[i], &status, WNOHANG) != pids[i])
+				continue;
+
+			if (pids[i] > 0) {
+				char reason[64];
+
+				if (hung[i])
+					snprintf(reason, sizeof(reason),
+						 "hung for over %d ms",
+						 FUZZ_HANG_MS);
+				else if (WIFSIGNALED(status))
+					snprintf(reason, sizeof(reason),
+						 "crashed with signal %d",
+						 WTERMSIG(status));
+				else
+					snprintf(reason, sizeof(reason),
+						 "failed with status %d",
+						 WEXITSTATUS(status));
+
+				if (save_crash(options, test, crash_dir,
+					       worker,
+					       hung[i] ? "hang-" : "crash-",
+					       reason))
+					crashes++;
+			}
+
+			/* Execs of the old worker still count */
+			worker->execs = 0;
+			last_execs[i] = 0;
+			hung[i] = false;
+			last_progress_ms[i] = now;
+			pids[i] = start_worker(test, shared, i, corpus_dir);
+			if (pids[i] < 0)
+				goto stop;
+		}
+
+		if (now - status_ms >= MSEC_PER_SEC) {
+			fprintf(stderr,
+				"\r%" PRIu64 " execs (%" PRIu64 "/s), "
+				"%" PRIu64 " new inputs, %u crashes",
+				execs,
+				(execs - execs_at_status) * MSEC_PER_SEC /
+					(now - status_ms),
+				shared->corpus_added, crashes);
+			status_ms = now;
+			execs_at_status = execs;
+		}
+
+		if (options->fuzz_seconds &&
+		    now - start_ms >= options->fuzz_seconds * MSEC_PER_SEC)
+			break;
+
+		usleep(FUZZ_POLL_MS * USEC_PER_MSEC);
+	}
+
+stop:
+	fprintf(stderr, "\n");
+	for (unsigned int i = 0; i < n_workers; i++) {
+		if (pids[i] > 0) {
+			kill(pids[i], SIGKILL);
+			waitpid(pids[i], NULL, 0);
+		}
+	}
+
+	bool any_coverage = false;
+	for (size_t i = 0; i < FUZZ_MAP_SIZE && !any_coverage; i++)
+		any_coverage = shared->seen[i];
+	if (!any_coverage)
+		fprintf(stderr, "No coverage was collected, so inputs were "
+			"mutated blindly. Build with "
+			"-fsanitize-coverage=trace-pc (make fuzz) for "
+			"coverage feedback.\n");
+
+	rv = crashes > 0;
+
+exit:
+	if (shared != MAP_FAILED)
+		munmap(shared, shared_size);
+	free(pids);
+	free(last_execs);
+	free(last_progress_ms);
+	free(hung);
+	free(test_dir);
+	free(corpus_dir);
+	free(crash_dir);
+	return rv;
+}
+
+int li_unit_fuzz(const struct li_unit_runner_options *options,
+		 struct li_unit_test *const *tests, size_t n_tests)
+{
+	int rv = 0;
+
+	if (!options->fuzz_dir) {
+		fprintf(stderr, "Fuzzing needs a fuzz directory.\n");
+		return -1;
+	}
+
+	if (mkdir(options->fuzz_dir, 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create %s: %m\n", options->fuzz_dir);
+		return -1;
+	}
+
+	for (size_t i = 0; i < n_tests; i++) {
+		int test_rv;
+
+		if (!tests[i]->fuzz)
+			continue;
+
+		test_rv = fuzz_test(options, tests[i]);
+		if (test_rv < 0)
+			return -1;
+		rv |= test_rv;
+	}
+	return rv;
+}
+
+/*
+ * Run the target on every input in a directory, read into buffers of
+ * exactly their size so that overreads can be caught.
+ */
+static size_t run_inputs_in(const struct li_unit_test *test,
+			    const char *fuzz_dir, const char *subdir)
+{
+	char *path;
+	DIR *dir;
+	struct dirent *dirent;
+	size_t n_inputs = 0;
+
+	if (asprintf(&path, "%s/%s/%s", fuzz_dir, test->name, subdir) < 0)
+		return 0;
+
+	dir = opendir(path);
+	if (!dir) {
+		free(path);
+		return 0;
+	}
+
+	while ((dirent = readdir(dir))) {
+		struct stat st;
+		uint8_t *data;
+		int fd;
+
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		fd = openat(dirfd(dir), dirent->d_name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+			if (fd >= 0)
+				close(fd);
+			continue;
+		}
+
+		data = malloc(st.st_size ?: 1);
+		if (data && read(fd, data, st.st_size) == st.st_size) {
+			printf("Running input %s/%s\n", path, dirent->d_name);
+			fflush(stdout);
+			test->fuzz(data, st.st_size);
+			n_inputs++;
+		}
+		free(data);
+		close(fd);
+	}
+
+	closedir(dir);
+	free(path);
+	return n_inputs;
+}
+
+void li_unit_run_fuzz_inputs(const struct li_unit_test *test)
+{
+	static const uint8_t empty[1];
+	const char *fuzz_dir = getenv(LI_UNIT_FUZZ_DIR_ENV);
+	size_t n_inputs = 1;
+
+	test->fuzz(empty, 0);
+
+	if (fuzz_dir) {
+		n_inputs += run_inputs_in(test, fuzz_dir, "crashes");
+		n_inputs += run_inputs_in(test, fuzz_dir, "corpus");
+	}
+
+	printf("Ran %zu fuzz inputs.\n", n_inputs);
+}
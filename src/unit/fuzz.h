@@ -0,0 +1,43 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_FUZZ_H_
+#define LITHIUM_SRC_UNIT_FUZZ_H_
+
+#include <stddef.h>
+
+#include "unit.h"
+
+/**
+ * The environment variable which gives the directory fuzz targets
+ * keep their inputs in, for tests started by the runner.
+ */
+#define LI_UNIT_FUZZ_DIR_ENV "LITHIUM_UNIT_FUZZ_DIR"
+
+/**
+ * Run a fuzz target as an ordinary test: on the empty input, then on
+ * every input in its corpus and crash directories, if there is a fuzz
+ * directory. This is how a saved crash is replayed.
+ */
+void li_unit_run_fuzz_inputs(const struct li_unit_test *test);
+
+/**
+ * Fuzz each of the fuzz targets among ``tests`` in turn, with
+ * ``options->parallelism`` worker processes, for
+ * ``options->fuzz_seconds`` each.
+ *
+ * :return: 0 if no crashes were found, 1 if some were, or -1 on
+ *          failure.
+ */
+int li_unit_fuzz(const struct li_unit_runner_options *options,
+		 struct li_unit_test *const *tests, size_t n_tests);
+
+/**
+ * The number of assertions which have failed in the current test.
+ * Defined in ``testlib.c``.
+ */
+size_t li_unit_failed_assertions(void);
+
+#endif /* LITHIUM_SRC_UNIT_FUZZ_H_ */
@@ -0,0 +1,181 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "history.h"
+#include "unit.h"
+#include "util/sorted_file.h"
+
+static int entry_cmp(const void *a, const void *b)
+{
+	const struct li_unit_history_entry *ea = a;
+	const struct li_unit_history_entry *eb = b;
+
+	return strcmp(ea->name, eb->name);
+}
+
+static int append_entry(struct li_unit_history *history, char *name,
+			uint64_t elapsed_ns)
+{
+	if (history->n_entries == history->entries_allocation) {
+		size_t new_allocation = history->entries_allocation * 2 + 64;
+		struct li_unit_history_entry *new_entries =
+			realloc(history->entries,
+				new_allocation * sizeof(*new_entries));
+
+		if (!new_entries)
+			return -1;
+		history->entries = new_entries;
+		history->entries_allocation = new_allocation;
+	}
+
+	history->entries[history->n_entries].name = name;
+	history->entries[history->n_entries].elapsed_ns = elapsed_ns;
+	history->n_entries++;
+	return 0;
+}
+
+static int parse_line(char *line, void *data)
+{
+	struct li_unit_history *history = data;
+	uint64_t elapsed_ns;
+	int name_offset;
+
+	if (sscanf(line, "%" SCNu64 " %n", &elapsed_ns, &name_offset) != 1 ||
+	    !line[name_offset])
+		return 1;
+
+	char *name = strdup(line + name_offset);
+	if (!name || append_entry(history, name, elapsed_ns) < 0) {
+		free(name);
+		perror("failed to load test history");
+		return -1;
+	}
+	return 0;
+}
+
+int li_unit_history_load(struct li_unit_history *history, const char *path)
+{
+	if (li_util_sorted_file_load(path, parse_line, history) < 0)
+		return -1;
+
+	qsort(history->entries, history->n_entries, sizeof(*history->entries),
+	      entry_cmp);
+	history->n_sorted = history->n_entries;
+	return 0;
+}
+
+bool li_unit_history_lookup(const struct li_unit_history *history,
+			    const char *name, uint64_t *elapsed_ns)
+{
+	struct li_unit_history_entry key = { .name = (char *)name };
+	struct li_unit_history_entry *entry =
+		bsearch(&key, history->entries, history->n_sorted,
+			sizeof(*history->entries), entry_cmp);
+
+	if (!entry)
+		return false;
+
+	*elapsed_ns = entry->elapsed_ns;
+	return true;
+}
+
+int li_unit_history_record(struct li_unit_history *history, const char *name,
+			   uint64_t elapsed_ns)
+{
+	char *name_copy = strdup(name);
+
+	if (!name_copy || append_entry(history, name_copy, elapsed_ns) < 0) {
+		free(name_copy);
+		perror("failed to record test history");
+		return -1;
+	}
+	return 0;
+}
+
+static void write_entry(FILE *f, const void *data)
+{
+	const struct li_unit_history_entry *entry = data;
+
+	fprintf(f, "%" PRIu64 " %s\n", entry->elapsed_ns, entry->name);
+}
+
+int li_unit_history_save(struct li_unit_history *history, const char *path)
+{
+	size_t n_merged;
+	struct li_unit_history_entry *merged = li_util_sorted_merge(
+		history->entries, history->n_sorted, history->n_entries,
+		sizeof(*history->entries), entry_cmp, &n_merged);
+	int rv;
+
+	if (!merged)
+		return -1;
+
+	rv = li_util_sorted_file_save(path, merged, n_merged, sizeof(*merged),
+				      write_entry);
+	free(merged);
+	return rv;
+}
+
+void li_unit_history_free(struct li_unit_history *history)
+{
+	for (size_t i = 0; i < history->n_entries; i++)
+		free(history->entries[i].name);
+	free(history->entries);
+	memset(history, 0, sizeof(*history));
+}
+
+DEFTEST("lithium.unit.history.save_and_load",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	char path[] = "/tmp/lithium_history_XXXXXX";
+	int fd = mkstemp(path);
+	struct li_unit_history history = { 0 };
+	uint64_t elapsed_ns;
+
+	ASSERT(fd >= 0);
+	close(fd);
+
+	EXPECT(li_unit_history_load(&history, path) == 0);
+	EXPECT(!li_unit_history_lookup(&history, "b", &elapsed_ns));
+	EXPECT(li_unit_history_record(&history, "b", 200) == 0);
+	EXPECT(li_unit_history_record(&history, "a", 100) == 0);
+	EXPECT(li_unit_history_save(&history, path) == 0);
+	li_unit_history_free(&history);
+
+	EXPECT(li_unit_history_load(&history, path) == 0);
+	EXPECT(li_unit_history_lookup(&history, "a", &elapsed_ns) &&
+	       elapsed_ns == 100);
+	EXPECT(li_unit_history_lookup(&history, "b", &elapsed_ns) &&
+	       elapsed_ns == 200);
+
+	/* Newer times replace older ones, and others are kept */
+	EXPECT(li_unit_history_record(&history, "b", 300) == 0);
+	EXPECT(li_unit_history_record(&history, "c", 50) == 0);
+	EXPECT(li_unit_history_save(&history, path) == 0);
+	li_unit_history_free(&history);
+
+	EXPECT(li_unit_history_load(&history, path) == 0);
+	EXPECT(history.n_entries == 3);
+	EXPECT(li_unit_history_lookup(&history, "a", &elapsed_ns) &&
+	       elapsed_ns == 100);
+	EXPECT(li_unit_history_lookup(&history, "b", &elapsed_ns) &&
+	       elapsed_ns == 300);
+	EXPECT(li_unit_history_lookup(&history, "c", &elapsed_ns) &&
+	       elapsed_ns == 50);
+	li_unit_history_free(&history);
+
+	unlink(path);
+}
@@ -0,0 +1,69 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_HISTORY_H_
+#define LITHIUM_SRC_UNIT_HISTORY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A database of how long each test took on previous runs, keyed by
+ * test name. On disk, this is a text file with one test per line:
+ * the elapsed time in nanoseconds, a space, and the test name.
+ */
+struct li_unit_history {
+	struct li_unit_history_entry {
+		char *name;
+		uint64_t elapsed_ns;
+	} * entries;
+	size_t n_entries;
+	size_t entries_allocation;
+
+	/* Number of entries (from the start) which are sorted by name.
+	   Entries after these were recorded during this run. */
+	size_t n_sorted;
+};
+
+/**
+ * Load the history from a file. A missing file is treated as an
+ * empty history.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_history_load(struct li_unit_history *history, const char *path);
+
+/**
+ * Look up how long a test took on the last run it was recorded.
+ *
+ * :return: True if the test was found, false otherwise.
+ */
+bool li_unit_history_lookup(const struct li_unit_history *history,
+			    const char *name, uint64_t *elapsed_ns);
+
+/**
+ * Record how long a test took. This does not affect lookups until
+ * the history is saved.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_history_record(struct li_unit_history *history, const char *name,
+			   uint64_t elapsed_ns);
+
+/**
+ * Merge the recorded times into the history, and atomically replace
+ * the file with the result.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_history_save(struct li_unit_history *history, const char *path);
+
+/**
+ * Free the memory used by the history.
+ */
+void li_unit_history_free(struct li_unit_history *history);
+
+#endif /* LITHIUM_SRC_UNIT_HISTORY_H_ */
@@ -0,0 +1,288 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jobserver.h"
+#include "unit.h"
+
+/*
+ * Find the value of the last jobserver option in MAKEFLAGS (make uses
+ * the last one too). Older versions of make call it --jobserver-fds.
+ */
+static char *find_jobserver_auth(const char *makeflags)
+{
+	static const char *const prefixes[] = {
+		"--jobserver-auth=",
+		"--jobserver-fds=",
+	};
+	const char *value = NULL;
+
+	for (const char *word = makeflags; *word;) {
+		size_t len = strcspn(word, " ");
+
+		for (size_t i = 0; i < ARRAY_SIZE(prefixes); i++) {
+			size_t prefix_len = strlen(prefixes[i]);
+
+			if (len > prefix_len &&
+			    !strncmp(word, prefixes[i], prefix_len))
+				value = word + prefix_len;
+		}
+
+		word += len;
+		word += strspn(word, " ");
+	}
+
+	if (!value)
+		return NULL;
+	return strndup(value, strcspn(value, " "));
+}
+
+static bool is_fifo(int fd)
+{
+	struct stat st;
+
+	return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+/*
+ * The read end of a pipe jobserver is shared with make and every
+ * other client, so it cannot be made nonblocking in place. Reopening
+ * it through /proc gives a private open file description instead.
+ */
+static int open_pipe_jobserver(struct li_unit_jobserver *jobserver,
+			       int read_fd, int write_fd)
+{
+	char path[64];
+
+	/* The descriptors may be left over from a make which is long
+	   gone, and reused for something else since */
+	if (!is_fifo(read_fd) || !is_fifo(write_fd)) {
+		fprintf(stderr, "The make jobserver is unavailable (is the "
+			"recipe missing a '+'?), ignoring it.\n");
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", read_fd);
+	jobserver->read_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (jobserver->read_fd < 0) {
+		perror("open failed");
+		return -1;
+	}
+
+	jobserver->write_fd = fcntl(write_fd, F_DUPFD_CLOEXEC, 0);
+	if (jobserver->write_fd < 0) {
+		perror("fcntl failed");
+		return -1;
+	}
+
+	jobserver->active = true;
+	return 0;
+}
+
+static int open_fifo_jobserver(struct li_unit_jobserver *jobserver,
+			       const char *path)
+{
+	jobserver->read_fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (jobserver->read_fd < 0) {
+		fprintf(stderr, "Failed to open the make jobserver %s: %m\n",
+			path);
+		return -1;
+	}
+
+	jobserver->write_fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (jobserver->write_fd < 0) {
+		fprintf(stderr, "Failed to open the make jobserver %s: %m\n",
+			path);
+		return -1;
+	}
+
+	jobserver->active = true;
+	return 0;
+}
+
+int li_unit_jobserver_connect(struct li_unit_jobserver *jobserver,
+			      const char *makeflags, unsigned int max_jobs)
+{
+	char *auth = NULL;
+	int read_fd, write_fd;
+	int rv = -1;
+
+	memset(jobserver, 0, sizeof(*jobserver));
+	jobserver->read_fd = -1;
+	jobserver->write_fd = -1;
+
+	if (makeflags)
+		auth = find_jobserver_auth(makeflags);
+	if (!auth)
+		return 0;
+
+	jobserver->max_tokens = max_jobs ? max_jobs - 1 : 0;
+	jobserver->tokens = calloc(jobserver->max_tokens + 1,
+				   sizeof(*jobserver->tokens));
+	if (!jobserver->tokens) {
+		perror("calloc failed");
+		goto exit;
+	}
+
+	if (!strncmp(auth, "fifo:", strlen("fifo:"))) {
+		rv = open_fifo_jobserver(jobserver, auth + strlen("fifo:"));
+	} else if (sscanf(auth, "%d,%d", &read_fd, &write_fd) == 2) {
+		rv = open_pipe_jobserver(jobserver, read_fd, write_fd);
+	} else {
+		fprintf(stderr, "Unsupported make jobserver %s, ignoring it.\n",
+			auth);
+		rv = 0;
+	}
+
+exit:
+	free(auth);
+	if (rv < 0 || !jobserver->active)
+		li_unit_jobserver_disconnect(jobserver);
+	return rv;
+}
+
+int li_unit_jobserver_acquire(struct li_unit_jobserver *jobserver)
+{
+	if (!jobserver->active)
+		return 1;
+
+	if (!jobserver->implicit_token_held) {
+		jobserver->implicit_token_held = true;
+		return 1;
+	}
+
+	if (jobserver->n_tokens == jobserver->max_tokens)
+		return 0;
+
+	for (;;) {
+		ssize_t rv = read(jobserver->read_fd,
+				  &jobserver->tokens[jobserver->n_tokens], 1);
+
+		if (rv == 1) {
+			jobserver->n_tokens++;
+			return 1;
+		}
+
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv < 0 && errno == EAGAIN)
+			return 0;
+
+		/* The write end closing means make has gone away */
+		if (rv == 0)
+			fprintf(stderr, "The make jobserver closed.\n");
+		else
+			perror("read failed");
+		return -1;
+	}
+}
+
+void li_unit_jobserver_release(struct li_unit_jobserver *jobserver)
+{
+	if (!jobserver->active)
+		return;
+
+	if (!jobserver->n_tokens) {
+		jobserver->implicit_token_held = false;
+		return;
+	}
+
+	while (write(jobserver->write_fd,
+		     &jobserver->tokens[jobserver->n_tokens - 1], 1) < 0) {
+		if (errno != EINTR) {
+			/* Make would not be able to use it anyway */
+			perror("write failed");
+			break;
+		}
+	}
+	jobserver->n_tokens--;
+}
+
+void li_unit_jobserver_disconnect(struct li_unit_jobserver *jobserver)
+{
+	while (jobserver->n_tokens)
+		li_unit_jobserver_release(jobserver);
+
+	if (jobserver->read_fd >= 0)
+		close(jobserver->read_fd);
+	if (jobserver->write_fd >= 0)
+		close(jobserver->write_fd);
+	free(jobserver->tokens);
+
+	memset(jobserver, 0, sizeof(*jobserver));
+	jobserver->read_fd = -1;
+	jobserver->write_fd = -1;
+}
+
+DEFTEST("lithium.unit.jobserver.pipe", {})
+{
+	struct li_unit_jobserver jobserver;
+	char makeflags[128];
+	char tokens[8];
+	int fds[2];
+
+	ASSERT(pipe(fds) == 0);
+	ASSERT(write(fds[1], "ab", 2) == 2);
+
+	snprintf(makeflags, sizeof(makeflags),
+		 " -j3 --jobserver-fds=90,91 --jobserver-auth=%d,%d", fds[0],
+		 fds[1]);
+	ASSERT(li_unit_jobserver_connect(&jobserver, makeflags, 4) == 0);
+	EXPECT(jobserver.active);
+
+	/* The implicit token, then both tokens in the pipe */
+	EXPECT(li_unit_jobserver_acquire(&jobserver) == 1);
+	EXPECT(li_unit_jobserver_acquire(&jobserver) == 1);
+	EXPECT(li_unit_jobserver_acquire(&jobserver) == 1);
+	EXPECT(li_unit_jobserver_acquire(&jobserver) == 0);
+
+	li_unit_jobserver_release(&jobserver);
+	EXPECT(read(fds[0], tokens, sizeof(tokens)) == 1 && tokens[0] == 'b');
+
+	/* The remaining token is given back on disconnect */
+	li_unit_jobserver_disconnect(&jobserver);
+	EXPECT(read(fds[0], tokens, sizeof(tokens)) == 1 && tokens[0] == 'a');
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+DEFTEST("lithium.unit.jobserver.inactive",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_jobserver jobserver;
+
+	ASSERT(li_unit_jobserver_connect(&jobserver, " -k", 4) == 0);
+	EXPECT(!jobserver.active);
+	for (int i = 0; i < 8; i++)
+		EXPECT(li_unit_jobserver_acquire(&jobserver) == 1);
+	li_unit_jobserver_disconnect(&jobserver);
+}
+
+DEFTEST("lithium.unit.jobserver.not_a_pipe", {})
+{
+	struct li_unit_jobserver jobserver;
+	char makeflags[128];
+	int fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+
+	ASSERT(fd >= 0);
+	snprintf(makeflags, sizeof(makeflags), " -j4 --jobserver-auth=%d,%d",
+		 fd, fd);
+	ASSERT(li_unit_jobserver_connect(&jobserver, makeflags, 4) == 0);
+	EXPECT(!jobserver.active);
+	li_unit_jobserver_disconnect(&jobserver);
+	close(fd);
+}
@@ -0,0 +1,66 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_JOBSERVER_H_
+#define LITHIUM_SRC_UNIT_JOBSERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A client of the GNU make jobserver, which shares a limit on
+ * parallel jobs between make and the programs it runs. Each job past
+ * the first needs a token (a byte) read from the jobserver, which is
+ * written back when the job completes. The first job runs on the
+ * token make implicitly gave to this process.
+ */
+struct li_unit_jobserver {
+	bool active;
+
+	/* Nonblocking, and private to this process */
+	int read_fd;
+	int write_fd;
+
+	bool implicit_token_held;
+
+	/* The tokens read from the jobserver, which are written back
+	   as they were (make may use the token values) */
+	char *tokens;
+	size_t n_tokens;
+	size_t max_tokens;
+};
+
+/**
+ * Connect to the jobserver described by ``MAKEFLAGS``. If there is
+ * none, or it is unusable, the jobserver is left inactive, and every
+ * acquire succeeds.
+ *
+ * :param makeflags: The value of ``MAKEFLAGS``, or NULL.
+ * :param max_jobs: The most jobs which will be run at once.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_jobserver_connect(struct li_unit_jobserver *jobserver,
+			      const char *makeflags, unsigned int max_jobs);
+
+/**
+ * Try to acquire a token for a new job, without blocking.
+ *
+ * :return: 1 if a token was acquired, 0 if none are available (wait
+ *          for the read end to become readable and try again), or -1
+ *          on failure.
+ */
+int li_unit_jobserver_acquire(struct li_unit_jobserver *jobserver);
+
+/**
+ * Give back the token of a completed job.
+ */
+void li_unit_jobserver_release(struct li_unit_jobserver *jobserver);
+
+/**
+ * Give back any tokens still held, and close the jobserver.
+ */
+void li_unit_jobserver_disconnect(struct li_unit_jobserver *jobserver);
+
+#endif /* LITHIUM_SRC_UNIT_JOBSERVER_H_ */
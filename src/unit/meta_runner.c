@@ -0,0 +1,303 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cmdline.h"
+#include "filter.h"
+#include "runner_cmdline.h"
+#include "unit.h"
+
+/*
+ * A test in one of the test binaries, run with "--single".
+ */
+struct meta_test {
+	struct li_unit_test test;
+	const char *argv[4];
+};
+
+static struct {
+	struct meta_test *tests;
+	size_t n_tests;
+	size_t tests_allocation;
+} meta_state;
+
+static struct meta_test *append_test(void)
+{
+	if (meta_state.n_tests == meta_state.tests_allocation) {
+		size_t new_allocation = meta_state.tests_allocation * 2 ?: 64;
+		struct meta_test *new_tests =
+			reallocarray(meta_state.tests, new_allocation,
+				     sizeof(*new_tests));
+
+		if (!new_tests) {
+			perror("reallocarray failed");
+			return NULL;
+		}
+
+		meta_state.tests = new_tests;
+		meta_state.tests_allocation = new_allocation;
+	}
+
+	return memset(&meta_state.tests[meta_state.n_tests++], 0,
+		      sizeof(*meta_state.tests));
+}
+
+/*
+ * Parse one line of "--list-tests-tsv" output. The test is named
+ * "<binary>:<test name>".
+ */
+static int add_test(const char *binary, const char *line)
+{
+	struct li_unit_test_options options = { 0 };
+	struct meta_test *test;
+	int informational, disabled, exclusive;
+	bool bench, fuzz;
+	int name_offset = -1;
+	char kind[8];
+	char *name;
+
+	if (sscanf(line,
+		   "%7[a-z]\t%d\t%d\t%d\t%ld\t%d\t%ld\t%ld\t%" SCNu64 "\t%n",
+		   kind, &informational, &disabled,
+		   &options.timeout_multiplier, &options.timeout_ms,
+		   &exclusive, &options.max_rss_kb, &options.max_cpu_ms,
+		   &options.max_instructions, &name_offset) != 9 ||
+	    name_offset < 0 || !line[name_offset]) {
+		fprintf(stderr, "%s: malformed test list line: %s\n", binary,
+			line);
+		return -1;
+	}
+
+	bench = !strcmp(kind, "bench");
+	fuzz = !strcmp(kind, "fuzz");
+	if (!bench && !fuzz && strcmp(kind, "test")) {
+		fprintf(stderr, "%s: unknown kind of test: %s\n", binary,
+			line);
+		return -1;
+	}
+
+	options.informational = informational;
+	options.disabled = disabled;
+
+	/* Benchmarks always run with no other tests */
+	options.exclusive = exclusive || bench;
+
+	if (asprintf(&name, "%s:%s", binary, line + name_offset) < 0) {
+		perror("asprintf failed");
+		return -1;
+	}
+
+	test = append_test();
+	if (!test) {
+		free(name);
+		return -1;
+	}
+
+	test->test.name = name;
+	test->test.options = options;
+	test->test.uncacheable = bench || fuzz;
+	test->argv[0] = binary;
+	test->argv[1] = "--single";
+	test->argv[2] = name + strlen(binary) + 1;
+	return 0;
+}
+
+/*
+ * Run the binary with "--list-tests-tsv", and add each of its tests.
+ */
+static int list_tests(const char *binary)
+{
+	const char *const argv[] = { binary, "--list-tests-tsv", NULL };
+	char *line = NULL;
+	size_t line_allocation = 0;
+	ssize_t line_length;
+	FILE *list = NULL;
+	int list_pipe[2];
+	int status;
+	int rv = -1;
+	pid_t pid;
+
+	if (pipe2(list_pipe, O_CLOEXEC) < 0) {
+		perror("pipe2 failed");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		close(list_pipe[0]);
+		close(list_pipe[1]);
+		return -1;
+	}
+
+	if (!pid) {
+		if (dup2(list_pipe[1], STDOUT_FILENO) < 0) {
+			perror("dup2 failed");
+			_exit(127);
+		}
+		execv(binary, (char *const *)argv);
+		fprintf(stderr, "%s: exec failed: %m\n", binary);
+		_exit(127);
+	}
+
+	close(list_pipe[1]);
+	list = fdopen(list_pipe[0], "r");
+	if (!list) {
+		perror("fdopen failed");
+		close(list_pipe[0]);
+		goto exit;
+	}
+
+	rv = 0;
+	while ((line_length = getline(&line, &line_allocation, list)) > 0) {
+		if (line[line_length - 1] == '\n')
+			line[line_length - 1] = '\0';
+		if (add_test(binary, line) < 0) {
+			rv = -1;
+			break;
+		}
+	}
+
+exit:
+	free(line);
+	if (list)
+		fclose(list);
+
+	if (waitpid(pid, &status, 0) < 0) {
+		perror("waitpid failed");
+		return -1;
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "%s: failed to list tests\n", binary);
+		return -1;
+	}
+
+	return rv;
+}
+
+static void free_tests(void)
+{
+	for (size_t i = 0; i < meta_state.n_tests; i++)
+		free((char *)meta_state.tests[i].test.name);
+	free(meta_state.tests);
+	memset(&meta_state, 0, sizeof(meta_state));
+}
+
+int li_unit_meta_runner_main(const char *const *argv)
+{
+	struct li_unit_runner_options options = { 0 };
+	struct li_unit_filter filter = { 0 };
+	const char *filterexpr = NULL;
+	const char *const *binaries;
+	int rv = 1;
+
+	/* The shared options, --help, and the terminator */
+	struct li_cmdline_option
+		cmdline_opts[LI_UNIT_RUNNER_N_CMDLINE_OPTIONS + 2] = { 0 };
+	size_t n_opts = li_unit_runner_cmdline_options(cmdline_opts, &options,
+						       &filterexpr);
+
+	cmdline_opts[n_opts] = (struct li_cmdline_option){
+		.shortopt = 'h',
+		.longopt = "help",
+		.action.type = LI_CMDLINE_HELP,
+	};
+
+	struct li_cmdline spec = {
+		.title = "Lithium Meta Test Runner",
+		.help = "Runs the tests from each of the given test binaries "
+		"(paths to programs built with li_unit_run_tests_main) from "
+		"one queue, under one limit on parallelism. Tests are named "
+		"<binary>:<test>.\n\n" LI_UNIT_FILTER_HELP,
+		.options = cmdline_opts,
+	};
+
+	switch (li_cmdline_parse(&spec, argv, &binaries)) {
+	case LI_CMDLINE_EXIT_SUCCESS:
+		return 0;
+	case LI_CMDLINE_CONTINUE:
+		break;
+	default:
+		return 1;
+	}
+
+	if (filterexpr) {
+		if (li_unit_filter_compile(&filter, filterexpr) < 0)
+			goto exit;
+		options.filter.func = li_unit_filter_test;
+		options.filter.data = &filter;
+	}
+
+	for (; *binaries; binaries++) {
+		if (list_tests(*binaries) < 0)
+			goto exit;
+	}
+
+	/* Link the tests only once the array is done moving */
+	for (size_t i = 0; i < meta_state.n_tests; i++) {
+		struct meta_test *test = &meta_state.tests[i];
+
+		test->test.argv = test->argv;
+		if (i + 1 < meta_state.n_tests)
+			test->test.rest = &meta_state.tests[i + 1].test;
+	}
+
+	options.test_list = meta_state.n_tests ? &meta_state.tests[0].test :
+						 NULL;
+	rv = li_unit_run_tests(&options) != 0;
+
+exit:
+	li_unit_filter_free(&filter);
+	free_tests();
+	return rv;
+}
+
+DEFTEST("lithium.unit.meta_runner.test_list", {})
+{
+	const char *line = "test\t1\t0\t2\t0\t1\t4096\t50\t1000000\t"
+			   "some.test";
+	struct li_unit_test_options *options;
+
+	ASSERT(add_test("bin", line) == 0);
+	EXPECT(add_test("bin", "1\t0\t2\t0\tsome.test") < 0);
+	EXPECT(add_test("bin", "what\t1\t0\t2\t0\t1\t0\t0\t0\tx") < 0);
+	ASSERT(meta_state.n_tests == 1);
+
+	options = &meta_state.tests[0].test.options;
+	EXPECT(!strcmp(meta_state.tests[0].test.name, "bin:some.test"));
+	EXPECT(options->informational && !options->disabled);
+	EXPECT(options->timeout_multiplier == 2);
+	EXPECT(options->exclusive);
+	EXPECT(options->max_rss_kb == 4096);
+	EXPECT(options->max_cpu_ms == 50);
+	EXPECT(options->max_instructions == 1000000);
+	EXPECT(!meta_state.tests[0].test.uncacheable);
+	free_tests();
+}
+
+DEFTEST("lithium.unit.meta_runner.uncacheable_kinds", {})
+{
+	ASSERT(add_test("bin", "bench\t0\t0\t1\t0\t0\t0\t0\t0\tb") == 0);
+	ASSERT(add_test("bin", "fuzz\t0\t0\t1\t0\t0\t0\t0\t0\tf") == 0);
+	ASSERT(meta_state.n_tests == 2);
+
+	/* Benchmarks are exclusive even if not listed so */
+	EXPECT(meta_state.tests[0].test.uncacheable);
+	EXPECT(meta_state.tests[0].test.options.exclusive);
+	EXPECT(meta_state.tests[1].test.uncacheable);
+	EXPECT(!meta_state.tests[1].test.options.exclusive);
+	free_tests();
+}
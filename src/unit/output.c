@@ -0,0 +1,288 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "unit.h"
+
+#define OUTPUT_READ_SIZE (1 << 14)
+
+static struct {
+	size_t limit;
+	size_t budget;
+
+	/* Bytes of retained output held in memory */
+	size_t retained;
+
+	/* Unlinked file holding output past the budget */
+	FILE *spill_file;
+} output_state;
+
+void li_unit_output_configure(size_t limit, size_t budget)
+{
+	output_state.limit = limit;
+	output_state.budget = budget;
+	output_state.retained = 0;
+}
+
+void li_unit_output_teardown(void)
+{
+	if (output_state.spill_file)
+		fclose(output_state.spill_file);
+	memset(&output_state, 0, sizeof(output_state));
+}
+
+/*
+ * With a limit, the tail holds between one and two windows worth of
+ * the latest output, so that old output only needs to be moved out
+ * of the way once per window.
+ */
+static size_t head_window(void)
+{
+	return output_state.limit / 2;
+}
+
+static size_t tail_window(void)
+{
+	return output_state.limit - head_window();
+}
+
+static void drop_tail_bytes(struct li_unit_output *output, size_t n)
+{
+	struct li_reallocating_buffer *tail = &output->tail;
+
+	memmove(tail->buf, tail->buf + n, tail->buf_usage - n);
+	tail->buf_usage -= n;
+	output->elided += n;
+}
+
+int li_unit_output_append(struct li_unit_output *output, const void *data,
+			  size_t len)
+{
+	struct li_reallocating_buffer *tail = &output->tail;
+	const char *bytes = data;
+	size_t window;
+	int rv;
+
+	if (!output_state.limit)
+		return li_reallocating_buffer_append(&output->head, data, len);
+
+	if (output->head.buf_usage < head_window()) {
+		size_t n = head_window() - output->head.buf_usage;
+
+		if (n > len)
+			n = len;
+		rv = li_reallocating_buffer_append(&output->head, bytes, n);
+		if (rv < 0)
+			return rv;
+		bytes += n;
+		len -= n;
+	}
+
+	window = tail_window();
+	if (len >= window) {
+		output->elided += tail->buf_usage + len - window;
+		tail->buf_usage = 0;
+		bytes += len - window;
+		len = window;
+	} else if (tail->buf_usage + len > 2 * window) {
+		drop_tail_bytes(output, tail->buf_usage + len - window);
+	}
+
+	return li_reallocating_buffer_append(tail, bytes, len);
+}
+
+ssize_t li_unit_output_read(struct li_unit_output *output, int fd)
+{
+	char buf[OUTPUT_READ_SIZE];
+	ssize_t read_rv = read(fd, buf, sizeof(buf));
+
+	if (read_rv > 0 && li_unit_output_append(output, buf, read_rv) < 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+	return read_rv;
+}
+
+static size_t output_size(const struct li_unit_output *output)
+{
+	return output->head.buf_usage + output->tail.buf_usage;
+}
+
+static void spill(struct li_unit_output *output)
+{
+	FILE *spill_file = output_state.spill_file;
+	off_t offset;
+
+	if (!spill_file) {
+		spill_file = tmpfile();
+		if (!spill_file) {
+			perror("Failed to spill test output, keeping it "
+			       "in memory");
+			return;
+		}
+		output_state.spill_file = spill_file;
+	}
+
+	if (fseeko(spill_file, 0, SEEK_END) < 0 ||
+	    (offset = ftello(spill_file)) < 0) {
+		perror("Failed to spill test output, keeping it in memory");
+		return;
+	}
+
+	li_unit_output_print(output, spill_file);
+	if (fflush(spill_file) == EOF) {
+		perror("Failed to spill test output, keeping it in memory");
+		return;
+	}
+
+	li_unit_output_discard(output);
+	output->spilled = true;
+	output->spill_offset = offset;
+	output->spill_length = ftello(spill_file) - offset;
+}
+
+void li_unit_output_retain(struct li_unit_output *output)
+{
+	/* Only the last window of the tail is ever printed */
+	if (output_state.limit && output->tail.buf_usage > tail_window())
+		drop_tail_bytes(output,
+				output->tail.buf_usage - tail_window());
+
+	if (output_state.budget &&
+	    output_state.retained + output_size(output) > output_state.budget) {
+		spill(output);
+		return;
+	}
+
+	output_state.retained += output_size(output);
+	output->retained = true;
+}
+
+void li_unit_output_discard(struct li_unit_output *output)
+{
+	if (output->retained)
+		output_state.retained -= output_size(output);
+
+	free(output->head.buf);
+	free(output->tail.buf);
+	memset(output, 0, sizeof(*output));
+}
+
+static void print_spilled(const struct li_unit_output *output, FILE *stream)
+{
+	char buf[OUTPUT_READ_SIZE];
+	size_t remaining = output->spill_length;
+
+	if (!output_state.spill_file ||
+	    fseeko(output_state.spill_file, output->spill_offset, SEEK_SET) <
+		    0) {
+		fprintf(stream, "[... output lost ...]\n");
+		return;
+	}
+
+	while (remaining) {
+		size_t n = remaining < sizeof(buf) ? remaining : sizeof(buf);
+
+		n = fread(buf, 1, n, output_state.spill_file);
+		if (!n)
+			break;
+		fwrite(buf, 1, n, stream);
+		remaining -= n;
+	}
+}
+
+void li_unit_output_print(const struct li_unit_output *output, FILE *stream)
+{
+	const struct li_reallocating_buffer *tail = &output->tail;
+	size_t elided = output->elided;
+	size_t tail_shown = tail->buf_usage;
+
+	if (output->spilled) {
+		print_spilled(output, stream);
+		return;
+	}
+
+	if (output_state.limit && tail_shown > tail_window()) {
+		elided += tail_shown - tail_window();
+		tail_shown = tail_window();
+	}
+
+	fwrite(output->head.buf, 1, output->head.buf_usage, stream);
+	if (elided)
+		fprintf(stream, "\n[... %zu bytes elided ...]\n", elided);
+	fwrite(tail->buf + tail->buf_usage - tail_shown, 1, tail_shown,
+	       stream);
+}
+
+static char *print_to_string(const struct li_unit_output *output)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *stream = open_memstream(&buf, &size);
+
+	if (!stream)
+		return NULL;
+	li_unit_output_print(output, stream);
+	fclose(stream);
+	return buf;
+}
+
+DEFTEST("lithium.unit.output.limit", {})
+{
+	struct li_unit_output output = { 0 };
+	char *printed;
+
+	li_unit_output_configure(8, 0);
+
+	for (const char *c = "0123456789abcdefghij"; *c; c++)
+		ASSERT(li_unit_output_append(&output, c, 1) == 0);
+	li_unit_output_retain(&output);
+
+	printed = print_to_string(&output);
+	ASSERT_NOT_NULL(printed);
+	EXPECT(!strcmp(printed, "0123\n[... 12 bytes elided ...]\nghij"));
+	free(printed);
+
+	li_unit_output_discard(&output);
+	li_unit_output_teardown();
+}
+
+DEFTEST("lithium.unit.output.spill", {})
+{
+	struct li_unit_output outputs[2] = { 0 };
+	char *printed;
+
+	li_unit_output_configure(0, 8);
+
+	ASSERT(li_unit_output_append(&outputs[0], "first.", 6) == 0);
+	li_unit_output_retain(&outputs[0]);
+	EXPECT(!outputs[0].spilled);
+
+	/* Over the budget */
+	ASSERT(li_unit_output_append(&outputs[1], "second.", 7) == 0);
+	li_unit_output_retain(&outputs[1]);
+	EXPECT(outputs[1].spilled);
+	EXPECT_NULL(outputs[1].head.buf);
+
+	printed = print_to_string(&outputs[1]);
+	ASSERT_NOT_NULL(printed);
+	EXPECT(!strcmp(printed, "second."));
+	free(printed);
+
+	for (size_t i = 0; i < ARRAY_SIZE(outputs); i++)
+		li_unit_output_discard(&outputs[i]);
+	li_unit_output_teardown();
+}
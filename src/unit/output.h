@@ -0,0 +1,66 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_OUTPUT_H_
+#define LITHIUM_SRC_UNIT_OUTPUT_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "unit.h"
+
+/**
+ * Set how much test output is kept, for the rest of the run.
+ *
+ * :param limit: The most bytes kept from each test, split between
+ *               the start and the end of its output, or 0 for no
+ *               limit.
+ * :param budget: The most bytes kept in memory from tests which have
+ *                completed. Further output is moved to a temporary
+ *                file. 0 for no limit.
+ */
+void li_unit_output_configure(size_t limit, size_t budget);
+
+/**
+ * Close the temporary file, if any. Any outputs which were moved to
+ * it can no longer be printed.
+ */
+void li_unit_output_teardown(void);
+
+/**
+ * Add output from a test.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_output_append(struct li_unit_output *output, const void *data,
+			  size_t len);
+
+/**
+ * Read output from a test into its buffer.
+ *
+ * :return: The number of bytes read, 0 at the end of the output, or
+ *          -1 on failure (with ``errno`` set).
+ */
+ssize_t li_unit_output_read(struct li_unit_output *output, int fd);
+
+/**
+ * Keep the output of a completed test to print later, counting it
+ * against the memory budget.
+ */
+void li_unit_output_retain(struct li_unit_output *output);
+
+/**
+ * Free the output of a test.
+ */
+void li_unit_output_discard(struct li_unit_output *output);
+
+/**
+ * Write the kept output to a stream, with a note where any of it was
+ * elided.
+ */
+void li_unit_output_print(const struct li_unit_output *output, FILE *stream);
+
+#endif /* LITHIUM_SRC_UNIT_OUTPUT_H_ */
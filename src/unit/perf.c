@@ -0,0 +1,142 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf.h"
+#include "unit.h"
+
+const char *const li_unit_perf_counter_names[LI_UNIT_PERF_N_COUNTERS] = {
+	[LI_UNIT_PERF_INSTRUCTIONS] = "instructions",
+	[LI_UNIT_PERF_CYCLES] = "cycles",
+	[LI_UNIT_PERF_CACHE_MISSES] = "cache_misses",
+	[LI_UNIT_PERF_BRANCH_MISSES] = "branch_misses",
+};
+
+static const uint64_t counter_configs[LI_UNIT_PERF_N_COUNTERS] = {
+	[LI_UNIT_PERF_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+	[LI_UNIT_PERF_CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+	[LI_UNIT_PERF_CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+	[LI_UNIT_PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static struct li_unit_perf_counters test_counters;
+static bool counting_test;
+
+int li_unit_perf_open(struct li_unit_perf_counters *counters, bool inherit)
+{
+	int leader = -1;
+
+	for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++) {
+		struct perf_event_attr attr = {
+			.type = PERF_TYPE_HARDWARE,
+			.size = sizeof(attr),
+			.config = counter_configs[i],
+			.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				       PERF_FORMAT_TOTAL_TIME_RUNNING,
+			.disabled = leader < 0,
+			.inherit = inherit,
+			.exclude_kernel = 1,
+			.exclude_hv = 1,
+		};
+
+		/* Later counters join the group of the first one the
+		   hardware has */
+		counters->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+					   leader, PERF_FLAG_FD_CLOEXEC);
+		if (leader < 0)
+			leader = counters->fds[i];
+	}
+
+	if (leader < 0)
+		return -1;
+
+	if (ioctl(leader, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+		perror("failed to enable counters");
+		li_unit_perf_close(counters);
+		return -1;
+	}
+	return 0;
+}
+
+bool li_unit_perf_read(const struct li_unit_perf_counters *counters,
+		       enum li_unit_perf_counter counter, uint64_t *count)
+{
+	/* The count, then the time enabled and the time running */
+	uint64_t values[3];
+
+	if (counters->fds[counter] < 0 ||
+	    read(counters->fds[counter], values, sizeof(values)) !=
+		    sizeof(values))
+		return false;
+
+	if (values[2] && values[2] < values[1])
+		*count = (double)values[0] * values[1] / values[2];
+	else
+		*count = values[0];
+	return true;
+}
+
+void li_unit_perf_close(struct li_unit_perf_counters *counters)
+{
+	for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++) {
+		if (counters->fds[i] >= 0)
+			close(counters->fds[i]);
+		counters->fds[i] = -1;
+	}
+}
+
+void li_unit_perf_start_test(void)
+{
+	if (!getenv(LI_UNIT_PERF_ENV))
+		return;
+
+	/* Not for processes the test starts, which count as part of
+	   it */
+	unsetenv(LI_UNIT_PERF_ENV);
+
+	if (li_unit_perf_open(&test_counters, true) < 0)
+		fprintf(stderr, "Hardware counters are unavailable: %m\n");
+	else
+		counting_test = true;
+}
+
+const struct li_unit_perf_counters *li_unit_perf_test_counters(void)
+{
+	return counting_test ? &test_counters : NULL;
+}
+
+DEFTEST("lithium.unit.perf.count", { .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_perf_counters counters;
+	uint64_t before, after;
+
+	if (li_unit_perf_open(&counters, false) < 0) {
+		/* No PMU, or not allowed to use it */
+		EXPECT(errno == ENOENT || errno == EACCES || errno == EPERM ||
+		       errno == EOPNOTSUPP || errno == ENODEV);
+		return;
+	}
+
+	ASSERT(li_unit_perf_read(&counters, LI_UNIT_PERF_INSTRUCTIONS,
+				 &before));
+	for (int i = 0; i < 1000; i++)
+		CLOBBER_MEMORY();
+	ASSERT(li_unit_perf_read(&counters, LI_UNIT_PERF_INSTRUCTIONS,
+				 &after));
+	EXPECT(after - before >= 1000);
+	li_unit_perf_close(&counters);
+}
@@ -0,0 +1,73 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_PERF_H_
+#define LITHIUM_SRC_UNIT_PERF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * The environment variable which tells a test child to count hardware
+ * events while it runs.
+ */
+#define LI_UNIT_PERF_ENV "LITHIUM_UNIT_PERF_COUNTERS"
+
+enum li_unit_perf_counter {
+	LI_UNIT_PERF_INSTRUCTIONS,
+	LI_UNIT_PERF_CYCLES,
+	LI_UNIT_PERF_CACHE_MISSES,
+	LI_UNIT_PERF_BRANCH_MISSES,
+	LI_UNIT_PERF_N_COUNTERS,
+};
+
+/**
+ * The names counts are reported as metrics under.
+ */
+extern const char *const li_unit_perf_counter_names[LI_UNIT_PERF_N_COUNTERS];
+
+/**
+ * A group of hardware counters, which the kernel always schedules
+ * together, so their counts cover the same time.
+ */
+struct li_unit_perf_counters {
+	/* -1 for counters the hardware does not have */
+	int fds[LI_UNIT_PERF_N_COUNTERS];
+};
+
+/**
+ * Start counting user space events in the calling thread.
+ *
+ * :param inherit: If true, also count in threads and processes it
+ *                 starts from now on.
+ * :return: 0 on success, or -1 if no counters are available (for
+ *          example, in a virtual machine without a virtual PMU).
+ */
+int li_unit_perf_open(struct li_unit_perf_counters *counters, bool inherit);
+
+/**
+ * Read a counter, scaled up for any time the kernel had to multiplex
+ * it with other events.
+ *
+ * :return: True on success, false if the counter is not available.
+ */
+bool li_unit_perf_read(const struct li_unit_perf_counters *counters,
+		       enum li_unit_perf_counter counter, uint64_t *count);
+
+void li_unit_perf_close(struct li_unit_perf_counters *counters);
+
+/**
+ * In a test child, start counting for the whole test if the runner
+ * asked for it.
+ */
+void li_unit_perf_start_test(void);
+
+/**
+ * The counters started by :c:func:`li_unit_perf_start_test`, or NULL
+ * if the test is not being counted.
+ */
+const struct li_unit_perf_counters *li_unit_perf_test_counters(void);
+
+#endif /* LITHIUM_SRC_UNIT_PERF_H_ */
@@ -0,0 +1,271 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unit.h"
+
+struct test_module {
+	struct li_unit_test *const *start;
+	struct li_unit_test *const *stop;
+};
+
+/* The tests a parameterized test was replaced with. They are kept
+   until the process exits, as the runner holds pointers to them. */
+struct expansion {
+	const struct li_unit_test *test;
+	struct li_unit_test *cases;
+};
+
+static struct {
+	/* The test sections of each module */
+	struct test_module *modules;
+	size_t n_modules;
+
+	/* All of their tests, sorted by name. Built on first use, and
+	   again if another module is registered after that. */
+	struct li_unit_test **index;
+	size_t n_tests;
+	bool index_valid;
+
+	struct expansion *expansions;
+	size_t n_expansions;
+} registry;
+
+void li_unit_register_tests(struct li_unit_test *const *start,
+			    struct li_unit_test *const *stop)
+{
+	struct test_module *modules;
+
+	if (!start || start == stop)
+		return;
+
+	for (size_t i = 0; i < registry.n_modules; i++) {
+		if (registry.modules[i].start == start)
+			return;
+	}
+
+	modules = reallocarray(registry.modules, registry.n_modules + 1,
+			       sizeof(*modules));
+	if (!modules) {
+		perror("reallocarray failed");
+		return;
+	}
+
+	modules[registry.n_modules++] = (struct test_module){
+		.start = start,
+		.stop = stop,
+	};
+	registry.modules = modules;
+	registry.index_valid = false;
+}
+
+static int compare_test_names(const void *a, const void *b)
+{
+	const struct li_unit_test *const *test_a = a;
+	const struct li_unit_test *const *test_b = b;
+
+	return strcmp((*test_a)->name, (*test_b)->name);
+}
+
+static size_t n_cases(const struct li_unit_test *test)
+{
+	return test->param_func ? test->n_params : 1;
+}
+
+/*
+ * Make a test for each parameter of a parameterized test, or find the
+ * ones made already.
+ */
+static struct li_unit_test *expand(const struct li_unit_test *test)
+{
+	struct expansion *expansions;
+	struct li_unit_test *cases;
+	size_t i;
+
+	for (i = 0; i < registry.n_expansions; i++) {
+		if (registry.expansions[i].test == test)
+			return registry.expansions[i].cases;
+	}
+
+	expansions = reallocarray(registry.expansions,
+				  registry.n_expansions + 1,
+				  sizeof(*expansions));
+	if (!expansions) {
+		perror("reallocarray failed");
+		return NULL;
+	}
+	registry.expansions = expansions;
+
+	cases = calloc(test->n_params, sizeof(*cases));
+	if (!cases) {
+		perror("calloc failed");
+		return NULL;
+	}
+
+	for (i = 0; i < test->n_params; i++) {
+		char *name;
+
+		if (asprintf(&name, "%s/%zu", test->name, i) < 0) {
+			perror("asprintf failed");
+			goto fail;
+		}
+
+		cases[i] = *test;
+		cases[i].name = name;
+		cases[i].params =
+			(const char *)test->params + i * test->param_size;
+		cases[i].n_params = 1;
+	}
+
+	expansions[registry.n_expansions++] = (struct expansion){
+		.test = test,
+		.cases = cases,
+	};
+	return cases;
+
+fail:
+	while (i--)
+		free((char *)cases[i].name);
+	free(cases);
+	return NULL;
+}
+
+static int build_index(void)
+{
+	size_t n_tests = 0;
+	size_t i = 0;
+
+	for (size_t m = 0; m < registry.n_modules; m++) {
+		for (struct li_unit_test *const *entry =
+			     registry.modules[m].start;
+		     entry < registry.modules[m].stop; entry++)
+			n_tests += n_cases(*entry);
+	}
+
+	free(registry.index);
+	registry.n_tests = 0;
+	registry.index = calloc(n_tests, sizeof(*registry.index));
+	if (!registry.index) {
+		perror("calloc failed");
+		return -1;
+	}
+
+	for (size_t m = 0; m < registry.n_modules; m++) {
+		for (struct li_unit_test *const *entry =
+			     registry.modules[m].start;
+		     entry < registry.modules[m].stop; entry++) {
+			struct li_unit_test *cases;
+
+			if (!(*entry)->param_func) {
+				registry.index[i++] = *entry;
+				continue;
+			}
+
+			cases = expand(*entry);
+			if (!cases)
+				return -1;
+			for (size_t c = 0; c < (*entry)->n_params; c++)
+				registry.index[i++] = &cases[c];
+		}
+	}
+
+	qsort(registry.index, n_tests, sizeof(*registry.index),
+	      compare_test_names);
+
+	for (i = 0; i < n_tests; i++)
+		registry.index[i]->rest =
+			i + 1 < n_tests ? registry.index[i + 1] : NULL;
+
+	registry.n_tests = n_tests;
+	registry.index_valid = true;
+	return 0;
+}
+
+struct li_unit_test *const *li_unit_registered_tests(size_t *n_tests)
+{
+	*n_tests = 0;
+	if (!registry.n_modules)
+		return NULL;
+
+	if (!registry.index_valid && build_index() < 0)
+		return NULL;
+
+	*n_tests = registry.n_tests;
+	return registry.index;
+}
+
+struct li_unit_test *li_unit_find_test(const char *name)
+{
+	struct li_unit_test key = { .name = name };
+	struct li_unit_test *key_entry = &key;
+	struct li_unit_test **found;
+	size_t n_tests;
+	struct li_unit_test *const *tests = li_unit_registered_tests(&n_tests);
+
+	if (!tests)
+		return NULL;
+
+	found = bsearch(&key_entry, tests, n_tests, sizeof(*tests),
+			compare_test_names);
+	return found ? *found : NULL;
+}
+
+static void find_me(void)
+{
+}
+
+static const int squares[][2] = { { 0, 0 }, { 3, 9 }, { 12, 144 } };
+
+DEFTEST_P("lithium.unit.registry.params",
+	  { .isolation = LI_UNIT_ISOLATION_THREAD }, squares)
+{
+	EXPECT((*param)[0] * (*param)[0] == (*param)[1]);
+}
+
+DEFTEST("lithium.unit.registry.find", {})
+{
+	size_t n_tests;
+	struct li_unit_test *const *tests = li_unit_registered_tests(&n_tests);
+	struct li_unit_test *test = li_unit_find_test(
+		"lithium.unit.registry.find");
+
+	ASSERT_NOT_NULL(tests);
+	ASSERT_NOT_NULL(test);
+	EXPECT(!strcmp(test->name, "lithium.unit.registry.find"));
+	EXPECT_NULL(li_unit_find_test("lithium.unit.registry.missing"));
+
+	/* Each parameter has a test, in place of the one defined */
+	EXPECT_NULL(li_unit_find_test("lithium.unit.registry.params"));
+	test = li_unit_find_test("lithium.unit.registry.params/2");
+	ASSERT_NOT_NULL(test);
+	EXPECT(test->params == &squares[2]);
+	EXPECT(!strcmp(test->name, "lithium.unit.registry.params/2"));
+
+	for (size_t i = 0; i + 1 < n_tests; i++) {
+		EXPECT(strcmp(tests[i]->name, tests[i + 1]->name) <= 0);
+		EXPECT(tests[i]->rest == tests[i + 1]);
+	}
+
+	/* Registering a module again does not duplicate its tests */
+	size_t n_before = n_tests;
+	struct li_unit_test extra = {
+		.name = "lithium.unit.registry.extra",
+		.func = find_me,
+	};
+	struct li_unit_test *const extra_section[] = { &extra };
+
+	li_unit_register_tests(extra_section, extra_section + 1);
+	li_unit_register_tests(extra_section, extra_section + 1);
+	EXPECT(li_unit_find_test("lithium.unit.registry.extra") == &extra);
+	EXPECT(li_unit_registered_tests(&n_tests) != NULL);
+	EXPECT(n_tests == n_before + 1);
+}
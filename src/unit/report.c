@@ -0,0 +1,690 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "output.h"
+#include "report.h"
+#include "unit.h"
+
+static const char *state_name(const struct li_unit_test *test)
+{
+	switch (test->priv.state) {
+	case _LI_UNIT_SUCCEEDED:
+		return "succeeded";
+	case _LI_UNIT_DEADLINE_EXCEEDED:
+		return "timed_out";
+	default:
+		return "failed";
+	}
+}
+
+static uint64_t elapsed_ns(const struct li_unit_test *test)
+{
+	return test->priv.elapsed_time.tv_sec * NSEC_PER_SEC +
+	       test->priv.elapsed_time.tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+	return tv->tv_sec * NSEC_PER_SEC + tv->tv_usec * NSEC_PER_USEC;
+}
+
+/*
+ * The resource usage of a test, as (name, value) pairs shared by all
+ * of the formats.
+ */
+struct usage_field {
+	const char *name;
+	long long value;
+};
+
+#define N_USAGE_FIELDS 7
+
+static void usage_fields(const struct li_unit_test *test,
+			 struct usage_field fields[N_USAGE_FIELDS])
+{
+	const struct rusage *rusage = &test->priv.rusage;
+
+	fields[0] = (struct usage_field){ "user_ns",
+					  timeval_ns(&rusage->ru_utime) };
+	fields[1] = (struct usage_field){ "system_ns",
+					  timeval_ns(&rusage->ru_stime) };
+	fields[2] = (struct usage_field){ "max_rss_kb", rusage->ru_maxrss };
+	fields[3] = (struct usage_field){ "major_faults", rusage->ru_majflt };
+	fields[4] = (struct usage_field){ "minor_faults", rusage->ru_minflt };
+	fields[5] = (struct usage_field){ "voluntary_switches",
+					  rusage->ru_nvcsw };
+	fields[6] = (struct usage_field){ "involuntary_switches",
+					  rusage->ru_nivcsw };
+}
+
+/*
+ * The kept output of a test, as one string (which may contain null
+ * bytes). Returns NULL if there is none.
+ */
+static char *output_string(const struct li_unit_test *test, size_t *len)
+{
+	char *buf = NULL;
+	FILE *stream = open_memstream(&buf, len);
+
+	if (!stream)
+		return NULL;
+
+	li_unit_output_print(&test->priv.output, stream);
+	fclose(stream);
+
+	if (!*len) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/*
+ * The length of the UTF-8 sequence at the start of s, or 0 if it is
+ * not valid (truncated, overlong, or a surrogate).
+ */
+static size_t utf8_sequence_length(const char *s, size_t len)
+{
+	const unsigned char *u = (const unsigned char *)s;
+	unsigned char min = 0x80, max = 0xbf;
+	size_t n;
+
+	if (u[0] < 0x80)
+		return 1;
+	else if (u[0] >= 0xc2 && u[0] <= 0xdf)
+		n = 2;
+	else if (u[0] >= 0xe0 && u[0] <= 0xef)
+		n = 3;
+	else if (u[0] >= 0xf0 && u[0] <= 0xf4)
+		n = 4;
+	else
+		return 0;
+
+	/* The second byte rules out the overlong forms, surrogates,
+	   and anything past U+10FFFF */
+	if (u[0] == 0xe0)
+		min = 0xa0;
+	else if (u[0] == 0xed)
+		max = 0x9f;
+	else if (u[0] == 0xf0)
+		min = 0x90;
+	else if (u[0] == 0xf4)
+		max = 0x8f;
+
+	if (len < n || u[1] < min || u[1] > max)
+		return 0;
+	for (size_t i = 2; i < n; i++) {
+		if (u[i] < 0x80 || u[i] > 0xbf)
+			return 0;
+	}
+	return n;
+}
+
+/*
+ * Write the valid UTF-8 sequence at s[*i], or else U+FFFD, and move
+ * *i to its last byte.
+ */
+static void write_utf8_sequence(FILE *stream, const char *s, size_t len,
+				size_t *i)
+{
+	size_t n = utf8_sequence_length(s + *i, len - *i);
+
+	if (!n) {
+		fputs("\xef\xbf\xbd", stream);
+		return;
+	}
+
+	fwrite(s + *i, 1, n, stream);
+	*i += n - 1;
+}
+
+/*
+ * Bytes which are not valid UTF-8 are replaced, as JSON has to be.
+ */
+static void write_json_string(FILE *stream, const char *s, size_t len)
+{
+	fputc('"', stream);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\')
+			fprintf(stream, "\\%c", c);
+		else if (c == '\n')
+			fputs("\\n", stream);
+		else if (c == '\t')
+			fputs("\\t", stream);
+		else if (c < 0x20 || c == 0x7f)
+			fprintf(stream, "\\u%04x", c);
+		else if (c >= 0x80)
+			write_utf8_sequence(stream, s, len, &i);
+		else
+			fputc(c, stream);
+	}
+	fputc('"', stream);
+}
+
+static void jsonl_begin(FILE *stream, size_t n_tests)
+{
+}
+
+static void jsonl_test_finished(FILE *stream, const struct li_unit_test *test,
+				unsigned int number)
+{
+	const struct li_unit_result *result = &test->priv.result;
+	struct usage_field usage[N_USAGE_FIELDS];
+	size_t output_len = 0;
+	char *output = output_string(test, &output_len);
+
+	fputs("{\"name\":", stream);
+	write_json_string(stream, test->name, strlen(test->name));
+	fprintf(stream,
+		",\"state\":\"%s\",\"informational\":%s,"
+		"\"elapsed_ns\":%llu,\"output\":",
+		state_name(test),
+		test->options.informational ? "true" : "false",
+		(unsigned long long)elapsed_ns(test));
+	write_json_string(stream, output, output_len);
+	if (test->priv.cached)
+		fputs(",\"cached\":true", stream);
+
+	usage_fields(test, usage);
+	fputs(",\"rusage\":{", stream);
+	for (size_t i = 0; i < N_USAGE_FIELDS; i++)
+		fprintf(stream, "%s\"%s\":%lld", i ? "," : "", usage[i].name,
+			usage[i].value);
+	fputc('}', stream);
+
+	if (result->has_assertions)
+		fprintf(stream,
+			",\"assertions\":{\"successful\":%llu,"
+			"\"failed\":%llu}",
+			(unsigned long long)result->successful_assertions,
+			(unsigned long long)result->failed_assertions);
+
+	if (result->failure_site) {
+		fputs(",\"failure_site\":", stream);
+		write_json_string(stream, result->failure_site,
+				  strlen(result->failure_site));
+	}
+
+	if (result->n_metrics) {
+		fputs(",\"metrics\":[", stream);
+		for (size_t i = 0; i < result->n_metrics; i++) {
+			const struct li_unit_metric *metric =
+				&result->metrics[i];
+
+			fputs(i ? ",{\"name\":" : "{\"name\":", stream);
+			write_json_string(stream, metric->name,
+					  strlen(metric->name));
+			fprintf(stream, ",\"value\":%.17g,\"sample\":%s}",
+				metric->value,
+				metric->sample ? "true" : "false");
+		}
+		fputc(']', stream);
+	}
+	fputs("}\n", stream);
+
+	free(output);
+}
+
+static void jsonl_end(FILE *stream)
+{
+}
+
+const struct li_unit_reporter_ops li_unit_jsonl_reporter = {
+	.begin = jsonl_begin,
+	.test_finished = jsonl_test_finished,
+	.end = jsonl_end,
+};
+
+/*
+ * Control characters, which XML 1.0 does not allow at all, and bytes
+ * which are not valid UTF-8, are replaced.
+ */
+static void write_xml_attribute(FILE *stream, const char *s)
+{
+	size_t len = strlen(s);
+
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		switch (c) {
+		case '&':
+			fputs("&amp;", stream);
+			break;
+		case '<':
+			fputs("&lt;", stream);
+			break;
+		case '>':
+			fputs("&gt;", stream);
+			break;
+		case '"':
+			fputs("&quot;", stream);
+			break;
+		default:
+			if (c < 0x20)
+				fputc('?', stream);
+			else if (c >= 0x80)
+				write_utf8_sequence(stream, s, len, &i);
+			else
+				fputc(c, stream);
+			break;
+		}
+	}
+}
+
+/*
+ * Write text in a CDATA section. The section is split around any
+ * "]]>", and control characters and bytes which are not valid UTF-8
+ * are replaced, as in attributes.
+ */
+static void write_xml_cdata(FILE *stream, const char *s, size_t len)
+{
+	fputs("<![CDATA[", stream);
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '>' && i >= 2 && s[i - 1] == ']' && s[i - 2] == ']')
+			fputs("]]><![CDATA[>", stream);
+		else if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+			fputc('?', stream);
+		else if (c >= 0x80)
+			write_utf8_sequence(stream, s, len, &i);
+		else
+			fputc(c, stream);
+	}
+	fputs("]]>", stream);
+}
+
+/*
+ * The number of failures is not known up front, so the testsuite
+ * element only gives the number of tests.
+ */
+static void junit_begin(FILE *stream, size_t n_tests)
+{
+	fprintf(stream,
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<testsuites>\n"
+		"  <testsuite name=\"lithium\" tests=\"%zu\">\n",
+		n_tests);
+}
+
+static void junit_test_finished(FILE *stream, const struct li_unit_test *test,
+				unsigned int number)
+{
+	const struct li_unit_result *result = &test->priv.result;
+	size_t output_len = 0;
+	char *output = output_string(test, &output_len);
+	uint64_t ns = elapsed_ns(test);
+	struct usage_field usage[N_USAGE_FIELDS];
+
+	fputs("    <testcase name=\"", stream);
+	write_xml_attribute(stream, test->name);
+	fprintf(stream, "\" time=\"%llu.%09llu\">\n",
+		(unsigned long long)(ns / NSEC_PER_SEC),
+		(unsigned long long)(ns % NSEC_PER_SEC));
+
+	usage_fields(test, usage);
+	fputs("      <properties>\n", stream);
+	for (size_t i = 0; i < N_USAGE_FIELDS; i++)
+		fprintf(stream,
+			"        <property name=\"%s\" value=\"%lld\"/>\n",
+			usage[i].name, usage[i].value);
+
+	if (result->has_assertions)
+		fprintf(stream,
+			"        <property name=\"successful_assertions\" "
+			"value=\"%llu\"/>\n"
+			"        <property name=\"failed_assertions\" "
+			"value=\"%llu\"/>\n",
+			(unsigned long long)result->successful_assertions,
+			(unsigned long long)result->failed_assertions);
+
+	/* Benchmark samples are told apart from metrics by a prefix */
+	for (size_t i = 0; i < result->n_metrics; i++) {
+		const struct li_unit_metric *metric = &result->metrics[i];
+
+		fprintf(stream, "        <property name=\"%s",
+			metric->sample ? "sample:" : "");
+		write_xml_attribute(stream, metric->name);
+		fprintf(stream, "\" value=\"%.17g\"/>\n", metric->value);
+	}
+	fputs("      </properties>\n", stream);
+
+	/* Informational failures do not fail the run, so they are
+	   reported as skipped */
+	if (test->priv.state != _LI_UNIT_SUCCEEDED) {
+		fprintf(stream, "      <%s message=\"",
+			test->options.informational ? "skipped" : "failure");
+		write_xml_attribute(stream,
+				    result->failure_site ?: state_name(test));
+		fputs("\"/>\n", stream);
+	}
+
+	if (output) {
+		fputs("      <system-out>", stream);
+		write_xml_cdata(stream, output, output_len);
+		fputs("</system-out>\n", stream);
+	}
+
+	fputs("    </testcase>\n", stream);
+	free(output);
+}
+
+static void junit_end(FILE *stream)
+{
+	fputs("  </testsuite>\n</testsuites>\n", stream);
+}
+
+const struct li_unit_reporter_ops li_unit_junit_reporter = {
+	.begin = junit_begin,
+	.test_finished = junit_test_finished,
+	.end = junit_end,
+};
+
+static void tap_begin(FILE *stream, size_t n_tests)
+{
+	fprintf(stream, "TAP version 13\n1..%zu\n", n_tests);
+}
+
+static void tap_test_finished(FILE *stream, const struct li_unit_test *test,
+			      unsigned int number)
+{
+	const struct li_unit_result *result = &test->priv.result;
+	size_t output_len = 0;
+	char *output = output_string(test, &output_len);
+	uint64_t ns = elapsed_ns(test);
+	bool succeeded = test->priv.state == _LI_UNIT_SUCCEEDED;
+	struct usage_field usage[N_USAGE_FIELDS];
+
+	fprintf(stream, "%s %u - %s", succeeded ? "ok" : "not ok", number,
+		test->name);
+	if (!succeeded && test->options.informational)
+		fputs(" # TODO informational", stream);
+	fputc('\n', stream);
+
+	fprintf(stream, "  ---\n  state: %s\n  duration_ms: %llu.%06llu\n",
+		state_name(test), (unsigned long long)(ns / NSEC_PER_MSEC),
+		(unsigned long long)(ns % NSEC_PER_MSEC));
+	if (result->failure_site) {
+		/* A JSON string is also a YAML string */
+		fputs("  failure_site: ", stream);
+		write_json_string(stream, result->failure_site,
+				  strlen(result->failure_site));
+		fputc('\n', stream);
+	}
+
+	usage_fields(test, usage);
+	for (size_t i = 0; i < N_USAGE_FIELDS; i++)
+		fprintf(stream, "  %s: %lld\n", usage[i].name, usage[i].value);
+
+	if (result->has_assertions)
+		fprintf(stream,
+			"  successful_assertions: %llu\n"
+			"  failed_assertions: %llu\n",
+			(unsigned long long)result->successful_assertions,
+			(unsigned long long)result->failed_assertions);
+
+	if (result->n_metrics) {
+		fputs("  metrics:\n", stream);
+		for (size_t i = 0; i < result->n_metrics; i++) {
+			const struct li_unit_metric *metric =
+				&result->metrics[i];
+
+			fputs("    - name: ", stream);
+			write_json_string(stream, metric->name,
+					  strlen(metric->name));
+			fprintf(stream, "\n      value: %.17g\n"
+				"      sample: %s\n",
+				metric->value,
+				metric->sample ? "true" : "false");
+		}
+	}
+	fputs("  ...\n", stream);
+
+	/* Output is given as diagnostics, one per line */
+	for (size_t i = 0; i < output_len;) {
+		size_t line_len = strcspn(output + i, "\n");
+
+		if (i + line_len > output_len)
+			line_len = output_len - i;
+		fputs("# ", stream);
+		fwrite(output + i, 1, line_len, stream);
+		fputc('\n', stream);
+		i += line_len + 1;
+	}
+
+	free(output);
+}
+
+static void tap_end(FILE *stream)
+{
+}
+
+const struct li_unit_reporter_ops li_unit_tap_reporter = {
+	.begin = tap_begin,
+	.test_finished = tap_test_finished,
+	.end = tap_end,
+};
+
+int li_unit_reporter_open(struct li_unit_reporter *reporter,
+			  const struct li_unit_reporter_ops *ops,
+			  const char *path, size_t n_tests)
+{
+	reporter->ops = ops;
+	reporter->n_reported = 0;
+
+	if (!strcmp(path, "-"))
+		reporter->stream = stdout;
+	else
+		reporter->stream = fopen(path, "we");
+
+	if (!reporter->stream) {
+		fprintf(stderr, "Failed to open report %s: %m\n", path);
+		return -1;
+	}
+
+	ops->begin(reporter->stream, n_tests);
+	fflush(reporter->stream);
+	return 0;
+}
+
+void li_unit_reporter_test_finished(struct li_unit_reporter *reporter,
+				    const struct li_unit_test *test)
+{
+	reporter->ops->test_finished(reporter->stream, test,
+				     ++reporter->n_reported);
+	fflush(reporter->stream);
+}
+
+int li_unit_reporter_close(struct li_unit_reporter *reporter)
+{
+	int rv = 0;
+
+	reporter->ops->end(reporter->stream);
+	if (ferror(reporter->stream))
+		rv = -1;
+
+	if (reporter->stream == stdout) {
+		if (fflush(stdout) == EOF)
+			rv = -1;
+	} else if (fclose(reporter->stream) == EOF) {
+		rv = -1;
+	}
+
+	reporter->stream = NULL;
+	return rv;
+}
+
+static char *report_to_string(const struct li_unit_reporter_ops *ops,
+			      const struct li_unit_test *test)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *stream = open_memstream(&buf, &size);
+
+	if (!stream)
+		return NULL;
+
+	ops->begin(stream, 1);
+	ops->test_finished(stream, test, 1);
+	ops->end(stream);
+	fclose(stream);
+	return buf;
+}
+
+DEFTEST("lithium.unit.report.formats",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	static char output[] = "line \"1\"\nline <2>]]>";
+	struct li_unit_test test = {
+		.name = "a.b&c",
+		.options.informational = true,
+		.priv = {
+			.state = _LI_UNIT_FAILED,
+			.elapsed_time = { .tv_sec = 1, .tv_nsec = 2000 },
+			.output.head = {
+				.buf = output,
+				.buf_usage = sizeof(output) - 1,
+			},
+		},
+	};
+	char *report;
+
+	report = report_to_string(&li_unit_jsonl_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT(!strcmp(report,
+		       "{\"name\":\"a.b&c\",\"state\":\"failed\","
+		       "\"informational\":true,\"elapsed_ns\":1000002000,"
+		       "\"output\":\"line \\\"1\\\"\\nline <2>]]>\","
+		       "\"rusage\":{\"user_ns\":0,\"system_ns\":0,"
+		       "\"max_rss_kb\":0,\"major_faults\":0,"
+		       "\"minor_faults\":0,\"voluntary_switches\":0,"
+		       "\"involuntary_switches\":0}}\n"));
+	free(report);
+
+	report = report_to_string(&li_unit_tap_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT(!strcmp(report, "TAP version 13\n"
+			       "1..1\n"
+			       "not ok 1 - a.b&c # TODO informational\n"
+			       "  ---\n"
+			       "  state: failed\n"
+			       "  duration_ms: 1000.002000\n"
+			       "  user_ns: 0\n"
+			       "  system_ns: 0\n"
+			       "  max_rss_kb: 0\n"
+			       "  major_faults: 0\n"
+			       "  minor_faults: 0\n"
+			       "  voluntary_switches: 0\n"
+			       "  involuntary_switches: 0\n"
+			       "  ...\n"
+			       "# line \"1\"\n"
+			       "# line <2>]]>\n"));
+	free(report);
+
+	report = report_to_string(&li_unit_junit_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT_NOT_NULL(strstr(report, "<testcase name=\"a.b&amp;c\" "
+				       "time=\"1.000002000\">"));
+	EXPECT_NOT_NULL(strstr(report, "<skipped message=\"failed\"/>"));
+	EXPECT_NOT_NULL(strstr(report, "line <2>]]]]><![CDATA[>]]>"));
+	free(report);
+}
+
+DEFTEST("lithium.unit.report.results",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_metric metrics[] = {
+		{ .name = "answer", .value = 42 },
+		{ .name = "ns_per_op", .value = 1.5, .sample = true },
+	};
+	struct li_unit_test test = {
+		.name = "a",
+		.priv = {
+			.state = _LI_UNIT_SUCCEEDED,
+			.result = {
+				.has_assertions = true,
+				.successful_assertions = 3,
+				.failed_assertions = 0,
+				.metrics = metrics,
+				.n_metrics = ARRAY_SIZE(metrics),
+			},
+		},
+	};
+	char *report;
+
+	report = report_to_string(&li_unit_junit_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT_NOT_NULL(strstr(report,
+			       "<property name=\"successful_assertions\" "
+			       "value=\"3\"/>\n"
+			       "        <property name=\"failed_assertions\" "
+			       "value=\"0\"/>\n"
+			       "        <property name=\"answer\" "
+			       "value=\"42\"/>\n"
+			       "        <property name=\"sample:ns_per_op\" "
+			       "value=\"1.5\"/>\n"));
+	free(report);
+
+	report = report_to_string(&li_unit_tap_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT_NOT_NULL(strstr(report, "  successful_assertions: 3\n"
+				       "  failed_assertions: 0\n"
+				       "  metrics:\n"
+				       "    - name: \"answer\"\n"
+				       "      value: 42\n"
+				       "      sample: false\n"
+				       "    - name: \"ns_per_op\"\n"
+				       "      value: 1.5\n"
+				       "      sample: true\n"
+				       "  ...\n"));
+	free(report);
+}
+
+DEFTEST("lithium.unit.report.invalid_utf8",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	/* A stray continuation byte, a surrogate, and a sequence cut
+	   short by the end, around valid two and four byte ones */
+	static char output[] = "\x80 \xc3\xa9 \xed\xa0\x80 "
+			       "\xf0\x9f\x98\x80 \xe2\x82";
+	struct li_unit_test test = {
+		.name = "bad\xffname",
+		.priv = {
+			.state = _LI_UNIT_SUCCEEDED,
+			.output.head = {
+				.buf = output,
+				.buf_usage = sizeof(output) - 1,
+			},
+		},
+	};
+	char *report;
+
+	report = report_to_string(&li_unit_jsonl_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT_NOT_NULL(strstr(report, "\"name\":\"bad\xef\xbf\xbdname\""));
+	EXPECT_NOT_NULL(strstr(report,
+			       "\"output\":\"\xef\xbf\xbd \xc3\xa9 "
+			       "\xef\xbf\xbd\xef\xbf\xbd\xef\xbf\xbd "
+			       "\xf0\x9f\x98\x80 \xef\xbf\xbd\xef\xbf\xbd\""));
+	free(report);
+
+	report = report_to_string(&li_unit_junit_reporter, &test);
+	ASSERT_NOT_NULL(report);
+	EXPECT_NOT_NULL(
+		strstr(report, "<testcase name=\"bad\xef\xbf\xbdname\""));
+	free(report);
+}
@@ -0,0 +1,63 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_REPORT_H_
+#define LITHIUM_SRC_UNIT_REPORT_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "unit.h"
+
+/**
+ * A machine-readable format for test results. Each test's record is
+ * written (and flushed) as soon as the test completes, so that a
+ * report can be followed while the run is still going.
+ */
+struct li_unit_reporter_ops {
+	void (*begin)(FILE *stream, size_t n_tests);
+	void (*test_finished)(FILE *stream, const struct li_unit_test *test,
+			      unsigned int number);
+	void (*end)(FILE *stream);
+};
+
+extern const struct li_unit_reporter_ops li_unit_jsonl_reporter;
+extern const struct li_unit_reporter_ops li_unit_junit_reporter;
+extern const struct li_unit_reporter_ops li_unit_tap_reporter;
+
+/**
+ * A report being written to a file.
+ */
+struct li_unit_reporter {
+	const struct li_unit_reporter_ops *ops;
+	FILE *stream;
+	unsigned int n_reported;
+};
+
+/**
+ * Open a report, and write its header.
+ *
+ * :param path: The file to write to, or "-" for stdout.
+ * :param n_tests: The number of tests in the run.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_reporter_open(struct li_unit_reporter *reporter,
+			  const struct li_unit_reporter_ops *ops,
+			  const char *path, size_t n_tests);
+
+/**
+ * Write the record of a completed test.
+ */
+void li_unit_reporter_test_finished(struct li_unit_reporter *reporter,
+				    const struct li_unit_test *test);
+
+/**
+ * Write the end of the report, and close it.
+ *
+ * :return: 0 on success, -1 if the report could not be written.
+ */
+int li_unit_reporter_close(struct li_unit_reporter *reporter);
+
+#endif /* LITHIUM_SRC_UNIT_REPORT_H_ */
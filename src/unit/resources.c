@@ -0,0 +1,298 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "resources.h"
+#include "unit.h"
+
+/* How long to wait for killed processes to leave a cgroup */
+#define CGROUP_REMOVE_ATTEMPTS 100
+#define CGROUP_REMOVE_INTERVAL_NS 1000000
+
+/*
+ * Set both the soft and hard limit, so the test cannot raise it
+ * again. An existing hard limit which is lower is kept.
+ */
+static int set_limit(int resource, rlim_t value)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(resource, &rlim) < 0)
+		return -1;
+
+	if (rlim.rlim_max != RLIM_INFINITY && rlim.rlim_max < value)
+		value = rlim.rlim_max;
+
+	rlim.rlim_cur = value;
+	rlim.rlim_max = value;
+	return setrlimit(resource, &rlim);
+}
+
+/*
+ * Lower only the soft limit, so the process can still raise it up to
+ * the hard limit.
+ */
+static int set_soft_limit(int resource, rlim_t value)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(resource, &rlim) < 0)
+		return -1;
+
+	if (rlim.rlim_cur != RLIM_INFINITY && rlim.rlim_cur <= value)
+		return 0;
+
+	rlim.rlim_cur = value;
+	return setrlimit(resource, &rlim);
+}
+
+static int write_file_at(int dir_fd, const char *name, const char *value)
+{
+	ssize_t len = strlen(value);
+	int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+	int rv = 0;
+
+	if (fd < 0)
+		return -1;
+
+	if (write(fd, value, len) != len)
+		rv = -1;
+
+	/* Keep the errno from the write */
+	int saved_errno = errno;
+	close(fd);
+	errno = saved_errno;
+	return rv;
+}
+
+static int read_u64_at(int dir_fd, const char *name, uint64_t *value)
+{
+	char buf[32];
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	ssize_t len;
+
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return -1;
+
+	buf[len] = '\0';
+	*value = strtoull(buf, NULL, 10);
+	return 0;
+}
+
+int li_unit_limits_apply(const struct li_unit_limits *limits, bool in_cgroup)
+{
+	/* The kernel should kill the test rather than the runner (or
+	   anything else) when memory runs out. Not all systems allow
+	   this, and the test can run regardless. */
+	write_file_at(AT_FDCWD, "/proc/self/oom_score_adj", "1000");
+
+	if (limits->memory_kb && !in_cgroup &&
+	    set_limit(RLIMIT_AS, (rlim_t)limits->memory_kb * 1024) < 0) {
+		perror("failed to limit address space");
+		return -1;
+	}
+
+	if (limits->open_files &&
+	    set_limit(RLIMIT_NOFILE, limits->open_files) < 0) {
+		perror("failed to limit open files");
+		return -1;
+	}
+
+	/* Tests should not inherit the higher limit of the runner */
+	if (!limits->open_files && limits->default_open_files &&
+	    set_soft_limit(RLIMIT_NOFILE, limits->default_open_files) < 0) {
+		perror("failed to restore the limit on open files");
+		return -1;
+	}
+
+	return 0;
+}
+
+int li_unit_raise_fd_limit(unsigned long long needed,
+			   unsigned long long *saved)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0) {
+		perror("getrlimit failed");
+		return -1;
+	}
+
+	*saved = rlim.rlim_cur;
+	if (rlim.rlim_cur == RLIM_INFINITY || rlim.rlim_cur >= needed)
+		return 0;
+
+	if (rlim.rlim_max != RLIM_INFINITY && rlim.rlim_max < needed) {
+		fprintf(stderr,
+			"Needed %llu file descriptors, but the hard limit "
+			"is %llu. Raise it (ulimit -Hn), or run fewer tests "
+			"in parallel.\n",
+			needed, (unsigned long long)rlim.rlim_max);
+		return -1;
+	}
+
+	rlim.rlim_cur = needed;
+	if (setrlimit(RLIMIT_NOFILE, &rlim) < 0) {
+		perror("failed to raise the limit on open files");
+		return -1;
+	}
+	return 0;
+}
+
+int li_unit_cgroup_setup(const char *path)
+{
+	static const char *controllers = "+memory +pids";
+	int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open cgroup %s: %m\n", path);
+		return -1;
+	}
+
+	if (write_file_at(fd, "cgroup.subtree_control", controllers) == 0)
+		return fd;
+
+	/* Processes in the cgroup itself prevent enabling controllers
+	   for its children */
+	if (errno != EBUSY)
+		goto fail;
+
+	if (mkdirat(fd, "runner", 0755) < 0 && errno != EEXIST)
+		goto fail;
+
+	if (write_file_at(fd, "runner/cgroup.procs", "0") < 0 ||
+	    write_file_at(fd, "cgroup.subtree_control", controllers) < 0)
+		goto fail;
+
+	return fd;
+
+fail:
+	fprintf(stderr, "Failed to set up cgroup %s: %m\n", path);
+	close(fd);
+	return -1;
+}
+
+int li_unit_cgroup_create(int parent_fd, const char *name,
+			  const struct li_unit_limits *limits)
+{
+	char value[32];
+	int fd;
+
+	if (mkdirat(parent_fd, name, 0755) < 0) {
+		perror("failed to create cgroup");
+		return -1;
+	}
+
+	fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		perror("failed to open cgroup");
+		goto fail;
+	}
+
+	if (limits->memory_kb) {
+		snprintf(value, sizeof(value), "%llu",
+			 (unsigned long long)limits->memory_kb * 1024);
+		if (write_file_at(fd, "memory.max", value) < 0) {
+			perror("failed to set memory.max");
+			goto fail;
+		}
+
+		/* Kill the whole test on OOM, not just one process of
+		   it. Older kernels lack this, which is fine. */
+		write_file_at(fd, "memory.oom.group", "1");
+	}
+
+	if (limits->processes) {
+		snprintf(value, sizeof(value), "%u", limits->processes);
+		if (write_file_at(fd, "pids.max", value) < 0) {
+			perror("failed to set pids.max");
+			goto fail;
+		}
+	}
+
+	return fd;
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	unlinkat(parent_fd, name, AT_REMOVEDIR);
+	return -1;
+}
+
+int li_unit_cgroup_enter(int cgroup_fd)
+{
+	if (write_file_at(cgroup_fd, "cgroup.procs", "0") < 0) {
+		perror("failed to enter cgroup");
+		return -1;
+	}
+	return 0;
+}
+
+void li_unit_cgroup_destroy(int parent_fd, const char *name, int cgroup_fd,
+			    uint64_t *peak_kb)
+{
+	struct timespec interval = {
+		.tv_nsec = CGROUP_REMOVE_INTERVAL_NS,
+	};
+	uint64_t peak;
+
+	*peak_kb = 0;
+	if (read_u64_at(cgroup_fd, "memory.peak", &peak) == 0)
+		*peak_kb = peak / 1024;
+
+	/* Anything the test left running. Older kernels lack
+	   cgroup.kill, and leftover processes keep the cgroup busy. */
+	write_file_at(cgroup_fd, "cgroup.kill", "1");
+	close(cgroup_fd);
+
+	for (int i = 0; i < CGROUP_REMOVE_ATTEMPTS; i++) {
+		if (unlinkat(parent_fd, name, AT_REMOVEDIR) == 0)
+			return;
+		if (errno != EBUSY)
+			break;
+		nanosleep(&interval, NULL);
+	}
+
+	fprintf(stderr, "Failed to remove cgroup %s: %m\n", name);
+}
+
+DEFTEST("lithium.unit.resources.open_files", {})
+{
+	struct li_unit_limits limits = {
+		.open_files = 16,
+	};
+	struct rlimit rlim;
+	int fd;
+
+	ASSERT(li_unit_limits_apply(&limits, false) == 0);
+	ASSERT(getrlimit(RLIMIT_NOFILE, &rlim) == 0);
+	EXPECT(rlim.rlim_cur == 16 && rlim.rlim_max == 16);
+
+	for (int i = 0; i < 16; i++) {
+		fd = dup(STDIN_FILENO);
+		if (fd < 0)
+			break;
+	}
+	EXPECT(fd < 0 && errno == EMFILE);
+}
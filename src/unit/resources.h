@@ -0,0 +1,115 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_RESOURCES_H_
+#define LITHIUM_SRC_UNIT_RESOURCES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Resource limits for a test process. Zero means no limit.
+ */
+struct li_unit_limits {
+	/**
+	 * The most memory the test may use, in KiB. Without a cgroup,
+	 * this limits the address space of each process.
+	 */
+	size_t memory_kb;
+
+	/**
+	 * The most file descriptors each process may have open.
+	 */
+	unsigned int open_files;
+
+	/**
+	 * If ``open_files`` is zero, the soft limit on file
+	 * descriptors to give each process back, as the runner raises
+	 * its own (see :c:func:`li_unit_raise_fd_limit`). Zero leaves
+	 * the limit alone.
+	 */
+	unsigned long long default_open_files;
+
+	/**
+	 * The most processes the test may have. This is only enforced
+	 * by a cgroup, as ``RLIMIT_NPROC`` counts every process of the
+	 * user rather than those of the test.
+	 */
+	unsigned int processes;
+};
+
+/**
+ * Apply limits to the calling process, and make it the first choice
+ * of the OOM killer. Called in the test child, before the test runs.
+ * The limit on processes is left to the cgroup.
+ *
+ * :param limits: The limits to apply.
+ * :param in_cgroup: True if the process is in a cgroup which already
+ *                   limits its memory.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_limits_apply(const struct li_unit_limits *limits, bool in_cgroup);
+
+/**
+ * Raise the soft limit on file descriptors of the calling process, as
+ * far as its hard limit allows, so that it can keep ``needed`` of them
+ * open.
+ *
+ * :param needed: The number of file descriptors needed.
+ * :param saved: Set to the soft limit from before.
+ * :return: 0 on success, -1 if the hard limit is too low (which is
+ *          explained on stderr).
+ */
+int li_unit_raise_fd_limit(unsigned long long needed,
+			   unsigned long long *saved);
+
+/**
+ * Prepare a cgroup v2 directory to hold a cgroup for each test. The
+ * memory and pids controllers are enabled for its children. If the
+ * calling process is in the directory itself, it is moved to a new
+ * child named ``runner``, as cgroups with controllers enabled for
+ * their children cannot hold processes.
+ *
+ * :param path: The path of the cgroup directory, which should be
+ *              delegated to the calling user.
+ * :return: A file descriptor for the directory, or -1 on failure.
+ */
+int li_unit_cgroup_setup(const char *path);
+
+/**
+ * Create the cgroup for a test.
+ *
+ * :param parent_fd: The file descriptor from
+ *                   :c:func:`li_unit_cgroup_setup`.
+ * :param name: The name of the new cgroup.
+ * :param limits: The memory and process limits to set on it.
+ * :return: A file descriptor for the new cgroup, or -1 on failure.
+ */
+int li_unit_cgroup_create(int parent_fd, const char *name,
+			  const struct li_unit_limits *limits);
+
+/**
+ * Move the calling process into a cgroup. Called in the test child.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_cgroup_enter(int cgroup_fd);
+
+/**
+ * Kill anything left in the cgroup of a test, and remove it.
+ *
+ * :param parent_fd: The file descriptor from
+ *                   :c:func:`li_unit_cgroup_setup`.
+ * :param name: The name the cgroup was created with.
+ * :param cgroup_fd: The file descriptor for the cgroup, which is
+ *                   closed.
+ * :param peak_kb: Set to the peak memory usage of the cgroup, in KiB,
+ *                 or 0 if the kernel does not record it.
+ */
+void li_unit_cgroup_destroy(int parent_fd, const char *name, int cgroup_fd,
+			    uint64_t *peak_kb);
+
+#endif /* LITHIUM_SRC_UNIT_RESOURCES_H_ */
@@ -0,0 +1,409 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "result.h"
+#include "unit.h"
+#include "util/hash.h"
+
+static uint32_t header_check(const struct li_unit_result_record *header)
+{
+	return li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, header,
+				offsetof(struct li_unit_result_record, check));
+}
+
+static uint32_t record_trailer(const struct li_unit_result_record *header,
+			       const void *a, size_t a_len, const void *b,
+			       size_t b_len)
+{
+	uint64_t hash = li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, header,
+					 sizeof(*header));
+
+	hash = li_util_fnv1a_64(hash, a, a_len);
+	return li_util_fnv1a_64(hash, b, b_len);
+}
+
+int li_unit_result_write(int fd, uint32_t job,
+			 enum li_unit_result_record_type type, const void *a,
+			 size_t a_len, const void *b, size_t b_len)
+{
+	struct li_unit_result_record header = {
+		.magic = LI_UNIT_RESULT_MAGIC,
+		.type = type,
+		.length = a_len + b_len,
+		.job = job,
+	};
+	uint32_t trailer;
+	struct iovec iov[] = {
+		{ .iov_base = &header, .iov_len = sizeof(header) },
+		{ .iov_base = (void *)a, .iov_len = a_len },
+		{ .iov_base = (void *)b, .iov_len = b_len },
+		{ .iov_base = &trailer, .iov_len = sizeof(trailer) },
+	};
+	size_t total = sizeof(header) + a_len + b_len + sizeof(trailer);
+
+	if (a_len + b_len > LI_UNIT_RESULT_MAX_LENGTH) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	header.check = header_check(&header);
+	trailer = record_trailer(&header, a, a_len, b, b_len);
+
+	/* A single write, so a record is never split by a crash, nor
+	   interleaved with those of other tests */
+	if (writev(fd, iov, ARRAY_SIZE(iov)) != (ssize_t)total)
+		return -1;
+	return 0;
+}
+
+int li_unit_result_add_metric(struct li_unit_result *result, const char *name,
+			      size_t name_len, double value, bool sample)
+{
+	struct li_unit_metric *metric;
+
+	if (result->n_metrics == result->metrics_allocation) {
+		size_t new_allocation = result->metrics_allocation * 2 ?: 8;
+		struct li_unit_metric *new_metrics = reallocarray(
+			result->metrics, new_allocation, sizeof(*new_metrics));
+
+		if (!new_metrics)
+			return -1;
+		result->metrics = new_metrics;
+		result->metrics_allocation = new_allocation;
+	}
+
+	metric = &result->metrics[result->n_metrics];
+	metric->name = strndup(name, name_len);
+	if (!metric->name)
+		return -1;
+	metric->value = value;
+	metric->sample = sample;
+	result->n_metrics++;
+	return 0;
+}
+
+int li_unit_result_set_failure_site(struct li_unit_result *result,
+				    const char *site, size_t len)
+{
+	if (result->failure_site)
+		return 0;
+
+	result->failure_site = strndup(site, len);
+	return result->failure_site ? 0 : -1;
+}
+
+static int parse_record(struct li_unit_result *result, uint32_t type,
+			const char *payload, size_t len)
+{
+	uint64_t counts[2];
+	double value;
+
+	switch (type) {
+	case LI_UNIT_RESULT_ASSERTIONS:
+		if (len != sizeof(counts))
+			return 0;
+		memcpy(counts, payload, sizeof(counts));
+		result->has_assertions = true;
+		result->successful_assertions = counts[0];
+		result->failed_assertions = counts[1];
+		return 0;
+	case LI_UNIT_RESULT_FAILURE_SITE:
+		return li_unit_result_set_failure_site(result, payload, len);
+	case LI_UNIT_RESULT_METRIC:
+	case LI_UNIT_RESULT_BENCH_SAMPLE:
+		if (len < sizeof(value))
+			return 0;
+		memcpy(&value, payload, sizeof(value));
+		return li_unit_result_add_metric(
+			result, payload + sizeof(value), len - sizeof(value),
+			value, type == LI_UNIT_RESULT_BENCH_SAMPLE);
+	default:
+		/* Unknown records are skipped */
+		return 0;
+	}
+}
+
+static bool valid_header(const struct li_unit_result_record *header)
+{
+	return header->magic == LI_UNIT_RESULT_MAGIC &&
+	       header->length <= LI_UNIT_RESULT_MAX_LENGTH &&
+	       header->check == header_check(header);
+}
+
+/*
+ * Find where the next record starts, at or after ``start``. Without
+ * one, skip all but the end, which may be a header still being
+ * written.
+ */
+static size_t find_header(const char *buf, size_t start, size_t len)
+{
+	const uint32_t magic = LI_UNIT_RESULT_MAGIC;
+	struct li_unit_result_record header;
+	const size_t keep = sizeof(header) - 1;
+	const char *found;
+
+	while ((found = memmem(buf + start, len - start, &magic,
+			       sizeof(magic)))) {
+		start = found - buf;
+		if (len - start < sizeof(header))
+			return start;
+
+		memcpy(&header, found, sizeof(header));
+		if (valid_header(&header))
+			return start;
+		start++;
+	}
+
+	return len - start > keep ? len - keep : start;
+}
+
+int li_unit_result_collect(int fd, off_t *offset,
+			   struct li_unit_result *(*find)(uint32_t job,
+							  void *data),
+			   void *data)
+{
+	struct stat st;
+	size_t len, used = 0, parsed = 0;
+	char *buf;
+	int rv = -1;
+
+	if (fstat(fd, &st) < 0) {
+		perror("fstat failed");
+		return -1;
+	}
+
+	if (st.st_size <= *offset)
+		return 0;
+
+	/* Anything appended after this is left for the next call.
+	   The file position is shared with the tests, so it is not
+	   used. */
+	len = st.st_size - *offset;
+	buf = malloc(len);
+	if (!buf) {
+		perror("malloc failed");
+		return -1;
+	}
+
+	while (used < len) {
+		ssize_t read_rv =
+			pread(fd, buf + used, len - used, *offset + used);
+
+		if (read_rv < 0 && errno == EINTR)
+			continue;
+		if (read_rv < 0) {
+			perror("pread failed");
+			goto exit;
+		}
+		if (read_rv == 0)
+			break;
+		used += read_rv;
+	}
+
+	while (used - parsed >= sizeof(struct li_unit_result_record)) {
+		struct li_unit_result_record header;
+		struct li_unit_result *result;
+		const char *payload;
+		size_t record_len;
+		uint32_t trailer;
+
+		memcpy(&header, buf + parsed, sizeof(header));
+		if (!valid_header(&header)) {
+			parsed = find_header(buf, parsed + 1, used);
+			continue;
+		}
+
+		result = find(header.job, data);
+		record_len = sizeof(header) + header.length + sizeof(trailer);
+		if (record_len > used - parsed) {
+			/* The test may still be writing it, unless it
+			   is done */
+			if (result)
+				break;
+			parsed = find_header(buf, parsed + 1, used);
+			continue;
+		}
+
+		/* A record which was cut short runs into the next one,
+		   and does not end with its trailer */
+		payload = buf + parsed + sizeof(header);
+		memcpy(&trailer, payload + header.length, sizeof(trailer));
+		if (trailer != record_trailer(&header, payload, header.length,
+					      NULL, 0)) {
+			parsed = find_header(buf, parsed + 1, used);
+			continue;
+		}
+
+		if (result && parse_record(result, header.type, payload,
+					   header.length) < 0) {
+			perror("failed to parse test result");
+			goto exit;
+		}
+		parsed += record_len;
+	}
+
+	rv = 0;
+
+exit:
+	*offset += parsed;
+	free(buf);
+	return rv;
+}
+
+void li_unit_result_free(struct li_unit_result *result)
+{
+	for (size_t i = 0; i < result->n_metrics; i++)
+		free(result->metrics[i].name);
+	free(result->metrics);
+	free(result->failure_site);
+	memset(result, 0, sizeof(*result));
+}
+
+static struct li_unit_result *find_test_result(uint32_t job, void *data)
+{
+	struct li_unit_result *results = data;
+
+	return job < 2 ? &results[job] : NULL;
+}
+
+static struct li_unit_result_record make_header(uint32_t job, uint32_t type,
+					       uint32_t length)
+{
+	struct li_unit_result_record header = {
+		.magic = LI_UNIT_RESULT_MAGIC,
+		.type = type,
+		.length = length,
+		.job = job,
+	};
+
+	header.check = header_check(&header);
+	return header;
+}
+
+DEFTEST("lithium.unit.result.round_trip",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_result results[2] = { 0 };
+	uint64_t counts[] = { 3, 1 };
+	struct li_unit_result_record header =
+		make_header(1, LI_UNIT_RESULT_ASSERTIONS, sizeof(counts));
+	uint32_t trailer =
+		record_trailer(&header, counts, sizeof(counts), NULL, 0);
+	double value = 1.5;
+	off_t offset = 0;
+	int fd = memfd_create("lithium_result_test", MFD_CLOEXEC);
+
+	ASSERT(fd >= 0);
+	EXPECT(li_unit_result_write(fd, 0, LI_UNIT_RESULT_FAILURE_SITE,
+				    "a.c:1", 5, NULL, 0) == 0);
+	EXPECT(li_unit_result_write(fd, 1, LI_UNIT_RESULT_FAILURE_SITE,
+				    "b.c:1", 5, NULL, 0) == 0);
+	EXPECT(li_unit_result_write(fd, 0, LI_UNIT_RESULT_FAILURE_SITE,
+				    "a.c:2", 5, NULL, 0) == 0);
+	EXPECT(li_unit_result_write(fd, 0, LI_UNIT_RESULT_METRIC, &value,
+				    sizeof(value), "m", 1) == 0);
+	EXPECT(li_unit_result_write(fd, 0, 99, "?", 1, NULL, 0) == 0);
+	EXPECT(li_unit_result_write(fd, 7, LI_UNIT_RESULT_METRIC, &value,
+				    sizeof(value), "x", 1) == 0);
+	EXPECT(li_unit_result_write(fd, 0, LI_UNIT_RESULT_ASSERTIONS, counts,
+				    sizeof(counts), NULL, 0) == 0);
+
+	/* A partly written record, as if another test was still
+	   writing it */
+	EXPECT(write(fd, &header, sizeof(header)) == sizeof(header));
+
+	ASSERT(li_unit_result_collect(fd, &offset, find_test_result,
+				      results) == 0);
+	EXPECT(results[0].has_assertions);
+	EXPECT(results[0].successful_assertions == 3);
+	EXPECT(results[0].failed_assertions == 1);
+	EXPECT(results[0].failure_site &&
+	       !strcmp(results[0].failure_site, "a.c:1"));
+	EXPECT(results[0].n_metrics == 1 &&
+	       !strcmp(results[0].metrics[0].name, "m") &&
+	       results[0].metrics[0].value == 1.5 &&
+	       !results[0].metrics[0].sample);
+	EXPECT(results[1].failure_site &&
+	       !strcmp(results[1].failure_site, "b.c:1"));
+	EXPECT(!results[1].has_assertions);
+
+	/* The rest of the record turns up on the next call */
+	EXPECT(write(fd, counts, sizeof(counts)) == sizeof(counts));
+	EXPECT(write(fd, &trailer, sizeof(trailer)) == sizeof(trailer));
+	ASSERT(li_unit_result_collect(fd, &offset, find_test_result,
+				      results) == 0);
+	EXPECT(results[1].has_assertions);
+	EXPECT(results[1].successful_assertions == 3);
+
+	li_unit_result_free(&results[0]);
+	li_unit_result_free(&results[1]);
+	close(fd);
+}
+
+DEFTEST("lithium.unit.result.garbage",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_result results[2] = { 0 };
+	struct li_unit_result_record bogus =
+		make_header(0, LI_UNIT_RESULT_FAILURE_SITE,
+			    LI_UNIT_RESULT_MAX_LENGTH + 1);
+	uint64_t counts[] = { 5, 0 };
+	struct li_unit_result_record cut_short =
+		make_header(7, LI_UNIT_RESULT_ASSERTIONS, sizeof(counts));
+	double value = 2.5;
+	off_t offset = 0;
+	int fd = memfd_create("lithium_result_test", MFD_CLOEXEC);
+
+	ASSERT(fd >= 0);
+
+	/* Output which is not a record, then a header which claims
+	   more than any record can have */
+	EXPECT(write(fd, "hello\n", 6) == 6);
+	EXPECT(write(fd, &bogus, sizeof(bogus)) == sizeof(bogus));
+	EXPECT(li_unit_result_write(fd, 1, LI_UNIT_RESULT_ASSERTIONS, counts,
+				    sizeof(counts), NULL, 0) == 0);
+
+	/* A record of a test which is done, cut short */
+	EXPECT(write(fd, &cut_short, sizeof(cut_short)) == sizeof(cut_short));
+	EXPECT(li_unit_result_write(fd, 1, LI_UNIT_RESULT_METRIC, &value,
+				    sizeof(value), "m", 1) == 0);
+	EXPECT(write(fd, "\0\0\0", 3) == 3);
+
+	ASSERT(li_unit_result_collect(fd, &offset, find_test_result,
+				      results) == 0);
+	EXPECT(!results[0].failure_site);
+	EXPECT(results[1].has_assertions);
+	EXPECT(results[1].successful_assertions == 5);
+	EXPECT(results[1].n_metrics == 1 &&
+	       results[1].metrics[0].value == 2.5);
+
+	/* The trailing bytes are held back only until they cannot be
+	   the start of a record */
+	EXPECT(write(fd, "more output which is not a record", 33) == 33);
+	EXPECT(li_unit_result_write(fd, 0, LI_UNIT_RESULT_FAILURE_SITE,
+				    "a.c:1", 5, NULL, 0) == 0);
+	ASSERT(li_unit_result_collect(fd, &offset, find_test_result,
+				      results) == 0);
+	EXPECT(results[0].failure_site &&
+	       !strcmp(results[0].failure_site, "a.c:1"));
+	EXPECT(offset == lseek(fd, 0, SEEK_END));
+
+	li_unit_result_free(&results[0]);
+	li_unit_result_free(&results[1]);
+	close(fd);
+}
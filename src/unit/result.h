@@ -0,0 +1,111 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_RESULT_H_
+#define LITHIUM_SRC_UNIT_RESULT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "unit.h"
+
+/**
+ * The environment variable which tells a test child the file
+ * descriptor of the result channel, and the job its records are
+ * tagged with, as ``fd:job``.
+ */
+#define LI_UNIT_RESULT_FD_ENV "LITHIUM_UNIT_RESULT_FD"
+
+/**
+ * The result channel is a single file, opened with ``O_APPEND``, which
+ * every test child appends records to. The runner reads the new
+ * records each time a child exits. Each record is a header, tagged
+ * with the job of the test which wrote it, followed by ``length``
+ * bytes of payload, and then a ``uint32_t`` trailer, in host byte
+ * order. The header starts with ``LI_UNIT_RESULT_MAGIC`` and ends
+ * with a hash of its other fields, and the trailer is a hash of the
+ * header and payload, so that the reader can tell a record which was
+ * cut short, and find the next one after anything else which was
+ * written to the channel. The payload is one of:
+ *
+ * - ``ASSERTIONS``: two ``uint64_t``, the number of successful and
+ *   failed assertions.
+ * - ``FAILURE_SITE``: the message of the first failed assertion.
+ * - ``METRIC`` and ``BENCH_SAMPLE``: a ``double``, then the name.
+ */
+enum li_unit_result_record_type {
+	LI_UNIT_RESULT_ASSERTIONS = 1,
+	LI_UNIT_RESULT_FAILURE_SITE,
+	LI_UNIT_RESULT_METRIC,
+	LI_UNIT_RESULT_BENCH_SAMPLE,
+};
+
+#define LI_UNIT_RESULT_MAGIC 0x6c695265 /* "eRil" */
+
+/* Longer records are not written, and headers claiming more are
+   skipped as garbage */
+#define LI_UNIT_RESULT_MAX_LENGTH (1 << 20)
+
+struct li_unit_result_record {
+	uint32_t magic;
+	uint32_t type;
+	uint32_t length;
+	uint32_t job;
+	uint32_t check;
+};
+
+/**
+ * Append a record, with its payload in two parts.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_result_write(int fd, uint32_t job,
+			 enum li_unit_result_record_type type, const void *a,
+			 size_t a_len, const void *b, size_t b_len);
+
+/**
+ * Add a metric or benchmark sample to a result.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_result_add_metric(struct li_unit_result *result, const char *name,
+			      size_t name_len, double value, bool sample);
+
+/**
+ * Set where a test first failed, unless it already was.
+ *
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_result_set_failure_site(struct li_unit_result *result,
+				    const char *site, size_t len);
+
+/**
+ * Read the records added to a result channel since the last call, and
+ * add each to the result of its job. A record which is only partly
+ * written is left for the next call, unless ``find`` returns NULL for
+ * its job, in which case nothing more will be written to it, and it is
+ * skipped. Bytes which are not part of a record are skipped too.
+ *
+ * :param fd: The result channel.
+ * :param offset: Where to start reading, updated to the end of what
+ *                was read.
+ * :param find: Returns the result for a job, or NULL if the job is no
+ *              longer running, to skip its records.
+ * :param data: Passed to ``find``.
+ * :return: 0 on success, -1 on failure.
+ */
+int li_unit_result_collect(int fd, off_t *offset,
+			   struct li_unit_result *(*find)(uint32_t job,
+							  void *data),
+			   void *data);
+
+/**
+ * Free a result.
+ */
+void li_unit_result_free(struct li_unit_result *result);
+
+#endif /* LITHIUM_SRC_UNIT_RESULT_H_ */
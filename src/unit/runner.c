@@ -3,16 +3,24 @@
  * found in the LICENSE file.
  */
 
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <sys/sysinfo.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -20,22 +28,141 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "baseline.h"
+#include "cache.h"
 #include "constants.h"
+#include "deadline.h"
+#include "fuzz.h"
+#include "history.h"
+#include "jobserver.h"
+#include "output.h"
+#include "perf.h"
+#include "report.h"
+#include "resources.h"
+#include "result.h"
+#include "schedule.h"
+#include "spawn.h"
 #include "unit.h"
+#include "util/hash.h"
 #include "util/timespec.h"
 
-struct li_unit_test *li_unit_test_list = NULL;
+/* Maximum number of ready file descriptors handled per wakeup */
+#define EPOLL_MAX_EVENTS 64
 
-#define TEST_OUTPUT_READ_SIZE 4096
+/*
+ * File descriptors the runner needs apart from those of running
+ * tests: the standard streams, epoll, the reports, the jobserver, the
+ * result channel, and those opened while spawning a test.
+ */
+#define RESERVED_FDS 64
+
+/*
+ * Each file descriptor registered with epoll carries the kind of
+ * event in the low bits of its data, and the job slot of the test it
+ * belongs to (if any) in the remaining bits.
+ */
+#define EVENT_KIND_BITS 8
+#define EVENT_KIND_MASK ((1 << EVENT_KIND_BITS) - 1)
+
+enum event_kind {
+	EVENT_TEST_OUTPUT,
+	EVENT_TEST_EXIT,
+	EVENT_SIGCHLD,
+	EVENT_JOBSERVER,
+	EVENT_THREAD_DONE,
+};
+
+/*
+ * A test with thread isolation runs on a thread of its own, which
+ * holds a job slot just like a test process. When the test is done,
+ * the thread writes the slot to the thread pipe, and the main loop
+ * joins it and reports the result.
+ */
+struct thread_job {
+	pthread_t thread;
+	bool running;
+	bool succeeded;
+	char *output;
+	size_t output_size;
+};
 
 static struct {
 	unsigned int completed_tests;
-	unsigned int total_tests;
 	int running_jobs;
-	int notify_pipe[2];
+	int epoll_fd;
 	struct timespec status_update_deadline;
-	struct li_unit_test *first_unfinished_test;
-	struct li_unit_test *remaining_tests;
+
+	/* The tests in this run, in the order they were given */
+	struct li_unit_test **tests;
+	size_t n_tests;
+
+	/* The same tests, in the order they should be started, less
+	   any which are cached */
+	struct li_unit_test **queue;
+	size_t n_queued;
+	size_t next_queued;
+
+	/* Running tests, indexed by job slot */
+	struct li_unit_test **slots;
+	unsigned int *free_slots;
+	unsigned int n_free_slots;
+
+	/* Threads running tests, indexed by job slot, and the pipe
+	   they write their slot to when done. Once a thread cannot be
+	   created, the remaining tests run as processes. */
+	struct thread_job *thread_jobs;
+	int thread_pipe[2];
+	bool threads_unavailable;
+
+	/* The result channel shared by every test process, and how
+	   far into it the runner has read */
+	int result_fd;
+	off_t result_offset;
+
+	/* The start of the result channel, up to here, is freed */
+	off_t result_punched;
+
+	/* Running tests which have a deadline */
+	struct li_unit_deadline_heap deadlines;
+
+	/* Set while a test which must run alone is running */
+	bool exclusive_running;
+
+	/* Fallback for kernels without pidfd support: SIGCHLD is
+	   blocked and read from a signalfd instead */
+	bool use_signalfd;
+	int signal_fd;
+	sigset_t saved_sigmask;
+
+	/* When run from make, each running test holds a job token */
+	struct li_unit_jobserver jobserver;
+	bool waiting_for_job_token;
+
+	/* Machine-readable reports, written as tests complete */
+	struct li_unit_reporter reporters[3];
+	unsigned int n_reporters;
+
+	/* Limits on each test process, and the cgroup directory tests
+	   are placed under, if any */
+	struct li_unit_limits limits;
+	int cgroup_fd;
+	unsigned int next_cgroup_id;
+
+	/* True if every test counts hardware events */
+	bool perf_counters;
+
+	/* Benchmark samples to compare with, if given */
+	struct li_unit_baseline baseline;
+	bool compare_baseline;
+	double baseline_alpha;
+	double baseline_threshold;
+
+	/* Tests which passed before, if caching, and the hash of the
+	   binary the last key was made for */
+	struct li_unit_cache cache;
+	const char *cache_binary;
+	bool cache_binary_hashed;
+	uint64_t cache_binary_hash;
 } runner_state;
 
 static const char *test_state_pretty_print[] = {
@@ -47,10 +174,303 @@ static const char *test_state_pretty_print[] = {
 	[_LI_UNIT_DEADLINE_EXCEEDED] = "DEADLINE EXCEEDED",
 };
 
-static int spawn_test(int default_timeout)
+static bool is_exclusive(const struct li_unit_test *test)
+{
+	return test->bench || test->options.exclusive;
+}
+
+/*
+ * Tests which must run alone are run as processes whatever their
+ * isolation, as threads cannot be kept apart from the runner.
+ */
+static bool runs_in_thread(const struct li_unit_test *test)
+{
+	return test->options.isolation == LI_UNIT_ISOLATION_THREAD &&
+	       !is_exclusive(test) && !runner_state.threads_unavailable;
+}
+
+static bool has_thread_tests(const struct li_unit_runner_options *options)
+{
+	for (const struct li_unit_test *test = options->test_list; test;
+	     test = test->rest) {
+		if (runs_in_thread(test))
+			return true;
+	}
+	return false;
+}
+
+static bool counts_events(const struct li_unit_test *test)
+{
+	return runner_state.perf_counters || test->options.max_instructions;
+}
+
+/*
+ * Return the next test to start, or NULL if there are no more.
+ */
+static struct li_unit_test *next_queued_test(void)
+{
+	if (runner_state.next_queued == runner_state.n_queued)
+		return NULL;
+	return runner_state.queue[runner_state.next_queued];
+}
+
+/*
+ * Make sure the runner can keep the file descriptors of each running
+ * test open: its pidfd, the read end of its output pipe (or its output
+ * file), and its cgroup. The hard limit is checked before any test
+ * starts, rather than running out part way through the run.
+ */
+static int raise_fd_limit(const struct li_unit_runner_options *options)
+{
+	unsigned long long per_job = 2 + (options->cgroup != NULL);
+
+	return li_unit_raise_fd_limit(RESERVED_FDS +
+					      per_job * options->parallelism,
+				      &runner_state.limits.default_open_files);
+}
+
+static int pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(SYS_pidfd_open, pid, flags);
+}
+
+static int epoll_add(int fd, enum event_kind kind, unsigned int slot)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.u64 = ((uint64_t)slot << EVENT_KIND_BITS) | kind,
+	};
+
+	if (epoll_ctl(runner_state.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		perror("epoll_ctl failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Acquire a job token for the next test. If none is available, the
+ * jobserver is polled until one might be.
+ */
+static int acquire_job_token(void)
+{
+	int rv = li_unit_jobserver_acquire(&runner_state.jobserver);
+
+	if (rv == 0 && !runner_state.waiting_for_job_token) {
+		if (epoll_add(runner_state.jobserver.read_fd, EVENT_JOBSERVER,
+			      0) < 0)
+			return -1;
+		runner_state.waiting_for_job_token = true;
+	}
+	return rv;
+}
+
+/*
+ * Stop polling the jobserver once it is readable, as it stays
+ * readable while any tokens are free, even when we have no use for
+ * them.
+ */
+static int handle_jobserver_readable(void)
+{
+	if (epoll_ctl(runner_state.epoll_fd, EPOLL_CTL_DEL,
+		      runner_state.jobserver.read_fd, NULL) < 0) {
+		perror("epoll_ctl failed");
+		return -1;
+	}
+	runner_state.waiting_for_job_token = false;
+	return 0;
+}
+
+/*
+ * Open an anonymous file for a test to write into: a memfd, or an
+ * unlinked temporary file if memfds are not supported.
+ */
+static int open_capture_file(const char *name)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	int fd = memfd_create(name, MFD_CLOEXEC);
+
+	if (fd >= 0)
+		return fd;
+
+	if (!tmpdir)
+		tmpdir = P_tmpdir;
+
+	return open(tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+}
+
+static void test_cgroup_name(struct li_unit_test *test, char *name,
+			     size_t name_size)
+{
+	snprintf(name, name_size, "test-%d-%u", (int)getpid(),
+		 test->priv.cgroup_id);
+}
+
+/*
+ * Remove the cgroup of a test which has exited, recording its peak
+ * memory use.
+ */
+static void destroy_test_cgroup(struct li_unit_test *test)
+{
+	char name[64];
+
+	if (test->priv.cgroup_fd < 0)
+		return;
+
+	test_cgroup_name(test, name, sizeof(name));
+	li_unit_cgroup_destroy(runner_state.cgroup_fd, name,
+			       test->priv.cgroup_fd,
+			       &test->priv.memory_peak_kb);
+	test->priv.cgroup_fd = -1;
+}
+
+/*
+ * The timeout of a test in milliseconds, or -1 for none.
+ */
+static long test_timeout_ms(const struct li_unit_runner_options *options,
+			    const struct li_unit_test *test)
+{
+	long default_timeout_ms = options->default_timeout_ms;
+	int timeout_multiplier = test->options.timeout_multiplier;
+
+	if (test->options.timeout_ms > 0)
+		return test->options.timeout_ms;
+
+	if (!default_timeout_ms && options->default_timeout > 0)
+		default_timeout_ms = options->default_timeout * MSEC_PER_SEC;
+
+	if (timeout_multiplier == 0)
+		timeout_multiplier = 1;
+
+	if (timeout_multiplier < 0 || default_timeout_ms <= 0)
+		return -1;
+	return timeout_multiplier * default_timeout_ms;
+}
+
+/*
+ * The usage of a test run on a thread is the difference in the usage
+ * of that thread. The peak RSS is for the whole process, so it is
+ * left out.
+ */
+static void thread_rusage_subtract(const struct rusage *after,
+				   const struct rusage *before,
+				   struct rusage *out)
+{
+	memset(out, 0, sizeof(*out));
+	timersub(&after->ru_utime, &before->ru_utime, &out->ru_utime);
+	timersub(&after->ru_stime, &before->ru_stime, &out->ru_stime);
+	out->ru_minflt = after->ru_minflt - before->ru_minflt;
+	out->ru_majflt = after->ru_majflt - before->ru_majflt;
+	out->ru_nvcsw = after->ru_nvcsw - before->ru_nvcsw;
+	out->ru_nivcsw = after->ru_nivcsw - before->ru_nivcsw;
+}
+
+/*
+ * Run a test on its own thread. Only the test and its job are
+ * touched here; the main loop does the rest once the thread is done.
+ */
+static void *run_thread_test(void *data)
+{
+	struct li_unit_test *test = data;
+	struct thread_job *job = &runner_state.thread_jobs[test->priv.slot];
+	unsigned int slot = test->priv.slot;
+	struct rusage rusage_before, rusage_after;
+	struct li_unit_perf_counters counters;
+	bool counts_unavailable = false;
+	struct timespec now;
+
+	getrusage(RUSAGE_THREAD, &rusage_before);
+
+	/* Only this thread runs the test, so only it is counted */
+	if (counts_events(test) && li_unit_perf_open(&counters, false) < 0)
+		counts_unavailable = true;
+
+	FILE *out = open_memstream(&job->output, &job->output_size);
+	if (out) {
+		job->succeeded = li_unit_run_test_in_thread(
+			test, out, &test->priv.result);
+		fclose(out);
+	} else {
+		perror("open_memstream failed");
+	}
+
+	if (counts_events(test) && !counts_unavailable) {
+		for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++) {
+			const char *name = li_unit_perf_counter_names[i];
+			uint64_t count;
+
+			if (li_unit_perf_read(&counters, i, &count))
+				li_unit_result_add_metric(&test->priv.result,
+							  name, strlen(name),
+							  count, false);
+		}
+		li_unit_perf_close(&counters);
+	}
+
+	getrusage(RUSAGE_THREAD, &rusage_after);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	li_util_timespec_subtract(&now, &test->priv.start_time,
+				  &test->priv.elapsed_time);
+	thread_rusage_subtract(&rusage_after, &rusage_before,
+			       &test->priv.rusage);
+
+	/* Smaller than PIPE_BUF, so written all at once */
+	while (write(runner_state.thread_pipe[1], &slot, sizeof(slot)) < 0 &&
+	       errno == EINTR)
+		;
+	return NULL;
+}
+
+/*
+ * Start a test with thread isolation. Returns 1 if no thread could be
+ * created, in which case it should run as a process instead.
+ */
+static int start_thread_test(struct li_unit_test *test)
+{
+	struct thread_job *job = &runner_state.thread_jobs[test->priv.slot];
+	int err;
+
+	memset(job, 0, sizeof(*job));
+	test->priv.has_deadline = false;
+
+	err = pthread_create(&job->thread, NULL, run_thread_test, test);
+	if (err) {
+		errno = err;
+		perror("pthread_create failed");
+		fprintf(stderr, "Running tests with thread isolation as "
+			"processes instead.\n");
+		runner_state.threads_unavailable = true;
+		return 1;
+	}
+
+	job->running = true;
+	return 0;
+}
+
+/*
+ * Wait for the threads which are still running tests, so that none
+ * outlives the state it uses.
+ */
+static void join_thread_tests(unsigned int parallelism)
+{
+	if (!runner_state.thread_jobs)
+		return;
+
+	for (unsigned int i = 0; i < parallelism; i++) {
+		struct thread_job *job = &runner_state.thread_jobs[i];
+
+		if (job->running)
+			pthread_join(job->thread, NULL);
+		free(job->output);
+		memset(job, 0, sizeof(*job));
+	}
+}
+
+static int spawn_test(struct li_unit_runner_options *options)
 {
 	int flags;
-	struct li_unit_test *test = runner_state.remaining_tests;
+	int output_fd;
+	struct li_unit_test *test = next_queued_test();
 
 	if (test->priv.state != _LI_UNIT_NOT_STARTED) {
 		fprintf(stderr, "Invalid state transition: %s -> %s\n",
@@ -60,90 +480,129 @@ static int spawn_test(int default_timeout)
 	}
 	test->priv.state = _LI_UNIT_RUNNING;
 
-	runner_state.remaining_tests = runner_state.remaining_tests->rest;
+	runner_state.next_queued++;
 	runner_state.running_jobs++;
+	if (is_exclusive(test))
+		runner_state.exclusive_running = true;
+
+	test->priv.slot = runner_state.free_slots[--runner_state.n_free_slots];
+	test->priv.pidfd = -1;
+	runner_state.slots[test->priv.slot] = test;
 
 	if (clock_gettime(CLOCK_MONOTONIC, &test->priv.start_time) < 0) {
 		perror("clock_gettime failed");
 		return -1;
 	}
 
-	if (pipe(test->priv.output_pipe) < 0) {
-		perror("pipe failed");
-		return -1;
+	if (runs_in_thread(test) && start_thread_test(test) == 0)
+		return 0;
+
+	test->priv.output_file = -1;
+	if (options->capture_to_memfd) {
+		test->priv.output_file = open_capture_file("li_unit_output");
+		if (test->priv.output_file < 0)
+			perror("Failed to create an output file, using a pipe");
 	}
 
-	pid_t pid = fork();
-	if (pid < 0) {
-		perror("fork failed");
-		return -1;
+	test->priv.cgroup_fd = -1;
+	if (runner_state.cgroup_fd >= 0) {
+		char name[64];
+
+		test->priv.cgroup_id = runner_state.next_cgroup_id++;
+		test_cgroup_name(test, name, sizeof(name));
+		test->priv.cgroup_fd = li_unit_cgroup_create(
+			runner_state.cgroup_fd, name, &runner_state.limits);
+		if (test->priv.cgroup_fd < 0)
+			return -1;
 	}
 
-	if (pid == 0) {
-		/* child process */
+	if (test->priv.output_file >= 0) {
+		output_fd = test->priv.output_file;
+	} else if (pipe2(test->priv.output_pipe, O_CLOEXEC) < 0) {
+		perror("pipe failed");
+		return -1;
+	} else {
+		output_fd = test->priv.output_pipe[1];
+	}
 
-		if (close(test->priv.output_pipe[0]) < 0) {
-			perror("close failed");
-			abort();
-		}
+	struct li_unit_spawn_request req = {
+		.test = test,
+		.output_fd = output_fd,
+		.result_fd = runner_state.result_fd,
+		.result_job = test->priv.job,
+		.cgroup_fd = test->priv.cgroup_fd,
+		.limits = runner_state.limits,
+		.perf_counters = counts_events(test),
+	};
+	if (runner_state.use_signalfd)
+		req.sigmask = &runner_state.saved_sigmask;
+
+	pid_t pid = li_unit_spawn(&req);
+	if (pid < 0)
+		return -1;
 
-		/* Redirect stdout to pipe */
-		if (dup2(test->priv.output_pipe[1], STDOUT_FILENO) < 0) {
-			perror("dup2 failed");
-			abort();
-		}
+	test->priv.pid = pid;
 
-		/* Redirect stderr to pipe */
-		if (dup2(test->priv.output_pipe[1], STDERR_FILENO) < 0) {
-			perror("dup2 failed");
-			abort();
+	if (!runner_state.use_signalfd) {
+		/* We have not reaped the child yet, so the pid cannot
+		   have been reused, even if the child already exited */
+		test->priv.pidfd = pidfd_open(pid, 0);
+		if (test->priv.pidfd < 0) {
+			perror("pidfd_open failed");
+			return -1;
 		}
 
-		li_unit_run_test(test);
+		if (epoll_add(test->priv.pidfd, EVENT_TEST_EXIT,
+			      test->priv.slot) < 0)
+			return -1;
 	}
 
-	test->priv.pid = pid;
+	/* Output written to a file is left alone until the test
+	   exits */
+	if (test->priv.output_file < 0) {
+		if (close(test->priv.output_pipe[1]) < 0) {
+			perror("close failed");
+			return -1;
+		}
 
-	if (close(test->priv.output_pipe[1]) < 0) {
-		perror("close failed");
-		return -1;
-	}
+		if ((flags = fcntl(test->priv.output_pipe[0], F_GETFL)) < 0) {
+			perror("fcntl failed");
+			return -1;
+		}
 
-	if ((flags = fcntl(test->priv.output_pipe[0], F_GETFL)) < 0) {
-		perror("fcntl failed");
-		return -1;
-	}
+		if (fcntl(test->priv.output_pipe[0], F_SETFL,
+			  flags | O_NONBLOCK) < 0) {
+			perror("fcntl failed");
+			return -1;
+		}
 
-	if (fcntl(test->priv.output_pipe[0], F_SETFL, flags | O_NONBLOCK) < 0) {
-		perror("fcntl failed");
-		return -1;
+		if (epoll_add(test->priv.output_pipe[0], EVENT_TEST_OUTPUT,
+			      test->priv.slot) < 0)
+			return -1;
 	}
 
 	/* compute the deadline for the test */
-	int timeout_multiplier = test->options.timeout_multiplier;
-
-	if (timeout_multiplier == 0)
-		timeout_multiplier = 1;
+	long timeout_ms = test_timeout_ms(options, test);
 
-	if (timeout_multiplier > 0 && default_timeout > 0) {
-		test->priv.has_deadline = true;
-		test->priv.deadline.tv_nsec = test->priv.start_time.tv_nsec;
-		test->priv.deadline.tv_sec =
-			test->priv.start_time.tv_sec +
-			(timeout_multiplier * default_timeout);
-	} else {
-		test->priv.has_deadline = false;
+	test->priv.has_deadline = timeout_ms > 0;
+	if (test->priv.has_deadline) {
+		test->priv.deadline = test->priv.start_time;
+		li_util_timespec_add_ms(&test->priv.deadline, timeout_ms);
+		li_unit_deadline_heap_push(&runner_state.deadlines, test);
 	}
 
 	return 0;
 }
 
+/*
+ * Read any pending output from a test. Returns 1 if the end of the
+ * output was reached, 0 if the read would block, or -1 on error.
+ */
 static int test_update_output_buffer(struct li_unit_test *test, bool block)
 {
 	for (;;) {
-		ssize_t read_rv = li_reallocating_buffer_read(
-			test->priv.output_pipe[0], &test->priv.output,
-			TEST_OUTPUT_READ_SIZE);
+		ssize_t read_rv = li_unit_output_read(
+			&test->priv.output, test->priv.output_pipe[0]);
 
 		if (read_rv < 0) {
 			if (errno == EWOULDBLOCK || errno == EAGAIN) {
@@ -156,76 +615,583 @@ static int test_update_output_buffer(struct li_unit_test *test, bool block)
 		}
 
 		if (read_rv == 0)
-			return 0;
+			return 1;
 	}
 }
 
-static int handle_waitpid(pid_t pid, int status)
+static int unregister_output_pipe(struct li_unit_test *test)
 {
-	struct li_unit_test *test = runner_state.first_unfinished_test;
+	/* Children forked later may still hold a copy of the read end
+	   of this pipe, so closing it is not enough to remove it from
+	   the interest list. */
+	if (epoll_ctl(runner_state.epoll_fd, EPOLL_CTL_DEL,
+		      test->priv.output_pipe[0], NULL) < 0 &&
+	    errno != ENOENT) {
+		perror("epoll_ctl failed");
+		return -1;
+	}
+	return 0;
+}
 
-	struct timespec now;
-	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
-		perror("clock_gettime failed");
+/*
+ * Read the output of a test which wrote it into a file, if the test
+ * failed, and close the file.
+ */
+static int collect_output_file(struct li_unit_test *test)
+{
+	int fd = test->priv.output_file;
+	ssize_t read_rv = 0;
+
+	if (test->priv.state == _LI_UNIT_SUCCEEDED)
+		goto exit;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		perror("lseek failed");
+		read_rv = -1;
+		goto exit;
+	}
+
+	/* The file may still grow, if the test left children behind */
+	do {
+		read_rv = li_unit_output_read(&test->priv.output, fd);
+	} while (read_rv > 0);
+
+	if (read_rv < 0)
+		perror("read failed");
+
+exit:
+	if (close(fd) < 0) {
+		perror("close error");
 		return -1;
 	}
+	return read_rv < 0 ? -1 : 0;
+}
+
+static struct li_unit_result *find_running_result(uint32_t job, void *data)
+{
+	struct li_unit_test *test;
+
+	if (job >= runner_state.n_tests)
+		return NULL;
+
+	/* Anything left behind by a test which already completed is
+	   too late */
+	test = runner_state.tests[job];
+	if (test->priv.state != _LI_UNIT_RUNNING &&
+	    test->priv.state != _LI_UNIT_PENDING_DEADLINE_EXCEEDED)
+		return NULL;
+	return &test->priv.result;
+}
+
+/*
+ * Read what the tests wrote to the result channel since the last
+ * time. Every record of a test process which exited is in by now.
+ */
+static void collect_results(void)
+{
+	const long page_size = sysconf(_SC_PAGESIZE);
+	off_t punch;
+
+	if (runner_state.result_fd < 0)
+		return;
+
+	if (li_unit_result_collect(runner_state.result_fd,
+				   &runner_state.result_offset,
+				   find_running_result, NULL) < 0)
+		fprintf(stderr, "Failed to read test results.\n");
+
+	/* Writers append, so the channel can be emptied whenever no
+	   test is running */
+	if (runner_state.running_jobs == 0 && runner_state.result_offset &&
+	    ftruncate(runner_state.result_fd, 0) == 0) {
+		runner_state.result_offset = 0;
+		runner_state.result_punched = 0;
+		return;
+	}
+
+	/* Otherwise, free the pages which were read (if the file
+	   system can), so the channel does not grow for the whole
+	   run */
+	punch = runner_state.result_offset & ~(off_t)(page_size - 1);
+	if (punch > runner_state.result_punched &&
+	    fallocate(runner_state.result_fd,
+		      FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+		      runner_state.result_punched,
+		      punch - runner_state.result_punched) == 0)
+		runner_state.result_punched = punch;
+}
+
+static void report_test_result(struct li_unit_test *test)
+{
+	const char *reason;
+
+	switch (test->priv.state) {
+	case _LI_UNIT_SUCCEEDED:
+		reason = test->priv.cached ? "cached" : "succeeded";
+		break;
+	case _LI_UNIT_DEADLINE_EXCEEDED:
+		reason = "timed out";
+		break;
+	default:
+		reason = "failed";
+		break;
+	}
+
+	runner_state.completed_tests++;
+	fprintf(stderr, "[%3u/%zu] %s %s! (%lld.%03lds)\n",
+		runner_state.completed_tests, runner_state.n_tests,
+		test->name, reason, (long long)test->priv.elapsed_time.tv_sec,
+		test->priv.elapsed_time.tv_nsec / NSEC_PER_MSEC);
+}
+
+/*
+ * Write the records of a completed test to each report, and then
+ * keep its output only if it failed.
+ */
+static void finish_test_output(struct li_unit_test *test)
+{
+	for (unsigned int i = 0; i < runner_state.n_reporters; i++)
+		li_unit_reporter_test_finished(&runner_state.reporters[i],
+					       test);
+
+	if (test->priv.state == _LI_UNIT_SUCCEEDED)
+		li_unit_output_discard(&test->priv.output);
+	else
+		li_unit_output_retain(&test->priv.output);
+}
+
+static uint64_t rusage_cpu_ns(const struct rusage *rusage)
+{
+	return (rusage->ru_utime.tv_sec + rusage->ru_stime.tv_sec) *
+		       NSEC_PER_SEC +
+	       (rusage->ru_utime.tv_usec + rusage->ru_stime.tv_usec) *
+		       NSEC_PER_USEC;
+}
+
+static const struct li_unit_metric *
+find_metric(const struct li_unit_result *result, const char *name)
+{
+	for (size_t i = 0; i < result->n_metrics; i++) {
+		if (!result->metrics[i].sample &&
+		    !strcmp(result->metrics[i].name, name))
+			return &result->metrics[i];
+	}
+	return NULL;
+}
+
+/*
+ * Fail a test which succeeded, but went over its resource budgets.
+ * Returns true, and describes why in msg, if it did.
+ */
+static bool check_budgets(struct li_unit_test *test, char *msg,
+			  size_t msg_size)
+{
+	const struct li_unit_test_options *options = &test->options;
+	const struct rusage *rusage = &test->priv.rusage;
+	uint64_t cpu_ms = rusage_cpu_ns(rusage) / NSEC_PER_MSEC;
+	long max_rss_kb = rusage->ru_maxrss;
+	const struct li_unit_metric *instructions =
+		find_metric(&test->priv.result, "instructions");
+
+	if (test->priv.state != _LI_UNIT_SUCCEEDED)
+		return false;
+
+	/* The cgroup counts every process of the test, and the page
+	   cache it used */
+	if (test->priv.memory_peak_kb > max_rss_kb)
+		max_rss_kb = test->priv.memory_peak_kb;
+
+	if (options->max_rss_kb && !runs_in_thread(test) &&
+	    max_rss_kb > options->max_rss_kb) {
+		snprintf(msg, msg_size,
+			 "Test exceeded its memory budget: %ld KiB max RSS, "
+			 "limit is %ld KiB",
+			 max_rss_kb, options->max_rss_kb);
+	} else if (options->max_cpu_ms && cpu_ms > options->max_cpu_ms) {
+		snprintf(msg, msg_size,
+			 "Test exceeded its CPU budget: %llu ms, limit is "
+			 "%ld ms",
+			 (unsigned long long)cpu_ms, options->max_cpu_ms);
+	} else if (options->max_instructions && instructions &&
+		   instructions->value > options->max_instructions) {
+		snprintf(msg, msg_size,
+			 "Test exceeded its instruction budget: %.0f "
+			 "instructions, limit is %llu",
+			 instructions->value,
+			 (unsigned long long)options->max_instructions);
+	} else {
+		return false;
+	}
+
+	test->priv.state = _LI_UNIT_FAILED;
+	li_unit_result_set_failure_site(&test->priv.result, msg, strlen(msg));
+	return true;
+}
+
+static int double_cmp(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+
+	return (da > db) - (da < db);
+}
+
+/*
+ * The median of some values, which are sorted in place.
+ */
+static double median(double *values, size_t n)
+{
+	qsort(values, n, sizeof(*values), double_cmp);
+	return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+/*
+ * The benchmark samples a test reported under a name, in a new array.
+ */
+static double *collect_samples(const struct li_unit_result *result,
+			       const char *name, size_t *n_samples)
+{
+	double *samples = calloc(result->n_metrics, sizeof(*samples));
+
+	*n_samples = 0;
+	if (!samples) {
+		perror("calloc failed");
+		return NULL;
+	}
+
+	for (size_t i = 0; i < result->n_metrics; i++) {
+		if (result->metrics[i].sample &&
+		    !strcmp(result->metrics[i].name, name))
+			samples[(*n_samples)++] = result->metrics[i].value;
+	}
+	return samples;
+}
+
+/*
+ * True if the metric at index i is a benchmark sample, and the first
+ * sample with its name.
+ */
+static bool first_sample_named(const struct li_unit_result *result,
+			       size_t i)
+{
+	if (!result->metrics[i].sample)
+		return false;
+
+	for (size_t j = 0; j < i; j++) {
+		if (result->metrics[j].sample &&
+		    !strcmp(result->metrics[j].name, result->metrics[i].name))
+			return false;
+	}
+	return true;
+}
+
+static void add_baseline_metric(struct li_unit_result *result,
+				const char *sample_name, const char *suffix,
+				double value)
+{
+	char name[128];
+	int len = snprintf(name, sizeof(name), "%s_%s", sample_name, suffix);
+
+	if (len > 0 && (size_t)len < sizeof(name))
+		li_unit_result_add_metric(result, name, len, value, false);
+}
+
+/*
+ * Compare each set of benchmark samples of a test with its baseline,
+ * adding how much it changed as metrics. Fail a test which succeeded,
+ * but is significantly slower than its baseline. Returns true, and
+ * describes why in msg, if it is.
+ */
+static bool compare_with_baseline(struct li_unit_test *test, char *msg,
+				  size_t msg_size)
+{
+	struct li_unit_result *result = &test->priv.result;
+	size_t n_metrics = result->n_metrics;
+	bool regressed = false;
+
+	if (!runner_state.compare_baseline ||
+	    test->priv.state != _LI_UNIT_SUCCEEDED)
+		return false;
+
+	/* Only benchmark samples are compared: they are times, where
+	   higher is worse, while other metrics (including those added
+	   here) may go either way. Metrics are added as we go, so only
+	   look at those which were reported by the test. */
+	for (size_t i = 0; i < n_metrics; i++) {
+		const char *name = result->metrics[i].name;
+		const struct li_unit_baseline_entry *entry;
+		double *samples, *old_samples;
+		size_t n_samples;
+		double p, old_median, new_median, change;
+
+		if (!first_sample_named(result, i))
+			continue;
+
+		entry = li_unit_baseline_lookup(&runner_state.baseline,
+						test->name, name);
+		if (!entry)
+			continue;
+
+		samples = collect_samples(result, name, &n_samples);
+		old_samples = calloc(entry->n_samples, sizeof(*old_samples));
+		if (!samples || !old_samples) {
+			free(samples);
+			free(old_samples);
+			continue;
+		}
+		memcpy(old_samples, entry->samples,
+		       entry->n_samples * sizeof(*old_samples));
+
+		p = li_unit_mann_whitney_p(old_samples, entry->n_samples,
+					   samples, n_samples);
+		old_median = median(old_samples, entry->n_samples);
+		new_median = median(samples, n_samples);
+		change = old_median > 0 ? new_median / old_median - 1 : 0;
+		free(samples);
+		free(old_samples);
+
+		add_baseline_metric(result, name, "baseline_change", change);
+		add_baseline_metric(result, name, "baseline_p", p);
+
+		if (!regressed && p < runner_state.baseline_alpha &&
+		    change > runner_state.baseline_threshold) {
+			snprintf(msg, msg_size,
+				 "Benchmark regressed: median %s went from "
+				 "%.3f to %.3f (%+.1f%%, p = %.2g)",
+				 name, old_median, new_median, change * 100, p);
+			regressed = true;
+		}
+	}
+
+	if (regressed) {
+		test->priv.state = _LI_UNIT_FAILED;
+		li_unit_result_set_failure_site(result, msg, strlen(msg));
+	}
+	return regressed;
+}
+
+/*
+ * Add the reason a test went over budget, or regressed, to the end of
+ * its output.
+ */
+static void append_budget_message(struct li_unit_test *test,
+				  const char *msg)
+{
+	if (li_unit_output_append(&test->priv.output, msg, strlen(msg)) < 0 ||
+	    li_unit_output_append(&test->priv.output, "\n", 1) < 0)
+		perror("failed to keep test output");
+}
+
+/*
+ * Give up the job slot and job token of a test which is done.
+ */
+static void release_job_slot(struct li_unit_test *test)
+{
+	runner_state.running_jobs--;
+	if (is_exclusive(test))
+		runner_state.exclusive_running = false;
+	li_unit_jobserver_release(&runner_state.jobserver);
+	runner_state.slots[test->priv.slot] = NULL;
+	runner_state.free_slots[runner_state.n_free_slots++] = test->priv.slot;
+}
 
-	while (test && test->priv.pid != pid)
-		test = test->rest;
+static int handle_waitpid(struct li_unit_test *test, int status,
+			  const struct rusage *rusage)
+{
+	char budget_msg[128];
+	char baseline_msg[192];
+	bool over_budget, regressed;
 
-	if (!test) {
-		fprintf(stderr, "No running test with pid %d found.\n", pid);
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+		perror("clock_gettime failed");
 		return -1;
 	}
 
 	if (!(test->priv.state == _LI_UNIT_RUNNING ||
-	      _LI_UNIT_PENDING_DEADLINE_EXCEEDED)) {
+	      test->priv.state == _LI_UNIT_PENDING_DEADLINE_EXCEEDED)) {
 		fprintf(stderr, "Invalid state transition: %s -> %s\n",
 			test_state_pretty_print[test->priv.state],
 			test_state_pretty_print[test->priv.state]);
 		return -1;
 	}
 
-	runner_state.running_jobs--;
+	/* Tests past their deadline were already removed */
+	if (test->priv.state == _LI_UNIT_RUNNING && test->priv.has_deadline)
+		li_unit_deadline_heap_remove(&runner_state.deadlines, test);
+
+	release_job_slot(test);
 	li_util_timespec_subtract(&now, &test->priv.start_time,
 				  &test->priv.elapsed_time);
-	runner_state.completed_tests++;
+	test->priv.rusage = *rusage;
+	destroy_test_cgroup(test);
 
-	const char *reason;
+	/* Benchmark samples are needed to tell whether the test
+	   passed */
+	collect_results();
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		test->priv.state = _LI_UNIT_SUCCEEDED;
+	else if (test->priv.state == _LI_UNIT_PENDING_DEADLINE_EXCEEDED)
+		test->priv.state = _LI_UNIT_DEADLINE_EXCEEDED;
+	else
+		test->priv.state = _LI_UNIT_FAILED;
+
+	over_budget = check_budgets(test, budget_msg, sizeof(budget_msg));
+	regressed = compare_with_baseline(test, baseline_msg,
+					  sizeof(baseline_msg));
+
+	report_test_result(test);
+
+	if (test->priv.output_file >= 0) {
+		if (collect_output_file(test) < 0)
+			return -1;
+	} else {
+		if (test_update_output_buffer(test, true) < 0)
+			return -1;
+
+		if (unregister_output_pipe(test) < 0)
+			return -1;
+
+		if (close(test->priv.output_pipe[0]) < 0) {
+			perror("close error");
+			return -1;
+		}
+	}
+
+	if (test->priv.memory_peak_kb)
+		li_unit_result_add_metric(&test->priv.result, "memory_peak_kb",
+					  strlen("memory_peak_kb"),
+					  test->priv.memory_peak_kb, false);
+
+	if (over_budget)
+		append_budget_message(test, budget_msg);
+	if (regressed)
+		append_budget_message(test, baseline_msg);
+
+	finish_test_output(test);
+
+	if (test->priv.pidfd >= 0 && close(test->priv.pidfd) < 0) {
+		perror("close error");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void finish_thread_test(struct li_unit_test *test)
+{
+	struct thread_job *job = &runner_state.thread_jobs[test->priv.slot];
+	char budget_msg[128];
+	char baseline_msg[192];
+	bool over_budget, regressed;
+
+	pthread_join(job->thread, NULL);
+	release_job_slot(test);
+
+	test->priv.state = job->succeeded ? _LI_UNIT_SUCCEEDED :
+					    _LI_UNIT_FAILED;
+	over_budget = check_budgets(test, budget_msg, sizeof(budget_msg));
+	regressed = compare_with_baseline(test, baseline_msg,
+					  sizeof(baseline_msg));
+
+	report_test_result(test);
+
+	if (li_unit_output_append(&test->priv.output, job->output,
+				  job->output_size) < 0)
+		perror("failed to keep test output");
+	if (over_budget)
+		append_budget_message(test, budget_msg);
+	if (regressed)
+		append_budget_message(test, baseline_msg);
+
+	finish_test_output(test);
+
+	free(job->output);
+	memset(job, 0, sizeof(*job));
+}
+
+/*
+ * Finish the tests whose threads wrote their slot to the thread pipe.
+ */
+static int handle_thread_done(void)
+{
+	unsigned int slot;
+	ssize_t read_rv;
+
+	while ((read_rv = read(runner_state.thread_pipe[0], &slot,
+			       sizeof(slot))) == sizeof(slot))
+		finish_thread_test(runner_state.slots[slot]);
+
+	if (read_rv < 0 && errno != EAGAIN && errno != EINTR) {
+		perror("read failed");
+		return -1;
+	}
+	return 0;
+}
+
+static int reap_test(struct li_unit_test *test)
+{
+	int status;
+	struct rusage rusage;
+	pid_t pid = wait4(test->priv.pid, &status, WNOHANG, &rusage);
+
+	if (pid < 0) {
+		perror("wait4 failed");
+		return -1;
+	}
+
+	/* Not exited yet */
+	if (pid == 0)
+		return 0;
+
+	return handle_waitpid(test, status, &rusage);
+}
+
+/*
+ * Used only on the signalfd path, where waitpid(-1, ...) tells us the
+ * pid but not the test. The search is bounded by the parallelism, not
+ * by the number of tests.
+ */
+static struct li_unit_test *find_running_test(pid_t pid,
+					      unsigned int parallelism)
+{
+	for (unsigned int i = 0; i < parallelism; i++) {
+		struct li_unit_test *test = runner_state.slots[i];
 
-	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-		test->priv.state = _LI_UNIT_SUCCEEDED;
-		reason = "succeeded";
-	} else if (test->priv.state == _LI_UNIT_PENDING_DEADLINE_EXCEEDED) {
-		test->priv.state = _LI_UNIT_DEADLINE_EXCEEDED;
-		reason = "timed out";
-	} else {
-		test->priv.state = _LI_UNIT_FAILED;
-		reason = "failed";
+		if (test && test->priv.pid == pid)
+			return test;
 	}
+	return NULL;
+}
 
-	fprintf(stderr, "[%3u/%u] %s %s! (%lld.%03lds)\n",
-		runner_state.completed_tests, runner_state.total_tests,
-		test->name, reason, (long long)test->priv.elapsed_time.tv_sec,
-		test->priv.elapsed_time.tv_nsec / NSEC_PER_MSEC);
+static int handle_sigchld(unsigned int parallelism)
+{
+	struct signalfd_siginfo info;
+	struct rusage rusage;
+	int status;
+	pid_t pid;
 
-	if (test_update_output_buffer(test, true) < 0)
-		return -1;
+	/* Signals coalesce, so drain the signalfd and reap everything
+	   which has exited */
+	while (read(runner_state.signal_fd, &info, sizeof(info)) > 0)
+		;
 
-	if (close(test->priv.output_pipe[0]) < 0) {
-		perror("close error");
-		return -1;
+	while ((pid = wait4(-1, &status, WNOHANG, &rusage)) > 0) {
+		struct li_unit_test *test = find_running_test(pid, parallelism);
+
+		/* With the zygote, we are a child subreaper, and may
+		   inherit orphaned descendants of tests */
+		if (!test)
+			continue;
+
+		if (handle_waitpid(test, status, &rusage) < 0)
+			return -1;
 	}
 
-	if (runner_state.first_unfinished_test == test) {
-		/* We have finished, and are the furthest back
-		   unfinished test, so move this pointer along to its
-		   new home */
-		while (runner_state.first_unfinished_test &&
-		       runner_state.first_unfinished_test->priv.state >=
-			       _LI_UNIT_SUCCEEDED)
-			runner_state.first_unfinished_test =
-				runner_state.first_unfinished_test->rest;
+	if (pid < 0 && errno != ECHILD) {
+		perror("wait4 failed");
+		return -1;
 	}
 
 	return 0;
@@ -242,12 +1208,13 @@ static int handle_deadline(struct li_unit_test *test)
 	return 0;
 }
 
-static int handle_status_update(struct li_unit_test *test_list,
-				unsigned int status_update_frequency)
+static int handle_status_update(unsigned int status_update_frequency)
 {
 	fprintf(stderr, "\nPending tasks:\n");
 
-	for (struct li_unit_test *t = test_list; t; t = t->rest) {
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *t = runner_state.tests[i];
+
 		if (t->priv.state < _LI_UNIT_SUCCEEDED)
 			fprintf(stderr, "  %s (%s)\n", t->name,
 				test_state_pretty_print[t->priv.state]);
@@ -264,46 +1231,100 @@ static int handle_status_update(struct li_unit_test *test_list,
 	return 0;
 }
 
+/*
+ * Convert a relative timeout to milliseconds for epoll_wait(),
+ * rounding up so that we never wake up before a deadline.
+ */
+static int timespec_to_epoll_timeout(const struct timespec *timeout)
+{
+	if (timeout->tv_sec < 0)
+		return 0;
+
+	if (timeout->tv_sec >= INT_MAX / MSEC_PER_SEC)
+		return INT_MAX;
+
+	return timeout->tv_sec * MSEC_PER_SEC +
+	       (timeout->tv_nsec + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+static int handle_event(struct epoll_event *event, unsigned int parallelism)
+{
+	enum event_kind kind = event->data.u64 & EVENT_KIND_MASK;
+	unsigned int slot = event->data.u64 >> EVENT_KIND_BITS;
+	struct li_unit_test *test;
+	int rv;
+
+	if (kind == EVENT_SIGCHLD) {
+		if (handle_sigchld(parallelism) < 0) {
+			fprintf(stderr, "handle_sigchld failed!\n");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (kind == EVENT_JOBSERVER)
+		return handle_jobserver_readable();
+
+	if (kind == EVENT_THREAD_DONE)
+		return handle_thread_done();
+
+	/* An earlier event in the same batch may have reaped this test
+	   and freed its slot */
+	test = runner_state.slots[slot];
+	if (!test)
+		return 0;
+
+	switch (kind) {
+	case EVENT_TEST_OUTPUT:
+		rv = test_update_output_buffer(test, false);
+		if (rv < 0)
+			return -1;
+
+		/* Stop polling a pipe which hit end-of-file, otherwise
+		   it would be reported as ready until the test gets
+		   reaped */
+		if (rv > 0 && unregister_output_pipe(test) < 0)
+			return -1;
+		return 0;
+	case EVENT_TEST_EXIT:
+		if (reap_test(test) < 0) {
+			fprintf(stderr, "handle_waitpid failed!\n");
+			return -1;
+		}
+		return 0;
+	default:
+		return 0;
+	}
+}
+
 static enum {
 	TEST_RUNNER_ITERATE_AGAIN,
 	TEST_RUNNER_ITERATE_FAILURE,
 	TEST_RUNNER_ITERATE_SUCCESS,
 } test_runner_iterate(struct li_unit_runner_options *options)
 {
-	/* Used for a read from a pipe we don't care about the data */
-	char unused_buf[4096];
-	int status;
-	pid_t pid;
+	struct li_unit_test *next_test = next_queued_test();
 
-	if (!runner_state.running_jobs && !runner_state.remaining_tests)
+	if (!runner_state.running_jobs && !next_test)
 		return TEST_RUNNER_ITERATE_SUCCESS;
 
-	if (runner_state.running_jobs < options->parallelism &&
-	    runner_state.remaining_tests) {
-		if (spawn_test(options->default_timeout) < 0) {
-			fprintf(stderr, "spawn_test failed!\n");
-			return TEST_RUNNER_ITERATE_FAILURE;
-		}
-		return TEST_RUNNER_ITERATE_AGAIN;
-	}
-
-	if (read(runner_state.notify_pipe[0], unused_buf, sizeof(unused_buf)) >
-	    0) {
-		return TEST_RUNNER_ITERATE_AGAIN;
-	}
-
-	pid = waitpid(-1, &status, WNOHANG);
-	if (pid < 0) {
-		perror("waitpid failed");
-		return TEST_RUNNER_ITERATE_FAILURE;
-	}
+	/* A test which must run alone waits for the others to finish,
+	   and holds off the rest until it is done */
+	if (runner_state.running_jobs < options->parallelism && next_test &&
+	    !runner_state.exclusive_running &&
+	    (!is_exclusive(next_test) || !runner_state.running_jobs)) {
+		int rv = acquire_job_token();
 
-	if (pid > 0) {
-		if (handle_waitpid(pid, status) < 0) {
-			fprintf(stderr, "handle_waitpid failed!\n");
+		if (rv < 0)
 			return TEST_RUNNER_ITERATE_FAILURE;
+
+		if (rv > 0) {
+			if (spawn_test(options) < 0) {
+				fprintf(stderr, "spawn_test failed!\n");
+				return TEST_RUNNER_ITERATE_FAILURE;
+			}
+			return TEST_RUNNER_ITERATE_AGAIN;
 		}
-		return TEST_RUNNER_ITERATE_AGAIN;
 	}
 
 	struct timespec now;
@@ -312,11 +1333,8 @@ static enum {
 		return TEST_RUNNER_ITERATE_FAILURE;
 	}
 
-	if (now.tv_sec >= runner_state.status_update_deadline.tv_sec &&
-	    now.tv_nsec >= runner_state.status_update_deadline.tv_nsec) {
-		if (handle_status_update(options->test_list,
-					 options->status_update_frequency) <
-		    0) {
+	if (!li_util_timespec_lt(&now, &runner_state.status_update_deadline)) {
+		if (handle_status_update(options->status_update_frequency) < 0) {
 			fprintf(stderr, "failed to print status update!\n");
 			return TEST_RUNNER_ITERATE_FAILURE;
 		}
@@ -324,66 +1342,411 @@ static enum {
 	}
 
 	struct timespec *next_deadline = &runner_state.status_update_deadline;
-	for (struct li_unit_test *test = runner_state.first_unfinished_test;
-	     test != runner_state.remaining_tests; test = test->rest) {
-		if (test->priv.state == _LI_UNIT_RUNNING &&
-		    test->priv.has_deadline &&
-		    li_util_timespec_lt(&test->priv.deadline, &now)) {
-			handle_deadline(test);
-			return TEST_RUNNER_ITERATE_AGAIN;
-		} else if (test->priv.state == _LI_UNIT_RUNNING &&
-			   test->priv.has_deadline &&
-			   li_util_timespec_lt(&test->priv.deadline,
-					       next_deadline)) {
-			next_deadline = &test->priv.deadline;
+	struct li_unit_test *test;
+
+	while ((test = li_unit_deadline_heap_peek(&runner_state.deadlines))) {
+		if (li_util_timespec_lt(&now, &test->priv.deadline)) {
+			if (li_util_timespec_lt(&test->priv.deadline,
+						next_deadline))
+				next_deadline = &test->priv.deadline;
+			break;
 		}
+
+		li_unit_deadline_heap_remove(&runner_state.deadlines, test);
+		if (handle_deadline(test) < 0)
+			return TEST_RUNNER_ITERATE_FAILURE;
 	}
 
 	struct timespec timeout;
 	li_util_timespec_subtract(next_deadline, &now, &timeout);
 
-	fd_set rfds;
-	FD_ZERO(&rfds);
-	FD_SET(runner_state.notify_pipe[0], &rfds);
-
-	int maxfd = runner_state.notify_pipe[0];
-	for (struct li_unit_test *test = runner_state.first_unfinished_test;
-	     test != runner_state.remaining_tests; test = test->rest) {
-		if (test->priv.state == _LI_UNIT_RUNNING) {
-			int fd = test->priv.output_pipe[0];
-			FD_SET(fd, &rfds);
-			if (fd > maxfd)
-				maxfd = fd;
-		}
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	int nevents = epoll_wait(runner_state.epoll_fd, events,
+				 ARRAY_SIZE(events),
+				 timespec_to_epoll_timeout(&timeout));
+	if (nevents < 0) {
+		if (errno == EINTR)
+			return TEST_RUNNER_ITERATE_AGAIN;
+		perror("epoll_wait failed");
+		return TEST_RUNNER_ITERATE_FAILURE;
 	}
 
-	if (pselect(maxfd + 1, &rfds, NULL, NULL, &timeout, NULL) < 0 &&
-	    errno != EINTR) {
-		perror("pselect failed");
-		return TEST_RUNNER_ITERATE_FAILURE;
+	for (int i = 0; i < nevents; i++) {
+		if (handle_event(&events[i], options->parallelism) < 0)
+			return TEST_RUNNER_ITERATE_FAILURE;
+	}
+
+	return TEST_RUNNER_ITERATE_AGAIN;
+}
+
+/*
+ * Children are reaped through a pidfd per child, which becomes
+ * readable when the child exits and maps straight back to its job
+ * slot. Kernels without pidfd_open (before 5.3) fall back to
+ * blocking SIGCHLD and reading it from a signalfd.
+ */
+static int setup_child_reaping(void)
+{
+	int fd = pidfd_open(getpid(), 0);
+
+	if (fd >= 0) {
+		close(fd);
+		runner_state.use_signalfd = false;
+		return 0;
+	}
+
+	if (errno != ENOSYS) {
+		perror("pidfd_open failed");
+		return -1;
+	}
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	if (sigprocmask(SIG_BLOCK, &mask, &runner_state.saved_sigmask) < 0) {
+		perror("sigprocmask failed");
+		return -1;
+	}
+	runner_state.use_signalfd = true;
+
+	runner_state.signal_fd =
+		signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (runner_state.signal_fd < 0) {
+		perror("signalfd failed");
+		return -1;
+	}
+
+	return epoll_add(runner_state.signal_fd, EVENT_SIGCHLD, 0);
+}
+
+static void teardown_child_reaping(void)
+{
+	if (!runner_state.use_signalfd)
+		return;
+
+	if (runner_state.signal_fd >= 0)
+		close(runner_state.signal_fd);
+	sigprocmask(SIG_SETMASK, &runner_state.saved_sigmask, NULL);
+}
+
+/*
+ * Tests which must run alone go at the end of the queue (keeping their
+ * order), so that the run only has to wait for other tests to drain
+ * once.
+ */
+static int move_exclusive_tests_last(void)
+{
+	struct li_unit_test **exclusive;
+	size_t n_shared = 0;
+	size_t n_exclusive = 0;
+
+	if (!runner_state.n_tests)
+		return 0;
+
+	exclusive = calloc(runner_state.n_tests, sizeof(*exclusive));
+	if (!exclusive) {
+		perror("calloc failed");
+		return -1;
+	}
+
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *test = runner_state.queue[i];
+
+		if (is_exclusive(test))
+			exclusive[n_exclusive++] = test;
+		else
+			runner_state.queue[n_shared++] = test;
+	}
+
+	memcpy(runner_state.queue + n_shared, exclusive,
+	       n_exclusive * sizeof(*exclusive));
+	free(exclusive);
+	return 0;
+}
+
+/*
+ * Collect the tests to run into an array, and decide the order to
+ * start them in.
+ */
+static int build_test_queue(struct li_unit_runner_options *options,
+			    const struct li_unit_history *history)
+{
+	for (struct li_unit_test *test = options->test_list; test;
+	     test = test->rest) {
+		runner_state.n_tests++;
+	}
+
+	/* Allocated for every test, but filled with only those the
+	   filter selects */
+	runner_state.tests =
+		calloc(runner_state.n_tests, sizeof(*runner_state.tests));
+	runner_state.queue =
+		calloc(runner_state.n_tests, sizeof(*runner_state.queue));
+	if (runner_state.n_tests &&
+	    (!runner_state.tests || !runner_state.queue)) {
+		perror("calloc failed");
+		return -1;
+	}
+
+	size_t i = 0;
+	for (struct li_unit_test *test = options->test_list; test;
+	     test = test->rest) {
+		if (!options->filter.func ||
+		    options->filter.func(test, options->filter.data))
+			runner_state.tests[i++] = test;
 	}
+	runner_state.n_tests = i;
 
-	for (struct li_unit_test *test = runner_state.first_unfinished_test;
-	     test != runner_state.remaining_tests; test = test->rest) {
-		if (FD_ISSET(test->priv.output_pipe[0], &rfds) &&
-		    test_update_output_buffer(test, false) < 0)
+	if (options->total_shards > 1) {
+		ssize_t n_selected = li_unit_schedule_shard(
+			runner_state.tests, runner_state.n_tests, history,
+			options->shard_index, options->total_shards);
+
+		if (n_selected < 0)
 			return -1;
+		runner_state.n_tests = n_selected;
 	}
 
-	return TEST_RUNNER_ITERATE_AGAIN;
+	/* Tests tag what they report with their index */
+	for (i = 0; i < runner_state.n_tests; i++)
+		runner_state.tests[i]->priv.job = i;
+
+	memcpy(runner_state.queue, runner_state.tests,
+	       runner_state.n_tests * sizeof(*runner_state.queue));
+	runner_state.n_queued = runner_state.n_tests;
+
+	if (options->history_file)
+		li_unit_schedule_longest_first(runner_state.queue,
+					       runner_state.n_tests, history);
+
+	return move_exclusive_tests_last();
+}
+
+static void save_history(struct li_unit_runner_options *options,
+			 struct li_unit_history *history)
+{
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *test = runner_state.tests[i];
+		struct timespec *elapsed = &test->priv.elapsed_time;
+
+		if (test->priv.state < _LI_UNIT_SUCCEEDED)
+			continue;
+
+		if (li_unit_history_record(history, test->name,
+					   elapsed->tv_sec * NSEC_PER_SEC +
+						   elapsed->tv_nsec) < 0)
+			return;
+	}
+
+	if (li_unit_history_save(history, options->history_file) < 0)
+		fprintf(stderr, "Failed to save test history to %s.\n",
+			options->history_file);
+}
+
+/*
+ * Benchmarks are run to be measured, and fuzz targets depend on the
+ * inputs saved for them, so neither is cached.
+ */
+static bool cacheable(const struct li_unit_test *test)
+{
+	return !test->bench && !test->fuzz && !test->uncacheable;
+}
+
+/*
+ * The key a test is cached under: a hash of the binary it runs in,
+ * and everything else which decides whether it passes. For tests in
+ * this process, the binary includes every shared object loaded. For
+ * tests in another executable, only the executable itself is hashed.
+ * Returns false if the binary could not be read.
+ */
+static bool test_cache_key(const struct li_unit_runner_options *options,
+			   const struct li_unit_test *test, uint64_t *key)
+{
+	const char *binary = test->argv ? test->argv[0] : "/proc/self/exe";
+	const struct li_unit_test_options *o = &test->options;
+	const uint64_t values[] = {
+		o->timeout_multiplier,	  o->timeout_ms,
+		o->isolation,		  o->max_rss_kb,
+		o->max_cpu_ms,		  o->max_instructions,
+		options->default_timeout, options->default_timeout_ms,
+		options->memory_limit_kb, options->fd_limit,
+		options->process_limit,
+	};
+	uint64_t hash;
+	int rv;
+
+	/* Tests from the same binary are listed together */
+	if (!runner_state.cache_binary ||
+	    strcmp(runner_state.cache_binary, binary)) {
+		uint64_t *binary_hash = &runner_state.cache_binary_hash;
+
+		runner_state.cache_binary = binary;
+		if (test->argv)
+			rv = li_unit_cache_hash_file(binary, binary_hash);
+		else
+			rv = li_unit_cache_hash_loaded_objects(binary_hash);
+		runner_state.cache_binary_hashed = rv == 0;
+	}
+	if (!runner_state.cache_binary_hashed)
+		return false;
+
+	hash = li_util_fnv1a_64(runner_state.cache_binary_hash, test->name,
+				strlen(test->name) + 1);
+	for (const char *const *arg = test->argv; arg && *arg; arg++)
+		hash = li_util_fnv1a_64(hash, *arg, strlen(*arg) + 1);
+	hash = li_util_fnv1a_64(hash, values, sizeof(values));
+	hash = li_util_fnv1a_64(hash, options->cgroup ?: "",
+				strlen(options->cgroup ?: "") + 1);
+
+	*key = hash;
+	return true;
+}
+
+/*
+ * Report the tests which passed before as cached, and take them out of
+ * the queue.
+ */
+static int use_cached_results(struct li_unit_runner_options *options)
+{
+	size_t n_queued = 0;
+
+	if (li_unit_cache_load(&runner_state.cache, options->cache_file) < 0)
+		return -1;
+
+	for (size_t i = 0; i < runner_state.n_queued; i++) {
+		struct li_unit_test *test = runner_state.queue[i];
+		uint64_t elapsed_ns;
+
+		test->priv.has_cache_key =
+			cacheable(test) &&
+			test_cache_key(options, test, &test->priv.cache_key);
+
+		if (options->no_cache || !test->priv.has_cache_key ||
+		    !li_unit_cache_lookup(&runner_state.cache,
+					  test->priv.cache_key, &elapsed_ns)) {
+			runner_state.queue[n_queued++] = test;
+			continue;
+		}
+
+		test->priv.cached = true;
+		test->priv.state = _LI_UNIT_SUCCEEDED;
+		test->priv.elapsed_time.tv_sec = elapsed_ns / NSEC_PER_SEC;
+		test->priv.elapsed_time.tv_nsec = elapsed_ns % NSEC_PER_SEC;
+		report_test_result(test);
+		finish_test_output(test);
+	}
+
+	if (n_queued < runner_state.n_queued)
+		fprintf(stderr, "%zu tests passed before, and are cached.\n",
+			runner_state.n_queued - n_queued);
+	runner_state.n_queued = n_queued;
+	return 0;
 }
 
-static void sigchld_handler(int sig)
+static void save_cache(struct li_unit_runner_options *options)
 {
-	/* Save the errno so we can restore it. */
-	int previous_errno = errno;
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *test = runner_state.tests[i];
+		struct timespec *elapsed = &test->priv.elapsed_time;
 
-	/* Write one byte to the notify pipe so that the pselect
-	   returns. Then, the waitpid will be picked up on the next
-	   iteration of the test runner. */
-	(void)write(runner_state.notify_pipe[1], "", 1);
+		if (!test->priv.has_cache_key || test->priv.cached ||
+		    test->priv.state != _LI_UNIT_SUCCEEDED)
+			continue;
+
+		if (li_unit_cache_record(&runner_state.cache,
+					 test->priv.cache_key,
+					 elapsed->tv_sec * NSEC_PER_SEC +
+						 elapsed->tv_nsec) < 0)
+			return;
+	}
+
+	if (li_unit_cache_save(&runner_state.cache, options->cache_file,
+			       options->cache_size ?: 10000) < 0)
+		fprintf(stderr, "Failed to save the test cache to %s.\n",
+			options->cache_file);
+}
+
+static void save_baseline(struct li_unit_runner_options *options)
+{
+	struct li_unit_baseline baseline = { 0 };
+
+	if (li_unit_baseline_load(&baseline, options->save_baseline) < 0)
+		goto exit;
+
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		const struct li_unit_result *result =
+			&runner_state.tests[i]->priv.result;
+
+		for (size_t j = 0; j < result->n_metrics; j++) {
+			const char *name = result->metrics[j].name;
+			double *samples;
+			size_t n_samples;
+			int recorded;
+
+			if (!first_sample_named(result, j))
+				continue;
+
+			samples = collect_samples(result, name, &n_samples);
+			if (!samples)
+				goto exit;
+			recorded = li_unit_baseline_record(
+				&baseline, runner_state.tests[i]->name, name,
+				samples, n_samples);
+			free(samples);
+			if (recorded < 0)
+				goto exit;
+		}
+	}
+
+	if (li_unit_baseline_save(&baseline, options->save_baseline) < 0)
+		fprintf(stderr, "Failed to save benchmark baseline to %s.\n",
+			options->save_baseline);
+
+exit:
+	li_unit_baseline_free(&baseline);
+}
+
+/*
+ * The full statistics are in the metrics of each benchmark, for
+ * reports.
+ */
+static void print_benchmark_results(void)
+{
+	bool printed_header = false;
+
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *test = runner_state.tests[i];
+		const struct li_unit_metric *ns_per_op =
+			find_metric(&test->priv.result, "ns_per_op");
+		const struct li_unit_metric *stddev =
+			find_metric(&test->priv.result, "ns_per_op_stddev");
+		const struct li_unit_metric *change = find_metric(
+			&test->priv.result, "ns_per_op_baseline_change");
+		const struct li_unit_metric *instructions = find_metric(
+			&test->priv.result, "instructions_per_op");
+
+		if (!ns_per_op)
+			continue;
 
-	errno = previous_errno;
+		if (!printed_header)
+			fprintf(stderr, "Benchmarks:\n");
+		printed_header = true;
+
+		fprintf(stderr, "  %s: %.3f ns/op", test->name,
+			ns_per_op->value);
+		if (stddev)
+			fprintf(stderr, " (stddev %.3f)", stddev->value);
+		if (instructions)
+			fprintf(stderr, ", %.1f instructions/op",
+				instructions->value);
+		if (change)
+			fprintf(stderr, ", %+.1f%% vs baseline",
+				change->value * 100);
+		if (test->priv.state != _LI_UNIT_SUCCEEDED)
+			fprintf(stderr, ", FAILED");
+		fprintf(stderr, "\n");
+	}
 }
 
 static void print_failure_output(struct li_unit_test *test)
@@ -412,11 +1775,46 @@ static void print_failure_output(struct li_unit_test *test)
 			top_output[i] = '=';
 	}
 	fprintf(stderr, "%s\n", top_output);
-	fwrite(test->priv.output.buf, sizeof(char), test->priv.output.buf_usage,
-	       stderr);
+	li_unit_output_print(&test->priv.output, stderr);
 	fprintf(stderr, "%s\n\n", bottom_output);
 }
 
+static int open_reporters(struct li_unit_runner_options *options)
+{
+	const struct {
+		const char *path;
+		const struct li_unit_reporter_ops *ops;
+	} reports[] = {
+		{ options->report_jsonl, &li_unit_jsonl_reporter },
+		{ options->report_junit, &li_unit_junit_reporter },
+		{ options->report_tap, &li_unit_tap_reporter },
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(reports); i++) {
+		struct li_unit_reporter *reporter =
+			&runner_state.reporters[runner_state.n_reporters];
+
+		if (!reports[i].path)
+			continue;
+
+		if (li_unit_reporter_open(reporter, reports[i].ops,
+					  reports[i].path,
+					  runner_state.n_tests) < 0)
+			return -1;
+		runner_state.n_reporters++;
+	}
+	return 0;
+}
+
+static void close_reporters(void)
+{
+	for (unsigned int i = 0; i < runner_state.n_reporters; i++) {
+		if (li_unit_reporter_close(&runner_state.reporters[i]) < 0)
+			fprintf(stderr, "Failed to write a test report.\n");
+	}
+	runner_state.n_reporters = 0;
+}
+
 int li_unit_run_tests(struct li_unit_runner_options *options)
 {
 	if (!options->default_timeout)
@@ -425,62 +1823,194 @@ int li_unit_run_tests(struct li_unit_runner_options *options)
 		options->parallelism = get_nprocs();
 	if (!options->status_update_frequency)
 		options->status_update_frequency = 15;
-	if (!options->test_list)
-		options->test_list = li_unit_test_list;
+	if (!options->test_list) {
+		size_t n_registered;
+		struct li_unit_test *const *registered =
+			li_unit_registered_tests(&n_registered);
+
+		options->test_list = n_registered ? registered[0] : NULL;
+	}
 
 	unsigned int failures = 0;
 	unsigned int informational_failures = 0;
+	uint64_t successful_assertions = 0;
+	uint64_t failed_assertions = 0;
+	uint64_t total_cpu_ns = 0;
+	struct li_unit_test *max_rss_test = NULL;
+	struct li_unit_test *max_cpu_test = NULL;
+	struct li_unit_history history = { 0 };
 
 	memset(&runner_state, 0, sizeof(runner_state));
-
 	runner_state.running_jobs = 0;
-	runner_state.first_unfinished_test = options->test_list;
-	runner_state.remaining_tests = options->test_list;
+	runner_state.epoll_fd = -1;
+	runner_state.signal_fd = -1;
+	runner_state.result_fd = -1;
+	runner_state.cgroup_fd = -1;
+	runner_state.thread_pipe[0] = -1;
+	runner_state.thread_pipe[1] = -1;
 
-	for (struct li_unit_test *test = options->test_list; test;
-	     test = test->rest) {
-		runner_state.total_tests++;
+	int rv = -1;
+
+	/* Before opening anything else, so that a stale jobserver in
+	   MAKEFLAGS cannot name one of our own file descriptors */
+	if (li_unit_jobserver_connect(&runner_state.jobserver,
+				      getenv("MAKEFLAGS"),
+				      options->parallelism) < 0)
+		goto exit;
+
+	/* Fuzz targets find their inputs through the environment, which
+	   the zygote and tests inherit */
+	if (options->fuzz_dir &&
+	    setenv(LI_UNIT_FUZZ_DIR_ENV, options->fuzz_dir, 1) < 0) {
+		perror("setenv failed");
+		goto exit;
 	}
 
-	fprintf(stderr, "Running %u tests with a parallelism of %u.\n",
-		runner_state.total_tests, options->parallelism);
+	if (raise_fd_limit(options) < 0)
+		goto exit;
 
-	if (pipe(runner_state.notify_pipe) < 0) {
-		perror("pipe failed");
-		return -1;
+	/* RLIMIT_NPROC would count every process of the user, not just
+	   those of the test */
+	if (options->process_limit && !options->cgroup) {
+		fprintf(stderr, "A process limit needs a cgroup to enforce "
+			"it (see --cgroup).\n");
+		goto exit;
 	}
 
-	for (int i = 0; i < ARRAY_SIZE(runner_state.notify_pipe); i++) {
-		int flags = fcntl(runner_state.notify_pipe[i], F_GETFL);
-		if (flags < 0) {
-			perror("fcntl failed");
-			return -1;
-		}
-		if (fcntl(runner_state.notify_pipe[i], F_SETFL,
-			  flags | O_NONBLOCK) < 0) {
-			perror("fcntl failed");
-			return -1;
-		}
+	runner_state.limits.memory_kb = options->memory_limit_kb;
+	runner_state.limits.open_files = options->fd_limit;
+	runner_state.limits.processes = options->process_limit;
+	runner_state.perf_counters = options->perf_counters;
+
+	/* This may move the runner into another cgroup, which the
+	   zygote should be in too */
+	if (options->cgroup) {
+		runner_state.cgroup_fd = li_unit_cgroup_setup(options->cgroup);
+		if (runner_state.cgroup_fd < 0)
+			goto exit;
+	}
+
+	/* Start the zygote before allocating anything, to keep it
+	   small. Tests with thread isolation run alongside test
+	   processes, which should not be forked from a process with
+	   threads (which may hold locks the child then waits on
+	   forever), so they need the zygote. */
+	if (options->use_zygote) {
+		if (li_unit_zygote_start() < 0)
+			goto exit;
+	} else if (has_thread_tests(options) && li_unit_zygote_start() < 0) {
+		fprintf(stderr, "Running tests with thread isolation as "
+			"processes instead.\n");
+		runner_state.threads_unavailable = true;
+	}
+
+	if (options->total_shards &&
+	    options->shard_index >= options->total_shards) {
+		fprintf(stderr,
+			"Shard index %u is out of range for %u shards.\n",
+			options->shard_index, options->total_shards);
+		goto exit;
+	}
+
+	if (options->history_file &&
+	    li_unit_history_load(&history, options->history_file) < 0)
+		goto exit;
+
+	if (build_test_queue(options, &history) < 0)
+		goto exit;
+
+	if (options->fuzz) {
+		rv = li_unit_fuzz(options, runner_state.tests,
+				  runner_state.n_tests);
+		goto exit;
+	}
+
+	if (options->compare_baseline) {
+		if (li_unit_baseline_load(&runner_state.baseline,
+					  options->compare_baseline) < 0)
+			goto exit;
+		runner_state.compare_baseline = true;
+		runner_state.baseline_alpha = options->baseline_alpha ?: 0.01;
+		runner_state.baseline_threshold =
+			options->baseline_threshold ?: 0.05;
+	}
+
+	li_unit_output_configure(options->output_limit, options->output_budget);
+
+	if (open_reporters(options) < 0)
+		goto exit;
+
+	if (options->cache_file && use_cached_results(options) < 0)
+		goto exit;
+
+	if (options->total_shards > 1)
+		fprintf(stderr, "Running %zu tests (shard %u of %u) with a "
+			"parallelism of %u.\n",
+			runner_state.n_queued, options->shard_index,
+			options->total_shards, options->parallelism);
+	else
+		fprintf(stderr, "Running %zu tests with a parallelism of %u.\n",
+			runner_state.n_queued, options->parallelism);
+
+	runner_state.slots =
+		calloc(options->parallelism, sizeof(*runner_state.slots));
+	runner_state.free_slots =
+		calloc(options->parallelism, sizeof(*runner_state.free_slots));
+	runner_state.thread_jobs = calloc(options->parallelism,
+					  sizeof(*runner_state.thread_jobs));
+	if (!runner_state.slots || !runner_state.free_slots ||
+	    !runner_state.thread_jobs) {
+		perror("calloc failed");
+		goto exit;
+	}
+
+	if (li_unit_deadline_heap_init(&runner_state.deadlines,
+				       options->parallelism) < 0)
+		goto exit;
+
+	/* Hand out the lowest numbered slots first */
+	for (unsigned int i = 0; i < options->parallelism; i++)
+		runner_state.free_slots[i] = options->parallelism - i - 1;
+	runner_state.n_free_slots = options->parallelism;
+
+	runner_state.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (runner_state.epoll_fd < 0) {
+		perror("epoll_create1 failed");
+		goto exit;
+	}
+
+	if (setup_child_reaping() < 0)
+		goto exit;
+
+	if (pipe2(runner_state.thread_pipe, O_CLOEXEC) < 0) {
+		perror("pipe2 failed");
+		goto exit;
+	}
+	if (fcntl(runner_state.thread_pipe[0], F_SETFL, O_NONBLOCK) < 0) {
+		perror("fcntl failed");
+		goto exit;
 	}
+	if (epoll_add(runner_state.thread_pipe[0], EVENT_THREAD_DONE, 0) < 0)
+		goto exit;
+
+	/* Tests run without a result channel if this fails */
+	runner_state.result_fd = open_capture_file("li_unit_result");
+	if (runner_state.result_fd >= 0 &&
+	    fcntl(runner_state.result_fd, F_SETFL, O_APPEND) < 0) {
+		close(runner_state.result_fd);
+		runner_state.result_fd = -1;
+	}
+	if (runner_state.result_fd < 0)
+		perror("Failed to create a result channel");
 
 	if (clock_gettime(CLOCK_MONOTONIC,
 			  &runner_state.status_update_deadline) < 0) {
 		perror("clock_gettime failed");
-		return -1;
+		goto exit;
 	}
 	runner_state.status_update_deadline.tv_sec +=
 		options->status_update_frequency;
 
-	struct sigaction sa;
-	sa.sa_handler = sigchld_handler;
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-	if (sigaction(SIGCHLD, &sa, 0) < 0) {
-		perror("setting up SIGCHLD handler failed");
-		return -1;
-	}
-
-	int rv = -1;
 	for (;;) {
 		switch (test_runner_iterate(options)) {
 		case TEST_RUNNER_ITERATE_AGAIN:
@@ -495,8 +2025,25 @@ int li_unit_run_tests(struct li_unit_runner_options *options)
 exit_success:
 	fprintf(stderr, "\n");
 
-	for (struct li_unit_test *test = options->test_list; test;
-	     test = test->rest) {
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		struct li_unit_test *test = runner_state.tests[i];
+
+		struct li_unit_result *result = &test->priv.result;
+
+		successful_assertions += result->successful_assertions;
+		failed_assertions += result->failed_assertions;
+
+		const struct rusage *rusage = &test->priv.rusage;
+
+		total_cpu_ns += rusage_cpu_ns(rusage);
+		if (!max_rss_test ||
+		    rusage->ru_maxrss > max_rss_test->priv.rusage.ru_maxrss)
+			max_rss_test = test;
+		if (!max_cpu_test ||
+		    rusage_cpu_ns(rusage) >
+			    rusage_cpu_ns(&max_cpu_test->priv.rusage))
+			max_cpu_test = test;
+
 		if (test->priv.state != _LI_UNIT_SUCCEEDED) {
 			if (test->options.informational)
 				informational_failures++;
@@ -507,6 +2054,27 @@ exit_success:
 		}
 	}
 
+	fprintf(stderr, "%llu successful assertions, %llu failed assertions.\n",
+		(unsigned long long)successful_assertions,
+		(unsigned long long)failed_assertions);
+
+	if (max_rss_test) {
+		uint64_t max_cpu_ns = rusage_cpu_ns(&max_cpu_test->priv.rusage);
+
+		fprintf(stderr, "%llu.%03llus of CPU time used by tests.\n",
+			(unsigned long long)(total_cpu_ns / NSEC_PER_SEC),
+			(unsigned long long)(total_cpu_ns % NSEC_PER_SEC /
+					     NSEC_PER_MSEC));
+		fprintf(stderr, "Most CPU time: %s (%llu ms).\n",
+			max_cpu_test->name,
+			(unsigned long long)(max_cpu_ns / NSEC_PER_MSEC));
+		fprintf(stderr, "Largest max RSS: %s (%ld KiB).\n",
+			max_rss_test->name,
+			max_rss_test->priv.rusage.ru_maxrss);
+	}
+
+	print_benchmark_results();
+
 	if (informational_failures == 0 && failures == 0)
 		fprintf(stderr, "All tests passed!\n");
 	else if (informational_failures != 0 && failures == 0)
@@ -515,12 +2083,44 @@ exit_success:
 	else
 		fprintf(stderr, "You have failing tests!\n");
 
+	if (options->history_file)
+		save_history(options, &history);
+	if (options->save_baseline)
+		save_baseline(options);
+	if (options->cache_file)
+		save_cache(options);
+
 	rv = failures > 0;
 
 exit:
-	for (struct li_unit_test *test = options->test_list; test;
-	     test = test->rest) {
-		free(test->priv.output.buf);
+	join_thread_tests(options->parallelism);
+	for (size_t i = 0; i < runner_state.n_tests; i++) {
+		li_unit_output_discard(&runner_state.tests[i]->priv.output);
+		li_unit_result_free(&runner_state.tests[i]->priv.result);
+	}
+	close_reporters();
+	free(runner_state.tests);
+	free(runner_state.queue);
+	li_unit_history_free(&history);
+	li_unit_baseline_free(&runner_state.baseline);
+	li_unit_cache_free(&runner_state.cache);
+	li_unit_output_teardown();
+	li_unit_zygote_stop();
+	li_unit_jobserver_disconnect(&runner_state.jobserver);
+	teardown_child_reaping();
+	if (runner_state.epoll_fd >= 0)
+		close(runner_state.epoll_fd);
+	if (runner_state.result_fd >= 0)
+		close(runner_state.result_fd);
+	for (int i = 0; i < 2; i++) {
+		if (runner_state.thread_pipe[i] >= 0)
+			close(runner_state.thread_pipe[i]);
 	}
+	free(runner_state.slots);
+	free(runner_state.free_slots);
+	free(runner_state.thread_jobs);
+	li_unit_deadline_heap_free(&runner_state.deadlines);
+	if (runner_state.cgroup_fd >= 0)
+		close(runner_state.cgroup_fd);
 	return rv;
 }
@@ -0,0 +1,301 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "cmdline.h"
+#include "macrolib.h"
+#include "runner_cmdline.h"
+#include "unit.h"
+
+size_t li_unit_runner_cmdline_options(struct li_cmdline_option *opts,
+				      struct li_unit_runner_options *options,
+				      const char **filterexpr)
+{
+	const struct li_cmdline_option shared_opts[] = {
+		{
+			.shortopt = 't',
+			.longopt = "timeout",
+			.help = "Integer value in seconds for default "
+			"timeout. -1 for no timeouts.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%d",
+				.dest = &options->default_timeout,
+			},
+		},
+		{
+			.longopt = "timeout-ms",
+			.help = "Default timeout in milliseconds, instead of "
+			"--timeout.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%ld",
+				.dest = &options->default_timeout_ms,
+			},
+		},
+		{
+			.shortopt = 'j',
+			.longopt = "jobs",
+			.help = "Maximum number of tests to run in parallel.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->parallelism,
+			},
+		},
+		{
+			.shortopt = 'f',
+			.longopt = "filter",
+			.help = "An expression to filter which tests to run "
+			"(see below).",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = filterexpr,
+			},
+		},
+		{
+			.shortopt = 'u',
+			.longopt = "status",
+			.help = "How frequently to print status updates, in "
+			"seconds.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->status_update_frequency,
+			},
+		},
+		{
+			.longopt = "history",
+			.help = "A file to record test durations in. Tests "
+			"are started longest first based on previous runs.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->history_file,
+			},
+		},
+		{
+			.longopt = "cache",
+			.help = "A file to cache passing tests in. Tests which "
+			"passed before with the same binary and options are "
+			"skipped. The binary includes its shared libraries, "
+			"except for tests run from another executable.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->cache_file,
+			},
+		},
+		{
+			.longopt = "cache-size",
+			.help = "The most tests to keep in the cache, evicting "
+			"the least recently used (default 10000).",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%zu",
+				.dest = &options->cache_size,
+			},
+		},
+		{
+			.longopt = "no-cache",
+			.help = "Run every test, even if cached, but still "
+			"update the cache.",
+			.action = {
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &options->no_cache,
+			},
+		},
+		{
+			.longopt = "save-baseline",
+			.help = "A file to save benchmark samples in, to "
+			"compare later runs with.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->save_baseline,
+			},
+		},
+		{
+			.longopt = "compare-baseline",
+			.help = "A file of benchmark samples saved by an "
+			"earlier run. Benchmarks which are significantly "
+			"slower than before fail.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->compare_baseline,
+			},
+		},
+		{
+			.longopt = "baseline-alpha",
+			.help = "The significance level for a benchmark to "
+			"count as slower than its baseline (default 0.01).",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%lf",
+				.dest = &options->baseline_alpha,
+			},
+		},
+		{
+			.longopt = "baseline-threshold",
+			.help = "How much slower a benchmark's median may get "
+			"before it fails, as a fraction (default 0.05).",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%lf",
+				.dest = &options->baseline_threshold,
+			},
+		},
+		{
+			.longopt = "fuzz-dir",
+			.help = "The directory fuzz targets keep their corpus "
+			"and crashes in. Fuzz targets run as tests replay the "
+			"inputs saved there.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->fuzz_dir,
+			},
+		},
+		{
+			.longopt = "shard-index",
+			.help = "The index of the shard to run, starting "
+			"from 0.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->shard_index,
+			},
+		},
+		{
+			.longopt = "total-shards",
+			.help = "Split the tests into this many shards, "
+			"balanced by the durations in the history file.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->total_shards,
+			},
+		},
+		{
+			.longopt = "memfd-output",
+			.help = "Capture test output in memory files, which "
+			"are only read if the test fails.",
+			.action = {
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &options->capture_to_memfd,
+			},
+		},
+		{
+			.longopt = "output-limit",
+			.help = "The most bytes of output to keep from each "
+			"failing test, from its start and end.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%zu",
+				.dest = &options->output_limit,
+			},
+		},
+		{
+			.longopt = "output-budget",
+			.help = "The most bytes of output from failing tests "
+			"to keep in memory, before moving it to disk.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%zu",
+				.dest = &options->output_budget,
+			},
+		},
+		{
+			.longopt = "report-jsonl",
+			.help = "Write a JSON Lines report of results to this "
+			"file as tests complete.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->report_jsonl,
+			},
+		},
+		{
+			.longopt = "report-junit",
+			.help = "Write a JUnit XML report of results to this "
+			"file as tests complete.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->report_junit,
+			},
+		},
+		{
+			.longopt = "report-tap",
+			.help = "Write a TAP report of results to this file as "
+			"tests complete.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->report_tap,
+			},
+		},
+		{
+			.longopt = "memory-limit",
+			.help = "The most memory in KiB each test may use.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%zu",
+				.dest = &options->memory_limit_kb,
+			},
+		},
+		{
+			.longopt = "fd-limit",
+			.help = "The most file descriptors each test may have "
+			"open.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->fd_limit,
+			},
+		},
+		{
+			.longopt = "process-limit",
+			.help = "The most processes each test may have. "
+			"Needs --cgroup.",
+			.action = {
+				.type = LI_CMDLINE_SCANF,
+				.format = "%u",
+				.dest = &options->process_limit,
+			},
+		},
+		{
+			.longopt = "cgroup",
+			.help = "A delegated cgroup v2 directory to run each "
+			"test in a cgroup under, to enforce the limits on the "
+			"whole test.",
+			.action = {
+				.type = LI_CMDLINE_STRING,
+				.dest = &options->cgroup,
+			},
+		},
+		{
+			.longopt = "perf-counters",
+			.help = "Count instructions, cycles, cache misses and "
+			"branch misses in each test with hardware counters.",
+			.action = {
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &options->perf_counters,
+			},
+		},
+		{
+			.shortopt = 'z',
+			.longopt = "zygote",
+			.help = "Fork tests from a zygote process started "
+			"before the run, to keep spawning tests cheap.",
+			.action = {
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &options->use_zygote,
+			},
+		},
+	};
+
+	_Static_assert(sizeof(shared_opts) / sizeof(shared_opts[0]) ==
+			       LI_UNIT_RUNNER_N_CMDLINE_OPTIONS,
+		       "LI_UNIT_RUNNER_N_CMDLINE_OPTIONS is out of date");
+
+	memcpy(opts, shared_opts, sizeof(shared_opts));
+	return ARRAY_SIZE(shared_opts);
+}
@@ -0,0 +1,35 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_RUNNER_CMDLINE_H_
+#define LITHIUM_SRC_UNIT_RUNNER_CMDLINE_H_
+
+#include <stddef.h>
+
+#include "cmdline.h"
+#include "unit.h"
+
+/**
+ * The number of options written by
+ * :c:func:`li_unit_runner_cmdline_options`.
+ */
+#define LI_UNIT_RUNNER_N_CMDLINE_OPTIONS 28
+
+/**
+ * Write the command line options shared by the test runner and the
+ * meta-runner: those which set the fields of a
+ * :c:type:`li_unit_runner_options`, and the filter expression.
+ *
+ * :param opts: Where to write the options, with room for
+ *              :c:macro:`LI_UNIT_RUNNER_N_CMDLINE_OPTIONS` of them.
+ * :param options: The runner options to set.
+ * :param filterexpr: Set to the filter expression, if one is given.
+ * :return: The number of options written.
+ */
+size_t li_unit_runner_cmdline_options(struct li_cmdline_option *opts,
+				      struct li_unit_runner_options *options,
+				      const char **filterexpr);
+
+#endif /* LITHIUM_SRC_UNIT_RUNNER_CMDLINE_H_ */
@@ -3,33 +3,90 @@
  * found in the LICENSE file.
  */
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "cmdline.h"
+#include "filter.h"
+#include "fuzz.h"
+#include "runner_cmdline.h"
 #include "unit.h"
 
-static int run_single_test_by_name(const char *name)
+static int run_single_test_by_name(const char *name, const char *fuzz_dir)
 {
-	for (struct li_unit_test *test = li_unit_test_list; test;
-	     test = test->rest) {
-		if (!strcmp(test->name, name))
-			li_unit_run_test(test);
+	struct li_unit_test *test = li_unit_find_test(name);
+
+	if (fuzz_dir && setenv(LI_UNIT_FUZZ_DIR_ENV, fuzz_dir, 1) < 0) {
+		perror("setenv failed");
+		return 1;
 	}
 
+	if (test)
+		li_unit_run_test(test);
+
 	fprintf(stderr, "No test named %s!\n", name);
 	return 1;
 }
 
+/*
+ * The kind of a test, as listed for the meta-runner.
+ */
+static const char *test_kind(const struct li_unit_test *test)
+{
+	if (test->bench)
+		return "bench";
+	if (test->fuzz)
+		return "fuzz";
+	return "test";
+}
+
+/*
+ * With tsv, print the options which the meta-runner needs before each
+ * name, separated by tabs.
+ */
+static void print_test_list(struct li_unit_runner_options *options, bool tsv)
+{
+	size_t n_tests;
+	struct li_unit_test *const *tests = li_unit_registered_tests(&n_tests);
+
+	for (size_t i = 0; i < n_tests; i++) {
+		struct li_unit_test *test = tests[i];
+
+		if (options->filter.func &&
+		    !options->filter.func(test, options->filter.data))
+			continue;
+		if (tsv)
+			printf("%s\t%d\t%d\t%d\t%ld\t%d\t%ld\t%ld\t%" PRIu64
+			       "\t",
+			       test_kind(test), test->options.informational,
+			       test->options.disabled,
+			       test->options.timeout_multiplier,
+			       test->options.timeout_ms,
+			       test->options.exclusive,
+			       test->options.max_rss_kb,
+			       test->options.max_cpu_ms,
+			       test->options.max_instructions);
+		printf("%s\n", test->name);
+	}
+}
+
 int li_unit_run_tests_main(const char *const *argv)
 {
 	bool list_tests = false;
+	bool list_tests_tsv = false;
 	struct li_unit_runner_options options = { 0 };
+	struct li_unit_filter filter;
 	const char *filterexpr = NULL;
 	const char *single = NULL;
+	int rv;
 
-	struct li_cmdline_option cmdline_opts[] = {
+	/* The options of this runner, the shared ones, --help, and the
+	   terminator */
+	struct li_cmdline_option
+		cmdline_opts[5 + LI_UNIT_RUNNER_N_CMDLINE_OPTIONS + 2] = {
 		{
 			.longopt = "list-tests",
 			.help = "Lists tests to be run and exit.",
@@ -38,6 +95,15 @@ int li_unit_run_tests_main(const char *const *argv)
 				.dest = &list_tests,
 			},
 		},
+		{
+			.longopt = "list-tests-tsv",
+			.help = "Lists tests to be run and their options, in "
+			"the format read by the meta-runner, and exit.",
+			.action = {
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &list_tests_tsv,
+			},
+		},
 		{
 			.shortopt = 's',
 			.longopt = "single",
@@ -49,57 +115,39 @@ int li_unit_run_tests_main(const char *const *argv)
 			},
 		},
 		{
-			.shortopt = 't',
-			.longopt = "timeout",
-			.help = "Integer value in seconds for default "
-			"timeout. -1 for no timeouts.",
-			.action = {
-				.type = LI_CMDLINE_SCANF,
-				.format = "%d",
-				.dest = &options.default_timeout,
-			},
-		},
-		{
-			.shortopt = 'j',
-			.longopt = "jobs",
-			.help = "Maximum number of tests to run in parallel.",
+			.longopt = "fuzz",
+			.help = "Fuzz the selected fuzz targets instead of "
+			"running tests, saving inputs which crash. Needs "
+			"--fuzz-dir.",
 			.action = {
-				.type = LI_CMDLINE_SCANF,
-				.format = "%u",
-				.dest = &options.parallelism,
-			},
-		},
-		{
-			.shortopt = 'f',
-			.longopt = "filter",
-			.help = "An expression to filter which tests to run "
-			"(see below).",
-			.action = {
-				.type = LI_CMDLINE_STRING,
-				.dest = &filterexpr,
+				.type = LI_CMDLINE_STORE_TRUE,
+				.dest = &options.fuzz,
 			},
 		},
 		{
-			.shortopt = 'u',
-			.longopt = "status",
-			.help = "How frequently to print status updates, in "
-			"seconds.",
+			.longopt = "fuzz-seconds",
+			.help = "How long to fuzz each target for, or 0 "
+			"(the default) to fuzz until interrupted.",
 			.action = {
 				.type = LI_CMDLINE_SCANF,
 				.format = "%u",
-				.dest = &options.status_update_frequency,
+				.dest = &options.fuzz_seconds,
 			},
 		},
-		{
-			.shortopt = 'h',
-			.longopt = "help",
-			.action.type = LI_CMDLINE_HELP,
-		},
-		{ 0 },
+	};
+	size_t n_opts = 5;
+
+	n_opts += li_unit_runner_cmdline_options(&cmdline_opts[n_opts],
+						 &options, &filterexpr);
+	cmdline_opts[n_opts] = (struct li_cmdline_option){
+		.shortopt = 'h',
+		.longopt = "help",
+		.action.type = LI_CMDLINE_HELP,
 	};
 
 	struct li_cmdline spec = {
 		.title = "Lithium Test Runner",
+		.help = LI_UNIT_FILTER_HELP,
 		.options = cmdline_opts,
 	};
 
@@ -107,10 +155,29 @@ int li_unit_run_tests_main(const char *const *argv)
 	case LI_CMDLINE_EXIT_SUCCESS:
 		return 0;
 	case LI_CMDLINE_CONTINUE:
-		if (single)
-			return run_single_test_by_name(single);
-		return li_unit_run_tests(&options) != 0;
+		break;
 	default:
 		return 1;
 	}
+
+	if (single)
+		return run_single_test_by_name(single, options.fuzz_dir);
+
+	if (filterexpr) {
+		if (li_unit_filter_compile(&filter, filterexpr) < 0)
+			return 1;
+		options.filter.func = li_unit_filter_test;
+		options.filter.data = &filter;
+	}
+
+	if (list_tests || list_tests_tsv) {
+		print_test_list(&options, list_tests_tsv);
+		rv = 0;
+	} else {
+		rv = li_unit_run_tests(&options) != 0;
+	}
+
+	if (filterexpr)
+		li_unit_filter_free(&filter);
+	return rv;
 }
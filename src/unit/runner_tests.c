@@ -3,11 +3,23 @@
  * found in the LICENSE file.
  */
 
+#define _GNU_SOURCE
+
+#include <dirent.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "perf.h"
 #include "unit.h"
+#include "util/timespec.h"
 
 static void wait_2_seconds(void)
 {
@@ -65,3 +77,972 @@ DEFTEST("lithium.unit.runner.spam_output", {})
 		}
 	}
 }
+
+static void print_some_output(void)
+{
+	printf("Some output.\n");
+}
+
+DEFTEST("lithium.unit.runner.parallel_output", {})
+{
+	struct li_unit_test tests[64] = { 0 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+		tests[i].name = "should_succeed";
+		tests[i].func = print_some_output;
+		if (i + 1 < ARRAY_SIZE(tests))
+			tests[i].rest = &tests[i + 1];
+	}
+
+	struct li_unit_runner_options options = {
+		.parallelism = ARRAY_SIZE(tests),
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 0);
+}
+
+DEFTEST("lithium.unit.runner.timeout_ms", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_timeout",
+			.func = wait_2_seconds,
+			.options.timeout_ms = 200,
+		},
+		{
+			.name = "should_timeout_by_default",
+			.func = wait_2_seconds,
+		},
+		{
+			.name = "should_succeed",
+			.func = print_some_output,
+			.options.timeout_ms = 10000,
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.default_timeout_ms = 100,
+		.parallelism = 3,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_DEADLINE_EXCEEDED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_DEADLINE_EXCEEDED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+
+	/* Killed well before the sleep would have ended */
+	for (size_t i = 0; i < 2; i++)
+		EXPECT(tests[i].priv.elapsed_time.tv_sec == 0);
+}
+
+DEFTEST("lithium.unit.runner.zygote", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_fail",
+			.func = test_failure,
+		},
+		{
+			.name = "should_timeout",
+			.func = wait_2_seconds,
+		},
+		{
+			.name = "should_succeed",
+			.func = print_some_output,
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.default_timeout = 1,
+		.parallelism = 2,
+		.use_zygote = true,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_DEADLINE_EXCEEDED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+}
+
+static void test_assert_failure(void)
+{
+	ASSERT(false);
+	abort();
+}
+
+static void test_success(void)
+{
+	EXPECT(true);
+}
+
+DEFTEST("lithium.unit.runner.thread_isolation", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_fail",
+			.func = test_failure,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+		{
+			.name = "should_unwind",
+			.func = test_assert_failure,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+		{
+			.name = "should_succeed",
+			.func = test_success,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+		{
+			.name = "should_succeed_in_process",
+			.func = test_success,
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[3].priv.state == _LI_UNIT_SUCCEEDED);
+}
+
+static void sleep_half_a_second(void)
+{
+	usleep(500000);
+}
+
+DEFTEST("lithium.unit.runner.thread_overlap", {})
+{
+	struct li_unit_test tests[4] = {
+		{
+			.name = "should_run_alongside",
+			.func = sleep_half_a_second,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+	};
+
+	for (size_t i = 1; i < ARRAY_SIZE(tests); i++) {
+		tests[i].name = "should_not_wait_for_thread";
+		tests[i].func = test_success;
+	}
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 0);
+
+	/* The test processes start while the thread is still busy */
+	for (size_t i = 1; i < ARRAY_SIZE(tests); i++) {
+		struct timespec since_thread;
+
+		EXPECT(tests[i].priv.state == _LI_UNIT_SUCCEEDED);
+		li_util_timespec_subtract(&tests[i].priv.start_time,
+					  &tests[0].priv.start_time,
+					  &since_thread);
+		EXPECT(li_util_timespec_lt(&since_thread,
+					   &tests[0].priv.elapsed_time));
+	}
+}
+
+DEFTEST("lithium.unit.runner.exec", {})
+{
+	const char *const succeed_argv[] = { "/bin/sh", "-c", "exit 0", NULL };
+	const char *const fail_argv[] = { "/bin/sh", "-c", "exit 1", NULL };
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_succeed",
+			.argv = succeed_argv,
+		},
+		{
+			.name = "should_fail",
+			.argv = fail_argv,
+		},
+	};
+
+	tests[0].rest = &tests[1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+}
+
+static void print_output_and_fail(void)
+{
+	printf("Some output.\n");
+	EXPECT(false);
+}
+
+DEFTEST("lithium.unit.runner.memfd_output", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_succeed",
+			.func = print_some_output,
+		},
+		{
+			.name = "should_fail",
+			.func = print_output_and_fail,
+		},
+	};
+
+	tests[0].rest = &tests[1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.capture_to_memfd = true,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+}
+
+static void sleep_briefly(void)
+{
+	usleep(50000);
+}
+
+DEFTEST("lithium.unit.runner.fd_limit", {})
+{
+	/* The runner keeps 64 file descriptors for itself, and two
+	   for each running test */
+	struct rlimit rlim = { .rlim_cur = 256, .rlim_max = 256 };
+	struct li_unit_test tests[96] = { 0 };
+	struct li_unit_test extra_test = {
+		.name = "should_not_start",
+		.func = sleep_briefly,
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+		tests[i].name = "should_succeed";
+		tests[i].func = sleep_briefly;
+		if (i + 1 < ARRAY_SIZE(tests))
+			tests[i].rest = &tests[i + 1];
+	}
+
+	ASSERT(setrlimit(RLIMIT_NOFILE, &rlim) == 0);
+
+	struct li_unit_runner_options options = {
+		.parallelism = ARRAY_SIZE(tests),
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 0);
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++)
+		EXPECT(tests[i].priv.state == _LI_UNIT_SUCCEEDED);
+
+	/* One more job than fits fails before starting anything */
+	options.parallelism++;
+	options.test_list = &extra_test;
+	EXPECT(li_unit_run_tests(&options) == -1);
+	EXPECT(extra_test.priv.state == _LI_UNIT_NOT_STARTED);
+}
+
+static void report_metric_and_fail(void)
+{
+	li_unit_report_metric("answer", 42);
+	EXPECT(true);
+	EXPECT(false);
+}
+
+DEFTEST("lithium.unit.runner.result_channel", {})
+{
+	char path[] = "/tmp/lithium_report_XXXXXX";
+	char report[8192] = { 0 };
+	int fd = mkstemp(path);
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_fail",
+			.func = report_metric_and_fail,
+		},
+		{
+			.name = "should_fail_too",
+			.func = report_metric_and_fail,
+		},
+		{
+			.name = "should_fail_in_thread",
+			.func = report_metric_and_fail,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+	};
+
+	ASSERT(fd >= 0);
+	tests[0].rest = &tests[1];
+	tests[1].rest = &tests[2];
+
+	/* The processes share the result channel */
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.use_zygote = true,
+		.report_jsonl = path,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(read(fd, report, sizeof(report) - 1) > 0);
+	close(fd);
+	unlink(path);
+
+	/* Once from each test */
+	const char *record = "\"assertions\":{\"successful\":1,\"failed\":1},"
+			     "\"failure_site\":\"src/unit/runner_tests.c:";
+	const char *metric = "\"metrics\":[{\"name\":\"answer\",\"value\":42,"
+			     "\"sample\":false}]";
+	const char *found = report;
+
+	for (int i = 0; i < 3; i++) {
+		found = strstr(found, record);
+		ASSERT(found);
+		found++;
+	}
+	EXPECT(!strstr(found, record));
+
+	found = report;
+	for (int i = 0; i < 3; i++) {
+		found = strstr(found, metric);
+		ASSERT(found);
+		found++;
+	}
+	EXPECT(!strstr(found, metric));
+}
+
+static void burn_cpu(void)
+{
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	do {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	} while (now.tv_sec == start.tv_sec &&
+		 now.tv_nsec - start.tv_nsec < 20000000);
+}
+
+static void touch_memory(void)
+{
+	size_t size = 64 << 20;
+	char *buf = calloc(size, 1);
+
+	ASSERT_NOT_NULL(buf);
+	memset(buf, 1, size);
+	EXPECT(((volatile char *)buf)[size - 1] == 1);
+	free(buf);
+}
+
+DEFTEST("lithium.unit.runner.budgets", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_exceed_cpu",
+			.func = burn_cpu,
+			.options.max_cpu_ms = 5,
+		},
+		{
+			.name = "should_exceed_cpu_in_thread",
+			.func = burn_cpu,
+			.options = {
+				.isolation = LI_UNIT_ISOLATION_THREAD,
+				.max_cpu_ms = 5,
+			},
+		},
+		{
+			.name = "should_exceed_rss",
+			.func = touch_memory,
+			.options.max_rss_kb = 32 << 10,
+		},
+		{
+			.name = "should_succeed",
+			.func = touch_memory,
+			.options = {
+				.max_rss_kb = 1 << 20,
+				.max_cpu_ms = 10000,
+			},
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[3].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[3].priv.rusage.ru_maxrss >= 64 << 10);
+}
+
+static void open_many_files(void)
+{
+	for (int i = 0; i < 64; i++)
+		ASSERT(dup(STDIN_FILENO) >= 0);
+}
+
+DEFTEST("lithium.unit.runner.limits", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_exceed_memory",
+			.func = touch_memory,
+		},
+		{
+			.name = "should_exceed_fds",
+			.func = open_many_files,
+		},
+		{
+			.name = "should_succeed",
+			.func = print_some_output,
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.use_zygote = true,
+		.memory_limit_kb = 64 << 10,
+		.fd_limit = 32,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+}
+
+static void fork_children(void)
+{
+	pid_t pids[8];
+	size_t n_pids = 0;
+	bool forked_all = true;
+
+	for (; n_pids < ARRAY_SIZE(pids); n_pids++) {
+		pids[n_pids] = fork();
+		if (pids[n_pids] < 0) {
+			forked_all = false;
+			break;
+		}
+		if (pids[n_pids] == 0) {
+			usleep(50000);
+			_exit(0);
+		}
+	}
+
+	while (n_pids--)
+		waitpid(pids[n_pids], NULL, 0);
+	EXPECT(forked_all);
+}
+
+DEFTEST("lithium.unit.runner.process_limit", {})
+{
+	struct li_unit_test test = {
+		.name = "should_not_start",
+		.func = fork_children,
+	};
+
+	struct li_unit_runner_options options = {
+		.parallelism = 1,
+		.process_limit = 4,
+		.test_list = &test,
+	};
+
+	/* Only a cgroup can limit the processes of one test */
+	EXPECT(li_unit_run_tests(&options) == -1);
+	EXPECT(test.priv.state == _LI_UNIT_NOT_STARTED);
+}
+
+/*
+ * Needs a cgroup v2 directory delegated to the user running the
+ * tests, given in LITHIUM_TEST_CGROUP.
+ */
+DEFTEST("lithium.unit.runner.cgroup", {})
+{
+	const char *cgroup = getenv("LITHIUM_TEST_CGROUP");
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_exceed_processes",
+			.func = fork_children,
+		},
+		{
+			.name = "should_exceed_memory",
+			.func = touch_memory,
+		},
+		{
+			.name = "should_succeed",
+			.func = print_some_output,
+		},
+	};
+
+	if (!cgroup) {
+		printf("NOTICE: LITHIUM_TEST_CGROUP is unset, skipping.\n");
+		return;
+	}
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.memory_limit_kb = 64 << 10,
+		.process_limit = 4,
+		.cgroup = cgroup,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+}
+
+DEFTEST("lithium.unit.runner.exclusive", {})
+{
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_run_alone",
+			.func = sleep_briefly,
+			.options.exclusive = true,
+		},
+		{
+			.name = "should_run_alongside_1",
+			.func = sleep_briefly,
+		},
+		{
+			.name = "should_run_alongside_2",
+			.func = sleep_briefly,
+		},
+	};
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 3,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 0);
+
+	/* The exclusive test was moved last, and started once the
+	   others were done */
+	for (size_t i = 1; i < ARRAY_SIZE(tests); i++) {
+		struct timespec end = tests[i].priv.start_time;
+
+		end.tv_sec += tests[i].priv.elapsed_time.tv_sec;
+		end.tv_nsec += tests[i].priv.elapsed_time.tv_nsec;
+		if (end.tv_nsec >= 1000000000) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000;
+		}
+		EXPECT(end.tv_sec < tests[0].priv.start_time.tv_sec ||
+		       (end.tv_sec == tests[0].priv.start_time.tv_sec &&
+			end.tv_nsec <= tests[0].priv.start_time.tv_nsec));
+	}
+}
+
+static void report_fast_samples(void)
+{
+	for (int i = 0; i < 10; i++)
+		li_unit_report_bench_sample("ns_per_op", 10 + i);
+}
+
+static void report_slow_samples(void)
+{
+	for (int i = 0; i < 10; i++)
+		li_unit_report_bench_sample("ns_per_op", 20 + i);
+}
+
+static void report_fast_samples_and_metrics(void)
+{
+	report_fast_samples();
+	li_unit_report_metric("ops_per_sec", 1000);
+}
+
+DEFTEST("lithium.unit.runner.baseline", {})
+{
+	char path[] = "/tmp/lithium_baseline_XXXXXX";
+	int fd = mkstemp(path);
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_regress",
+			.func = report_slow_samples,
+		},
+		{
+			.name = "should_hold",
+			.func = report_fast_samples,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+		{
+			.name = "should_have_no_baseline",
+			.func = report_slow_samples,
+		},
+		{
+			.name = "should_only_compare_samples",
+			.func = report_fast_samples_and_metrics,
+		},
+	};
+	FILE *baseline = fdopen(fd, "w");
+
+	ASSERT_NOT_NULL(baseline);
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+		if (i == 2)
+			continue;
+		fprintf(baseline, "%s\tns_per_op\t", tests[i].name);
+		for (int j = 0; j < 10; j++)
+			fprintf(baseline, "%d ", 10 + j);
+		fprintf(baseline, "\n");
+	}
+
+	/* Higher is better for this one, so it must not count as a
+	   regression */
+	fprintf(baseline, "%s\tops_per_sec\t", tests[3].name);
+	for (int j = 0; j < 10; j++)
+		fprintf(baseline, "%d ", 10 + j);
+	fprintf(baseline, "\n");
+	fclose(baseline);
+
+	for (size_t i = 0; i + 1 < ARRAY_SIZE(tests); i++)
+		tests[i].rest = &tests[i + 1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 1,
+		.compare_baseline = path,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	unlink(path);
+
+	EXPECT(tests[0].priv.state == _LI_UNIT_FAILED);
+	EXPECT(tests[1].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[2].priv.state == _LI_UNIT_SUCCEEDED);
+	EXPECT(tests[3].priv.state == _LI_UNIT_SUCCEEDED);
+}
+
+static void sleep_past_limit(void)
+{
+	EXPECT_WITHIN_NS(1000, 50, 5) {
+		struct timespec pause = { .tv_nsec = 1000000 };
+
+		nanosleep(&pause, NULL);
+	}
+}
+
+DEFTEST("lithium.unit.runner.timing_assertion", {})
+{
+	char path[] = "/tmp/lithium_report_XXXXXX";
+	char report[4096] = { 0 };
+	int fd = mkstemp(path);
+	struct li_unit_test test = {
+		.name = "should_be_too_slow",
+		.func = sleep_past_limit,
+	};
+
+	ASSERT(fd >= 0);
+
+	struct li_unit_runner_options options = {
+		.parallelism = 1,
+		.report_jsonl = path,
+		.test_list = &test,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(read(fd, report, sizeof(report) - 1) > 0);
+	close(fd);
+	unlink(path);
+
+	/* The failure gives the distribution of times */
+	EXPECT_NOT_NULL(strstr(report, "EXPECT_WITHIN_NS failure, block is "
+				       "too slow: 1000 (p50 was "));
+	EXPECT_NOT_NULL(strstr(report, "over 5 iterations: min "));
+}
+
+DEFTEST("lithium.unit.runner.instruction_budget", {})
+{
+	struct li_unit_perf_counters counters;
+	bool have_counters = li_unit_perf_open(&counters, false) == 0;
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_exceed_instructions",
+			.func = burn_cpu,
+			.options.max_instructions = 1000,
+		},
+		{
+			.name = "should_exceed_instructions_in_thread",
+			.func = burn_cpu,
+			.options = {
+				.isolation = LI_UNIT_ISOLATION_THREAD,
+				.max_instructions = 1000,
+			},
+		},
+	};
+
+	if (have_counters)
+		li_unit_perf_close(&counters);
+	tests[0].rest = &tests[1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.test_list = tests,
+	};
+
+	/* Without counters, the budget is not checked */
+	EXPECT(li_unit_run_tests(&options) == have_counters);
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++)
+		EXPECT(tests[i].priv.state == (have_counters ?
+						       _LI_UNIT_FAILED :
+						       _LI_UNIT_SUCCEEDED));
+}
+
+static void fail_in_loop(void)
+{
+	for (int i = 0; i < 1000000; i++)
+		EXPECT(i < 0);
+}
+
+DEFTEST("lithium.unit.runner.repeated_failures", {})
+{
+	char path[] = "/tmp/lithium_report_XXXXXX";
+	char report[8192] = { 0 };
+	int fd = mkstemp(path);
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_fail_quietly",
+			.func = fail_in_loop,
+		},
+		{
+			.name = "should_fail_quietly_in_thread",
+			.func = fail_in_loop,
+			.options.isolation = LI_UNIT_ISOLATION_THREAD,
+		},
+	};
+
+	ASSERT(fd >= 0);
+	tests[0].rest = &tests[1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.report_jsonl = path,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	EXPECT(read(fd, report, sizeof(report) - 1) > 0);
+	close(fd);
+	unlink(path);
+
+	/* Every failure is counted, but only the first few are printed,
+	   so both reports fit */
+	const char *counts = "\"failed\":1000000}";
+	const char *repeats = "(failed 1000000 times, 999990 not shown)";
+	char *first = strstr(report, counts);
+
+	EXPECT(first && strstr(first + 1, counts));
+	first = strstr(report, repeats);
+	EXPECT(first && strstr(first + 1, repeats));
+}
+
+static void fail_on_a(const uint8_t *data, size_t size)
+{
+	EXPECT(size == 0 || data[0] != 'A');
+}
+
+static char *make_fuzz_dir(void)
+{
+	char template[] = "/tmp/lithium_fuzz_XXXXXX";
+	char *dir = mkdtemp(template);
+
+	return dir ? strdup(dir) : NULL;
+}
+
+static void remove_fuzz_dir(const char *dir)
+{
+	char *command;
+
+	if (asprintf(&command, "rm -rf '%s'", dir) >= 0) {
+		EXPECT(system(command) == 0);
+		free(command);
+	}
+}
+
+DEFTEST("lithium.unit.runner.fuzz_replay", {})
+{
+	char *dir = make_fuzz_dir();
+	char *path;
+	FILE *input;
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_replay",
+			.fuzz = fail_on_a,
+		},
+		{
+			.name = "should_replay",
+			.fuzz = fail_on_a,
+		},
+	};
+	struct li_unit_runner_options options = {
+		.parallelism = 1,
+		.test_list = &tests[0],
+	};
+
+	ASSERT_NOT_NULL(dir);
+	ASSERT(asprintf(&path, "%s/should_replay", dir) >= 0);
+	ASSERT(mkdir(path, 0755) == 0);
+	free(path);
+	ASSERT(asprintf(&path, "%s/should_replay/crashes", dir) >= 0);
+	ASSERT(mkdir(path, 0755) == 0);
+	free(path);
+	ASSERT(asprintf(&path, "%s/should_replay/crashes/crash-a", dir) >= 0);
+	input = fopen(path, "w");
+	free(path);
+	ASSERT_NOT_NULL(input);
+	fputs("A", input);
+	fclose(input);
+
+	/* Only the empty input, without the fuzz directory */
+	EXPECT(li_unit_run_tests(&options) == 0);
+
+	options.fuzz_dir = dir;
+	options.test_list = &tests[1];
+	EXPECT(li_unit_run_tests(&options) == 1);
+
+	remove_fuzz_dir(dir);
+	free(dir);
+}
+
+DEFTEST("lithium.unit.runner.fuzz", {})
+{
+	char *dir = make_fuzz_dir();
+	char *path;
+	struct dirent *dirent;
+	DIR *crashes;
+	size_t n_crashes = 0;
+	struct li_unit_test tests[] = {
+		{
+			.name = "should_crash",
+			.fuzz = fail_on_a,
+		},
+		{
+			.name = "should_not_be_fuzzed",
+			.func = test_failure,
+		},
+	};
+
+	ASSERT_NOT_NULL(dir);
+	tests[0].rest = &tests[1];
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.fuzz = true,
+		.fuzz_seconds = 1,
+		.fuzz_dir = dir,
+		.test_list = tests,
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+
+	ASSERT(asprintf(&path, "%s/should_crash/crashes", dir) >= 0);
+	crashes = opendir(path);
+	free(path);
+	ASSERT_NOT_NULL(crashes);
+	while ((dirent = readdir(crashes))) {
+		if (!strncmp(dirent->d_name, "crash-", 6))
+			n_crashes++;
+	}
+	closedir(crashes);
+
+	/* Found even without coverage feedback, in the debug build */
+	EXPECT(n_crashes >= 1);
+
+	remove_fuzz_dir(dir);
+	free(dir);
+}
+
+DEFTEST("lithium.unit.runner.cache", {})
+{
+	const char *const succeed_argv[] = { "/bin/sh", "-c", "exit 0", NULL };
+	char path[] = "/tmp/lithium_cache_XXXXXX";
+	int fd = mkstemp(path);
+	struct li_unit_test runs[3][4];
+
+	ASSERT(fd >= 0);
+	close(fd);
+
+	for (size_t i = 0; i < ARRAY_SIZE(runs); i++) {
+		struct li_unit_test *tests = runs[i];
+
+		memset(tests, 0, sizeof(runs[i]));
+		tests[0].name = "should_be_cached";
+		tests[0].func = print_some_output;
+		tests[1].name = "should_be_cached_in_thread";
+		tests[1].func = print_some_output;
+		tests[1].options.isolation = LI_UNIT_ISOLATION_THREAD;
+		tests[2].name = "should_be_cached_exec";
+		tests[2].argv = succeed_argv;
+		tests[3].name = "should_fail";
+		tests[3].func = test_failure;
+		for (size_t j = 0; j + 1 < ARRAY_SIZE(runs[i]); j++)
+			tests[j].rest = &tests[j + 1];
+	}
+
+	struct li_unit_runner_options options = {
+		.parallelism = 2,
+		.cache_file = path,
+		.test_list = runs[0],
+	};
+
+	EXPECT(li_unit_run_tests(&options) == 1);
+	for (size_t j = 0; j < ARRAY_SIZE(runs[0]); j++)
+		EXPECT(!runs[0][j].priv.cached);
+
+	/* Only the failing test runs again */
+	options.test_list = runs[1];
+	EXPECT(li_unit_run_tests(&options) == 1);
+	for (size_t j = 0; j < 3; j++) {
+		EXPECT(runs[1][j].priv.cached);
+		EXPECT(runs[1][j].priv.state == _LI_UNIT_SUCCEEDED);
+	}
+	EXPECT(!runs[1][3].priv.cached);
+	EXPECT(runs[1][3].priv.state == _LI_UNIT_FAILED);
+
+	/* A changed limit changes the key */
+	options.test_list = runs[2];
+	options.fd_limit = 1024;
+	EXPECT(li_unit_run_tests(&options) == 1);
+	for (size_t j = 0; j < ARRAY_SIZE(runs[2]); j++)
+		EXPECT(!runs[2][j].priv.cached);
+
+	unlink(path);
+}
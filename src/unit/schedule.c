@@ -0,0 +1,279 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+#include "schedule.h"
+#include "unit.h"
+#include "util/hash.h"
+
+struct schedule_entry {
+	struct li_unit_test *test;
+	uint64_t expected_ns;
+	bool known;
+	size_t index;
+};
+
+static int longest_first_cmp(const void *a, const void *b)
+{
+	const struct schedule_entry *ea = a;
+	const struct schedule_entry *eb = b;
+
+	if (ea->expected_ns != eb->expected_ns)
+		return ea->expected_ns > eb->expected_ns ? -1 : 1;
+
+	/* qsort is not stable, so break ties by the original order */
+	return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+/*
+ * Fill in the expected durations of the tests from the history, with
+ * unknown tests getting the mean of the known ones.
+ */
+static void estimate_durations(struct schedule_entry *entries, size_t n_tests,
+			       const struct li_unit_history *history)
+{
+	uint64_t known_total_ns = 0;
+	size_t n_known = 0;
+
+	for (size_t i = 0; i < n_tests; i++) {
+		entries[i].expected_ns = 0;
+		entries[i].known =
+			history && li_unit_history_lookup(
+					   history, entries[i].test->name,
+					   &entries[i].expected_ns);
+		if (entries[i].known) {
+			known_total_ns += entries[i].expected_ns;
+			n_known++;
+		}
+	}
+
+	if (!n_known)
+		return;
+
+	for (size_t i = 0; i < n_tests; i++) {
+		if (!entries[i].known)
+			entries[i].expected_ns = known_total_ns / n_known;
+	}
+}
+
+static struct schedule_entry *
+make_entries(struct li_unit_test **tests, size_t n_tests,
+	     const struct li_unit_history *history)
+{
+	struct schedule_entry *entries = calloc(n_tests, sizeof(*entries));
+
+	if (!entries)
+		return NULL;
+
+	for (size_t i = 0; i < n_tests; i++) {
+		entries[i].test = tests[i];
+		entries[i].index = i;
+	}
+
+	estimate_durations(entries, n_tests, history);
+	return entries;
+}
+
+void li_unit_schedule_longest_first(struct li_unit_test **tests,
+				    size_t n_tests,
+				    const struct li_unit_history *history)
+{
+	struct schedule_entry *entries = make_entries(tests, n_tests, history);
+
+	/* Scheduling is an optimization, so just keep the order */
+	if (!entries)
+		return;
+
+	qsort(entries, n_tests, sizeof(*entries), longest_first_cmp);
+
+	for (size_t i = 0; i < n_tests; i++)
+		tests[i] = entries[i].test;
+
+	free(entries);
+}
+
+/*
+ * Sort for shard assignment. Unlike longest_first_cmp, ties are broken
+ * by name, so that the assignment does not depend on the order the
+ * tests were registered in.
+ */
+static int shard_cmp(const void *a, const void *b)
+{
+	const struct schedule_entry *ea = a;
+	const struct schedule_entry *eb = b;
+
+	if (ea->expected_ns != eb->expected_ns)
+		return ea->expected_ns > eb->expected_ns ? -1 : 1;
+	return strcmp(ea->test->name, eb->test->name);
+}
+
+static int index_cmp(const void *a, const void *b)
+{
+	const struct schedule_entry *ea = a;
+	const struct schedule_entry *eb = b;
+
+	return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+ssize_t li_unit_schedule_shard(struct li_unit_test **tests, size_t n_tests,
+			       const struct li_unit_history *history,
+			       unsigned int shard_index,
+			       unsigned int total_shards)
+{
+	struct schedule_entry *entries = make_entries(tests, n_tests, history);
+	uint64_t *shard_load = calloc(total_shards, sizeof(*shard_load));
+	unsigned int *shard_of = calloc(n_tests, sizeof(*shard_of));
+	ssize_t n_selected = -1;
+
+	if (!entries || !shard_load || !shard_of) {
+		perror("calloc failed");
+		goto exit;
+	}
+
+	qsort(entries, n_tests, sizeof(*entries), shard_cmp);
+
+	/* Tests without a recorded duration are placed by a hash of
+	   their name */
+	for (size_t i = 0; i < n_tests; i++) {
+		const char *name = entries[i].test->name;
+
+		if (entries[i].known)
+			continue;
+
+		shard_of[i] = li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, name,
+					       strlen(name)) %
+			      total_shards;
+		shard_load[shard_of[i]] += entries[i].expected_ns;
+	}
+
+	/* The rest are placed greedily, longest first, onto the shard
+	   with the least expected work */
+	for (size_t i = 0; i < n_tests; i++) {
+		unsigned int least_loaded = 0;
+
+		if (!entries[i].known)
+			continue;
+
+		for (unsigned int shard = 1; shard < total_shards; shard++) {
+			if (shard_load[shard] < shard_load[least_loaded])
+				least_loaded = shard;
+		}
+
+		shard_of[i] = least_loaded;
+		shard_load[least_loaded] += entries[i].expected_ns;
+	}
+
+	n_selected = 0;
+	for (size_t i = 0; i < n_tests; i++) {
+		if (shard_of[i] == shard_index)
+			entries[n_selected++] = entries[i];
+	}
+
+	qsort(entries, n_selected, sizeof(*entries), index_cmp);
+	for (ssize_t i = 0; i < n_selected; i++)
+		tests[i] = entries[i].test;
+
+exit:
+	free(entries);
+	free(shard_load);
+	free(shard_of);
+	return n_selected;
+}
+
+DEFTEST("lithium.unit.schedule.longest_first",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_test a = { .name = "a" };
+	struct li_unit_test b = { .name = "b" };
+	struct li_unit_test c = { .name = "c" };
+	struct li_unit_test d = { .name = "d" };
+	struct li_unit_test *tests[] = { &a, &b, &c, &d };
+	struct li_unit_history_entry entries[] = {
+		{ .name = "a", .elapsed_ns = 10 },
+		{ .name = "c", .elapsed_ns = 30 },
+	};
+	struct li_unit_history history = {
+		.entries = entries,
+		.n_entries = ARRAY_SIZE(entries),
+		.n_sorted = ARRAY_SIZE(entries),
+	};
+
+	/* b and d are unknown, so they are expected to take 20ns */
+	li_unit_schedule_longest_first(tests, ARRAY_SIZE(tests), &history);
+	EXPECT(tests[0] == &c);
+	EXPECT(tests[1] == &b);
+	EXPECT(tests[2] == &d);
+	EXPECT(tests[3] == &a);
+
+	/* Without a history, the order is kept */
+	li_unit_schedule_longest_first(tests, ARRAY_SIZE(tests), NULL);
+	EXPECT(tests[0] == &c);
+	EXPECT(tests[3] == &a);
+}
+
+DEFTEST("lithium.unit.schedule.shard",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct li_unit_test tests[8];
+	char names[ARRAY_SIZE(tests)][2];
+	struct li_unit_history_entry entries[] = {
+		{ .name = "a", .elapsed_ns = 60 },
+		{ .name = "b", .elapsed_ns = 50 },
+		{ .name = "c", .elapsed_ns = 40 },
+		{ .name = "d", .elapsed_ns = 30 },
+		{ .name = "e", .elapsed_ns = 20 },
+		{ .name = "f", .elapsed_ns = 10 },
+	};
+	struct li_unit_history history = {
+		.entries = entries,
+		.n_entries = ARRAY_SIZE(entries),
+		.n_sorted = ARRAY_SIZE(entries),
+	};
+	unsigned int times_selected[ARRAY_SIZE(tests)] = { 0 };
+
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++) {
+		names[i][0] = 'a' + i;
+		names[i][1] = '\0';
+		tests[i] = (struct li_unit_test){ .name = names[i] };
+	}
+
+	for (unsigned int shard = 0; shard < 2; shard++) {
+		struct li_unit_test *shard_tests[ARRAY_SIZE(tests)];
+		uint64_t known_load = 0;
+
+		for (size_t i = 0; i < ARRAY_SIZE(tests); i++)
+			shard_tests[i] = &tests[i];
+
+		ssize_t n = li_unit_schedule_shard(shard_tests,
+						   ARRAY_SIZE(tests),
+						   &history, shard, 2);
+		ASSERT(n >= 0);
+
+		for (ssize_t i = 0; i < n; i++) {
+			size_t index = shard_tests[i] - tests;
+
+			times_selected[index]++;
+			if (index < ARRAY_SIZE(entries))
+				known_load += entries[index].elapsed_ns;
+
+			/* The original order is kept */
+			if (i > 0)
+				EXPECT(shard_tests[i - 1] < shard_tests[i]);
+		}
+
+		/* 210ns of known work splits evenly */
+		EXPECT(known_load == 100 || known_load == 110);
+	}
+
+	/* Every test lands on exactly one shard */
+	for (size_t i = 0; i < ARRAY_SIZE(tests); i++)
+		EXPECT(times_selected[i] == 1);
+}
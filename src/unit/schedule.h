@@ -0,0 +1,54 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_SCHEDULE_H_
+#define LITHIUM_SRC_UNIT_SCHEDULE_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "history.h"
+#include "unit.h"
+
+/**
+ * Sort tests longest expected duration first (LPT scheduling), so a
+ * long test starting late does not stretch the run.
+ *
+ * :param tests: The array of tests to sort in place.
+ * :param n_tests: The number of tests in the array.
+ * :param history: Durations from previous runs. Tests which are not
+ *                 in the history are expected to take the mean time
+ *                 of those which are.
+ *
+ * Tests with equal expected durations keep their relative order.
+ */
+void li_unit_schedule_longest_first(struct li_unit_test **tests,
+				    size_t n_tests,
+				    const struct li_unit_history *history);
+
+/**
+ * Select the tests which belong to one shard of a run split across
+ * several machines.
+ *
+ * :param tests: The array of tests. On return, the tests for this
+ *               shard are at the start of the array, in their
+ *               original order.
+ * :param n_tests: The number of tests in the array.
+ * :param history: Durations from previous runs.
+ * :param shard_index: The index of this shard.
+ * :param total_shards: The number of shards.
+ * :return: The number of tests in this shard, or -1 on failure.
+ *
+ * Tests with a recorded duration are spread so that each shard gets
+ * about the same expected work. The rest are assigned by a hash of
+ * their name. The partition is deterministic, as long as every shard
+ * uses the same history and set of tests.
+ */
+ssize_t li_unit_schedule_shard(struct li_unit_test **tests, size_t n_tests,
+			       const struct li_unit_history *history,
+			       unsigned int shard_index,
+			       unsigned int total_shards);
+
+#endif /* LITHIUM_SRC_UNIT_SCHEDULE_H_ */
@@ -0,0 +1,359 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "macrolib.h"
+#include "perf.h"
+#include "result.h"
+#include "spawn.h"
+#include "unit.h"
+
+struct zygote_reply {
+	pid_t pid;
+	int error;
+};
+
+static struct {
+	pid_t pid;
+	int control_fd;
+	int saved_subreaper;
+} zygote = {
+	.pid = -1,
+	.control_fd = -1,
+};
+
+static void __noreturn run_test_child(const struct li_unit_spawn_request *req)
+{
+	/* Redirect stdout to output */
+	if (dup2(req->output_fd, STDOUT_FILENO) < 0) {
+		perror("dup2 failed");
+		abort();
+	}
+
+	/* Redirect stderr to output */
+	if (dup2(req->output_fd, STDERR_FILENO) < 0) {
+		perror("dup2 failed");
+		abort();
+	}
+
+	if (req->output_fd > STDERR_FILENO && close(req->output_fd) < 0) {
+		perror("close failed");
+		abort();
+	}
+
+	if (req->sigmask && sigprocmask(SIG_SETMASK, req->sigmask, NULL) < 0) {
+		perror("sigprocmask failed");
+		abort();
+	}
+
+	if (req->cgroup_fd >= 0) {
+		if (li_unit_cgroup_enter(req->cgroup_fd) < 0)
+			abort();
+		close(req->cgroup_fd);
+	}
+
+	if (li_unit_limits_apply(&req->limits, req->cgroup_fd >= 0) < 0)
+		abort();
+
+	/* The result channel has to survive the exec of a test in
+	   another binary, but should not leak into anything a test
+	   in this one runs */
+	if (req->result_fd >= 0) {
+		char fd_str[32];
+
+		snprintf(fd_str, sizeof(fd_str), "%d:%" PRIu32, req->result_fd,
+			 req->result_job);
+		if ((req->test->argv && fcntl(req->result_fd, F_SETFD, 0) < 0) ||
+		    setenv(LI_UNIT_RESULT_FD_ENV, fd_str, 1) < 0) {
+			perror("failed to pass on the result channel");
+			abort();
+		}
+	}
+
+	if (req->perf_counters && setenv(LI_UNIT_PERF_ENV, "1", 1) < 0) {
+		perror("setenv failed");
+		abort();
+	}
+
+	if (req->test->argv) {
+		execv(req->test->argv[0], (char *const *)req->test->argv);
+		fprintf(stderr, "%s: exec failed: %m\n", req->test->argv[0]);
+		_exit(127);
+	}
+
+	li_unit_run_test(req->test);
+}
+
+/*
+ * Fork the test child from the zygote, through an intermediate
+ * process which exits right away. This orphans the child, and it
+ * gets reparented to the runner (which is a child subreaper).
+ */
+static pid_t zygote_spawn_orphan(const struct li_unit_spawn_request *req,
+				 int control_fd)
+{
+	int pid_pipe[2];
+	pid_t pid = -1;
+	pid_t intermediate;
+	int status;
+
+	if (pipe2(pid_pipe, O_CLOEXEC) < 0)
+		return -1;
+
+	intermediate = fork();
+	if (intermediate < 0)
+		goto exit;
+
+	if (intermediate == 0) {
+		pid_t child = fork();
+
+		if (child == 0) {
+			close(control_fd);
+			close(pid_pipe[0]);
+			close(pid_pipe[1]);
+			run_test_child(req);
+		}
+
+		if (write(pid_pipe[1], &child, sizeof(child)) != sizeof(child))
+			_exit(1);
+		_exit(child < 0);
+	}
+
+	if (read(pid_pipe[0], &pid, sizeof(pid)) != sizeof(pid))
+		pid = -1;
+
+	/* Once the intermediate process has exited, the child is
+	   reparented and the runner can wait on it */
+	if (waitpid(intermediate, &status, 0) < 0)
+		pid = -1;
+
+	if (pid < 0)
+		errno = EAGAIN;
+
+exit:
+	close(pid_pipe[0]);
+	close(pid_pipe[1]);
+	return pid;
+}
+
+static ssize_t zygote_recv_request(int control_fd,
+				   struct li_unit_spawn_request *req)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))];
+	int fds[3];
+	size_t n_fds;
+	struct iovec iov = {
+		.iov_base = req,
+		.iov_len = sizeof(*req),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+
+	ssize_t rv = recvmsg(control_fd, &msg, MSG_CMSG_CLOEXEC);
+	if (rv <= 0)
+		return rv;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (rv != sizeof(*req) || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len < CMSG_LEN(sizeof(int)) ||
+	    cmsg->cmsg_len > CMSG_LEN(sizeof(fds))) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	/* The output is followed by the result channel and the cgroup,
+	   for those the runner had (the values in the request are the
+	   runner's descriptors) */
+	n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	if (n_fds != 1 + (req->result_fd >= 0) + (req->cgroup_fd >= 0)) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+	n_fds = 0;
+	req->output_fd = fds[n_fds++];
+	if (req->result_fd >= 0)
+		req->result_fd = fds[n_fds++];
+	if (req->cgroup_fd >= 0)
+		req->cgroup_fd = fds[n_fds++];
+
+	/* Our signal mask is the one from before the runner changed
+	   it, and the pointer is not valid here anyway */
+	req->sigmask = NULL;
+	return rv;
+}
+
+static void __noreturn zygote_main(int control_fd)
+{
+	for (;;) {
+		struct li_unit_spawn_request req;
+		struct zygote_reply reply = { 0 };
+		ssize_t rv = zygote_recv_request(control_fd, &req);
+
+		/* The runner closes the socket when it is done */
+		if (rv == 0)
+			_exit(0);
+
+		if (rv < 0) {
+			perror("zygote: recvmsg failed");
+			_exit(1);
+		}
+
+		reply.pid = zygote_spawn_orphan(&req, control_fd);
+		if (reply.pid < 0)
+			reply.error = errno;
+		close(req.output_fd);
+		if (req.result_fd >= 0)
+			close(req.result_fd);
+		if (req.cgroup_fd >= 0)
+			close(req.cgroup_fd);
+
+		if (send(control_fd, &reply, sizeof(reply), 0) < 0) {
+			perror("zygote: send failed");
+			_exit(1);
+		}
+	}
+}
+
+int li_unit_zygote_start(void)
+{
+	int sv[2];
+
+	if (prctl(PR_GET_CHILD_SUBREAPER, &zygote.saved_subreaper) < 0 ||
+	    prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+		perror("prctl failed");
+		return -1;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair failed");
+		return -1;
+	}
+
+	/* Don't let the zygote inherit unflushed output */
+	fflush(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		zygote_main(sv[1]);
+	}
+
+	close(sv[1]);
+	zygote.pid = pid;
+	zygote.control_fd = sv[0];
+	return 0;
+}
+
+void li_unit_zygote_stop(void)
+{
+	if (zygote.pid < 0)
+		return;
+
+	close(zygote.control_fd);
+	if (waitpid(zygote.pid, NULL, 0) < 0)
+		perror("waitpid failed");
+	prctl(PR_SET_CHILD_SUBREAPER, zygote.saved_subreaper);
+
+	zygote.pid = -1;
+	zygote.control_fd = -1;
+}
+
+static pid_t zygote_spawn(const struct li_unit_spawn_request *req)
+{
+	char control[CMSG_SPACE(3 * sizeof(int))] = { 0 };
+	int fds[3] = { req->output_fd };
+	size_t n_fds = 1;
+	struct iovec iov = {
+		.iov_base = (void *)req,
+		.iov_len = sizeof(*req),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	struct zygote_reply reply;
+
+	if (req->result_fd >= 0)
+		fds[n_fds++] = req->result_fd;
+	if (req->cgroup_fd >= 0)
+		fds[n_fds++] = req->cgroup_fd;
+	msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+
+	if (sendmsg(zygote.control_fd, &msg, 0) < 0) {
+		perror("sendmsg failed");
+		return -1;
+	}
+
+	if (recv(zygote.control_fd, &reply, sizeof(reply), 0) !=
+	    sizeof(reply)) {
+		perror("recv failed");
+		return -1;
+	}
+
+	if (reply.pid < 0) {
+		errno = reply.error;
+		perror("zygote failed to spawn test");
+		return -1;
+	}
+
+	return reply.pid;
+}
+
+pid_t li_unit_spawn(const struct li_unit_spawn_request *req)
+{
+	if (zygote.pid >= 0)
+		return zygote_spawn(req);
+
+	/* Don't let the child inherit unflushed output */
+	fflush(NULL);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork failed");
+		return -1;
+	}
+
+	if (pid == 0)
+		run_test_child(req);
+
+	return pid;
+}
@@ -0,0 +1,94 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LITHIUM_SRC_UNIT_SPAWN_H_
+#define LITHIUM_SRC_UNIT_SPAWN_H_
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "resources.h"
+#include "unit.h"
+
+/**
+ * Everything a test child needs to set itself up before running the
+ * test.
+ */
+struct li_unit_spawn_request {
+	/**
+	 * The test to run.
+	 */
+	const struct li_unit_test *test;
+
+	/**
+	 * File descriptor to redirect stdout and stderr to.
+	 */
+	int output_fd;
+
+	/**
+	 * File descriptor of the result channel (see ``result.h``), or
+	 * -1 for none.
+	 */
+	int result_fd;
+
+	/**
+	 * The job the test tags its records in the result channel
+	 * with.
+	 */
+	uint32_t result_job;
+
+	/**
+	 * File descriptor of the cgroup to move the child into, or -1
+	 * for none.
+	 */
+	int cgroup_fd;
+
+	/**
+	 * Resource limits to apply in the child.
+	 */
+	struct li_unit_limits limits;
+
+	/**
+	 * True if the child should count hardware events while the
+	 * test runs.
+	 */
+	bool perf_counters;
+
+	/**
+	 * If non-NULL, the signal mask to restore in the child.
+	 */
+	const sigset_t *sigmask;
+};
+
+/**
+ * Start the zygote process, which all further calls to
+ * :c:func:`li_unit_spawn` will fork test children from.
+ *
+ * :return: 0 on success, -1 on failure.
+ *
+ * This should be called as early as possible, as the zygote is a
+ * copy of the calling process. Test children forked from the zygote
+ * are reparented to the caller, so they can be reaped as usual.
+ */
+int li_unit_zygote_start(void);
+
+/**
+ * Stop the zygote process, if it was started. Further calls to
+ * :c:func:`li_unit_spawn` will fork from the calling process.
+ */
+void li_unit_zygote_stop(void);
+
+/**
+ * Start a child process to run a test.
+ *
+ * :param req: The spawn request. The file descriptors in it are not
+ *             closed.
+ * :return: The pid of the child, or -1 on failure.
+ */
+pid_t li_unit_spawn(const struct li_unit_spawn_request *req);
+
+#endif /* LITHIUM_SRC_UNIT_SPAWN_H_ */
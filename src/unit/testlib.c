@@ -3,85 +3,305 @@
  * found in the LICENSE file.
  */
 
+#include <inttypes.h>
+#include <setjmp.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "bench.h"
+#include "fuzz.h"
 #include "macrolib.h"
+#include "perf.h"
+#include "result.h"
 #include "unit.h"
 
-static size_t successful_assertions;
-static size_t failed_assertions;
+/* Thread-local, so that tests can run on several threads of the
+   runner at once */
+_Thread_local size_t _li_unit_successful_assertions;
+static _Thread_local size_t failed_assertions;
 
-static void __noreturn handle_test_exit(bool premature)
+/* Only the first few failures of each assertion are printed, so that
+   one failing in a loop does not flood the output. Sites are keyed by
+   their failure message, which is a distinct string literal for each
+   one, in a small open-addressed table. */
+#define MAX_PRINTED_FAILURES 10
+#define N_FAILURE_SITES 256
+
+static _Thread_local struct failure_site {
+	const char *fail_msg;
+	uint64_t failures;
+} failure_sites[N_FAILURE_SITES];
+
+/* Set while running a test in a thread: where messages go, and where
+   to unwind to when an assertion fails */
+static _Thread_local FILE *test_output;
+static _Thread_local sigjmp_buf *test_unwind;
+
+/* Where results go: straight into the runner's struct when running
+   in a thread, or else the result channel, if the runner gave us
+   one */
+static _Thread_local struct li_unit_result *test_result;
+static _Thread_local bool failure_site_reported;
+static int result_fd = -1;
+static uint32_t result_job;
+
+static FILE *output(void)
+{
+	return test_output ? test_output : stdout;
+}
+
+static void report_failure_site(const char *fail_msg)
+{
+	if (failure_site_reported)
+		return;
+	failure_site_reported = true;
+
+	if (test_result)
+		li_unit_result_set_failure_site(test_result, fail_msg,
+						strlen(fail_msg));
+	else if (result_fd >= 0)
+		li_unit_result_write(result_fd, result_job,
+				     LI_UNIT_RESULT_FAILURE_SITE, fail_msg,
+				     strlen(fail_msg), NULL, 0);
+}
+
+static void report_assertions(void)
+{
+	uint64_t counts[] = { _li_unit_successful_assertions,
+			      failed_assertions };
+
+	if (test_result) {
+		test_result->has_assertions = true;
+		test_result->successful_assertions = counts[0];
+		test_result->failed_assertions = counts[1];
+	} else if (result_fd >= 0) {
+		li_unit_result_write(result_fd, result_job,
+				     LI_UNIT_RESULT_ASSERTIONS, counts,
+				     sizeof(counts), NULL, 0);
+	}
+}
+
+static void report_value(const char *name, double value, bool sample)
+{
+	if (test_result)
+		li_unit_result_add_metric(test_result, name, strlen(name),
+					  value, sample);
+	else if (result_fd >= 0)
+		li_unit_result_write(result_fd, result_job,
+				     sample ? LI_UNIT_RESULT_BENCH_SAMPLE :
+					      LI_UNIT_RESULT_METRIC,
+				     &value, sizeof(value), name,
+				     strlen(name));
+}
+
+void li_unit_report_metric(const char *name, double value)
+{
+	report_value(name, value, false);
+}
+
+void li_unit_report_bench_sample(const char *name, double ns_per_op)
+{
+	report_value(name, ns_per_op, true);
+}
+
+static void report_counters(void)
+{
+	const struct li_unit_perf_counters *counters =
+		li_unit_perf_test_counters();
+	uint64_t count;
+
+	if (!counters)
+		return;
+
+	for (int i = 0; i < LI_UNIT_PERF_N_COUNTERS; i++) {
+		if (li_unit_perf_read(counters, i, &count))
+			report_value(li_unit_perf_counter_names[i], count,
+				     false);
+	}
+}
+
+static void reset_assertions(void)
+{
+	_li_unit_successful_assertions = 0;
+	failed_assertions = 0;
+	failure_site_reported = false;
+	memset(failure_sites, 0, sizeof(failure_sites));
+}
+
+/*
+ * Count a failure of an assertion, and return how many times it has
+ * failed, or 0 if it could not be tracked.
+ */
+static uint64_t count_failure(const char *fail_msg)
+{
+	size_t hash = (uintptr_t)fail_msg / 8 % N_FAILURE_SITES;
+
+	for (size_t i = 0; i < N_FAILURE_SITES; i++) {
+		struct failure_site *site =
+			&failure_sites[(hash + i) % N_FAILURE_SITES];
+
+		if (!site->fail_msg)
+			site->fail_msg = fail_msg;
+		if (site->fail_msg == fail_msg)
+			return ++site->failures;
+	}
+
+	/* Too many sites to keep track of, so print every failure */
+	return 0;
+}
+
+static void print_repeated_failures(void)
 {
+	for (size_t i = 0; i < N_FAILURE_SITES; i++) {
+		const struct failure_site *site = &failure_sites[i];
+
+		if (site->failures > MAX_PRINTED_FAILURES)
+			fprintf(output(), "%s (failed %llu times, %llu not "
+				"shown)\n",
+				site->fail_msg,
+				(unsigned long long)site->failures,
+				(unsigned long long)(site->failures -
+						     MAX_PRINTED_FAILURES));
+	}
+}
+
+static void print_test_summary(bool premature)
+{
+	print_repeated_failures();
+
 	if (premature)
-		printf("Test ended prematurely due to an assertion failure!\n");
+		fprintf(output(),
+			"Test ended prematurely due to an assertion failure!\n");
 	else if (failed_assertions)
-		printf("Test ended, but failed due to expectation failures!\n");
+		fprintf(output(),
+			"Test ended, but failed due to expectation failures!\n");
 	else
-		printf("Test succeeded!\n");
+		fprintf(output(), "Test succeeded!\n");
 
-	printf("%zu successful assertions, %zu failed assertions!\n",
-	       successful_assertions, failed_assertions);
+	fprintf(output(), "%zu successful assertions, %zu failed assertions!\n",
+		_li_unit_successful_assertions, failed_assertions);
+}
+
+static void __noreturn handle_test_exit(bool premature)
+{
+	print_test_summary(premature);
+	report_assertions();
+	report_counters();
+
+	if (test_unwind)
+		siglongjmp(*test_unwind, 1);
 
 	exit(failed_assertions != 0);
 	__builtin_unreachable();
 }
 
-void _li_unit_test_assert(bool result, const char *fail_msg)
+void _li_unit_test_assert_failed(const char *fail_msg)
 {
-	if (result) {
-		successful_assertions += 1;
-	} else {
-		failed_assertions += 1;
-		printf("%s\n", fail_msg);
-		handle_test_exit(true);
-	}
+	failed_assertions += 1;
+	fprintf(output(), "%s\n", fail_msg);
+	report_failure_site(fail_msg);
+	handle_test_exit(true);
 }
 
-bool _li_unit_test_expect(bool result, const char *fail_msg)
+bool _li_unit_test_expect_failed(const char *fail_msg)
 {
-	if (result) {
-		successful_assertions += 1;
-	} else {
-		failed_assertions += 1;
-		printf("%s\n", fail_msg);
-	}
+	uint64_t failures = count_failure(fail_msg);
 
-	return result;
+	failed_assertions += 1;
+	if (failures <= MAX_PRINTED_FAILURES)
+		fprintf(output(), "%s\n", fail_msg);
+	if (failures == MAX_PRINTED_FAILURES)
+		fprintf(output(), "(Further failures of this assertion are "
+			"counted, but not printed.)\n");
+	report_failure_site(fail_msg);
+	return false;
 }
 
-void _li_unit_test_assert_null(const void *ptr, const char *fail_msg)
+size_t li_unit_failed_assertions(void)
 {
-	_li_unit_test_assert(!ptr, fail_msg);
+	return failed_assertions;
 }
 
-bool _li_unit_test_expect_null(const void *ptr, const char *fail_msg)
+static void call_test(const struct li_unit_test *test)
 {
-	return _li_unit_test_expect(!ptr, fail_msg);
+	if (test->bench)
+		li_unit_run_bench(test);
+	else if (test->fuzz)
+		li_unit_run_fuzz_inputs(test);
+	else if (test->param_func)
+		test->param_func(test->params);
+	else
+		test->func();
 }
 
-void _li_unit_test_assert_not_null(const void *ptr, const char *fail_msg)
+static void print_test_banner(const struct li_unit_test *test)
 {
-	_li_unit_test_assert(ptr, fail_msg);
+	fprintf(output(), "Running test %s...\n", test->name);
+
+	if (test->options.informational)
+		fprintf(output(), "NOTICE: Test is informational.\n");
+	if (test->options.disabled)
+		fprintf(output(), "WARNING: Test is disabled. Running anyway.\n");
+}
+
+bool li_unit_run_test_in_thread(const struct li_unit_test *test, FILE *out,
+				struct li_unit_result *result)
+{
+	struct li_unit_result discarded_result = { 0 };
+	sigjmp_buf unwind;
+
+	reset_assertions();
+	test_output = out;
+	test_result = result ? result : &discarded_result;
+
+	print_test_banner(test);
+
+	/* The signal mask is left alone, so there is no need to save
+	   it */
+	if (!sigsetjmp(unwind, 0)) {
+		test_unwind = &unwind;
+		call_test(test);
+		print_test_summary(false);
+		report_assertions();
+	}
+
+	test_unwind = NULL;
+	test_output = NULL;
+	test_result = NULL;
+	li_unit_result_free(&discarded_result);
+	return failed_assertions == 0;
 }
 
-bool _li_unit_test_expect_not_null(const void *ptr, const char *fail_msg)
+/*
+ * Pick up the result channel from the runner, if any. It is removed
+ * from the environment so that processes started by the test do not
+ * write to it.
+ */
+static void open_result_channel(void)
 {
-	return _li_unit_test_expect(ptr, fail_msg);
+	const char *fd_str = getenv(LI_UNIT_RESULT_FD_ENV);
+
+	if (!fd_str)
+		return;
+
+	if (sscanf(fd_str, "%d:%" SCNu32, &result_fd, &result_job) != 2)
+		result_fd = -1;
+	unsetenv(LI_UNIT_RESULT_FD_ENV);
 }
 
 void __noreturn li_unit_run_test(const struct li_unit_test *test)
 {
-	printf("Running test %s...\n", test->name);
-
-	if (test->options.informational)
-		printf("NOTICE: Test is informational.\n");
-	if (test->options.disabled)
-		printf("WARNING: Test is disabled. Running anyway.\n");
+	/* The child may be forked from a process which was itself
+	   running a test */
+	reset_assertions();
 
-	test->func();
+	open_result_channel();
+	print_test_banner(test);
+	li_unit_perf_start_test();
+	call_test(test);
 	handle_test_exit(false);
 }
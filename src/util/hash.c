@@ -0,0 +1,54 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "unit.h"
+#include "util/hash.h"
+
+#define FNV1A_64_PRIME 0x100000001b3ULL
+
+uint64_t li_util_fnv1a_64(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *bytes = data;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= FNV1A_64_PRIME;
+	}
+
+	return hash;
+}
+
+DEFTEST("lithium.util.hash.fnv1a_64",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	/* Reference values from the FNV specification */
+	EXPECT(li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, "", 0) ==
+	       0xcbf29ce484222325ULL);
+	EXPECT(li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, "a", 1) ==
+	       0xaf63dc4c8601ec8cULL);
+	EXPECT(li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, "foobar", 6) ==
+	       0x85944171f73967e8ULL);
+
+	/* Hashing in pieces is the same as hashing all at once */
+	EXPECT(li_util_fnv1a_64(li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, "foo",
+						 3),
+				"bar", 3) == 0x85944171f73967e8ULL);
+}
+
+DEFBENCH("lithium.util.hash.fnv1a_64_bench", {})
+{
+	const char data[] = "lithium.unit.runner.parallel_output";
+	size_t len = sizeof(data) - 1;
+
+	BENCH_LOOP(bench)
+	{
+		DO_NOT_OPTIMIZE(len);
+		DO_NOT_OPTIMIZE(li_util_fnv1a_64(LI_UTIL_FNV1A_64_INIT, data,
+						 len));
+	}
+}
@@ -6,22 +6,37 @@
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "unit.h"
 #include "util/reallocating_buffer.h"
 
 #define MIN_REALLOC_SIZE (1 << 13) /* 8 KB */
 
-static void increase_buffer_size(struct li_reallocating_buffer *buf,
-				 size_t n_bytes)
+static int increase_buffer_size(struct li_reallocating_buffer *buf,
+				size_t n_bytes)
 {
+	size_t new_allocation;
+	void *new_buf;
+
 	if (!n_bytes)
-		return;
+		return 0;
+
+	/* Grow at least geometrically, so repeated appends stay cheap */
+	new_allocation = buf->buf_allocation + n_bytes;
+	if (new_allocation < buf->buf_allocation * 2)
+		new_allocation = buf->buf_allocation * 2;
+	new_allocation =
+		((new_allocation / MIN_REALLOC_SIZE) + 1) * MIN_REALLOC_SIZE;
 
-	buf->buf_allocation =
-		((((buf->buf_allocation + n_bytes) / MIN_REALLOC_SIZE) + 1)) *
-		MIN_REALLOC_SIZE;
-	buf->buf = realloc(buf->buf, buf->buf_allocation);
+	new_buf = realloc(buf->buf, new_allocation);
+	if (!new_buf)
+		return -1;
+
+	buf->buf = new_buf;
+	buf->buf_allocation = new_allocation;
+	return 0;
 }
 
 ssize_t li_reallocating_buffer_read(int fd, struct li_reallocating_buffer *buf,
@@ -32,8 +47,9 @@ ssize_t li_reallocating_buffer_read(int fd, struct li_reallocating_buffer *buf,
 
 	size_t space_left = buf->buf_allocation - buf->buf_usage;
 
-	if (space_left < n_bytes)
-		increase_buffer_size(buf, n_bytes - space_left);
+	if (space_left < n_bytes &&
+	    increase_buffer_size(buf, n_bytes - space_left) < 0)
+		return -1;
 
 	/* If fd is non-blocking, may as well increase the size of the
 	   read to what we can handle */
@@ -50,3 +66,39 @@ ssize_t li_reallocating_buffer_read(int fd, struct li_reallocating_buffer *buf,
 
 	return read_rv;
 }
+
+int li_reallocating_buffer_append(struct li_reallocating_buffer *buf,
+				  const void *data, size_t len)
+{
+	size_t space_left = buf->buf_allocation - buf->buf_usage;
+
+	if (space_left < len &&
+	    increase_buffer_size(buf, len - space_left) < 0)
+		return -1;
+
+	memcpy(buf->buf + buf->buf_usage, data, len);
+	buf->buf_usage += len;
+	return 0;
+}
+
+DEFTEST("lithium.util.reallocating_buffer.append", {})
+{
+	struct li_reallocating_buffer buf = { 0 };
+	char chunk[3000];
+
+	for (size_t i = 0; i < sizeof(chunk); i++)
+		chunk[i] = i;
+
+	for (int i = 0; i < 10; i++)
+		ASSERT(li_reallocating_buffer_append(&buf, chunk,
+						     sizeof(chunk)) == 0);
+	EXPECT(buf.buf_usage == 10 * sizeof(chunk));
+	EXPECT(buf.buf_allocation >= buf.buf_usage);
+	for (int i = 0; i < 10; i++)
+		EXPECT(!memcmp(buf.buf + i * sizeof(chunk), chunk,
+			       sizeof(chunk)));
+
+	EXPECT(li_reallocating_buffer_append(&buf, NULL, 0) == 0);
+	EXPECT(buf.buf_usage == 10 * sizeof(chunk));
+	free(buf.buf);
+}
@@ -0,0 +1,187 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "unit.h"
+#include "util/sorted_file.h"
+
+int li_util_sorted_file_load(const char *path,
+			     int (*parse_line)(char *line, void *data),
+			     void *data)
+{
+	char *line = NULL;
+	size_t line_allocation = 0;
+	ssize_t line_len;
+	int rv = -1;
+
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		if (errno == ENOENT)
+			return 0;
+		perror("fopen failed");
+		return -1;
+	}
+
+	while ((line_len = getline(&line, &line_allocation, f)) > 0) {
+		int parse_rv;
+
+		if (line[line_len - 1] == '\n')
+			line[line_len - 1] = '\0';
+
+		parse_rv = parse_line(line, data);
+		if (parse_rv < 0)
+			goto exit;
+		if (parse_rv > 0)
+			fprintf(stderr, "%s: ignoring malformed line: %s\n",
+				path, line);
+	}
+
+	rv = 0;
+
+exit:
+	free(line);
+	fclose(f);
+	return rv;
+}
+
+/*
+ * Entries which compare equal are ordered by where they are in the
+ * array, which is the order they were recorded in.
+ */
+static int entry_ptr_cmp(const void *a, const void *b, void *data)
+{
+	int (*cmp)(const void *a, const void *b) = data;
+	const char *ea = *(const char *const *)a;
+	const char *eb = *(const char *const *)b;
+	int rv = cmp(ea, eb);
+
+	if (rv)
+		return rv;
+	return (ea > eb) - (ea < eb);
+}
+
+void *li_util_sorted_merge(const void *entries, size_t n_sorted,
+			   size_t n_entries, size_t size,
+			   int (*cmp)(const void *a, const void *b),
+			   size_t *n_merged)
+{
+	const char *old = entries;
+	size_t n_new = n_entries - n_sorted;
+	const char **new = calloc(n_new ?: 1, sizeof(*new));
+	char *merged = calloc(n_entries ?: 1, size);
+	size_t i = 0, j = 0, n = 0;
+
+	if (!new || !merged) {
+		perror("calloc failed");
+		free(new);
+		free(merged);
+		return NULL;
+	}
+
+	for (size_t k = 0; k < n_new; k++)
+		new[k] = old + (n_sorted + k) * size;
+	qsort_r(new, n_new, sizeof(*new), entry_ptr_cmp, cmp);
+
+	while (i < n_sorted || j < n_new) {
+		const char *latest;
+
+		if (j == n_new ||
+		    (i < n_sorted && cmp(old + i * size, new[j]) < 0)) {
+			memcpy(merged + n++ * size, old + i++ * size, size);
+			continue;
+		}
+
+		/* The last of the entries recorded for the same key
+		   replaces any loaded one */
+		while (j + 1 < n_new && !cmp(new[j], new[j + 1]))
+			j++;
+		latest = new[j++];
+		while (i < n_sorted && !cmp(old + i * size, latest))
+			i++;
+		memcpy(merged + n++ * size, latest, size);
+	}
+
+	free(new);
+	*n_merged = n;
+	return merged;
+}
+
+int li_util_sorted_file_save(const char *path, const void *entries,
+			     size_t n_entries, size_t size,
+			     void (*write_entry)(FILE *f, const void *entry))
+{
+	char *tmp_path;
+	int rv = 0;
+
+	if (asprintf(&tmp_path, "%s.tmp.%d", path, getpid()) < 0) {
+		perror("asprintf failed");
+		return -1;
+	}
+
+	FILE *f = fopen(tmp_path, "w");
+	if (!f) {
+		perror("fopen failed");
+		free(tmp_path);
+		return -1;
+	}
+
+	for (size_t i = 0; i < n_entries; i++)
+		write_entry(f, (const char *)entries + i * size);
+
+	if (fclose(f) != 0) {
+		fprintf(stderr, "%s: failed to write: %m\n", path);
+		rv = -1;
+	} else if (rename(tmp_path, path) < 0) {
+		perror("rename failed");
+		rv = -1;
+	}
+
+	if (rv < 0)
+		unlink(tmp_path);
+	free(tmp_path);
+	return rv;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+	const int *ia = a;
+	const int *ib = b;
+
+	return (*ia / 10 > *ib / 10) - (*ia / 10 < *ib / 10);
+}
+
+DEFTEST("lithium.util.sorted_file.merge",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	/* Entries compare by their tens, so 21 and 22 are the same
+	   key recorded twice */
+	const int entries[] = { 10, 20, 40, 50, 21, 31, 22, 11 };
+	const int expected[] = { 11, 22, 31, 40, 50 };
+	size_t n_merged;
+	int *merged = li_util_sorted_merge(entries, 4, ARRAY_SIZE(entries),
+					   sizeof(*entries), int_cmp,
+					   &n_merged);
+
+	ASSERT(merged);
+	EXPECT(n_merged == ARRAY_SIZE(expected));
+	for (size_t i = 0; i < n_merged && i < ARRAY_SIZE(expected); i++)
+		EXPECT(merged[i] == expected[i]);
+	free(merged);
+
+	/* Nothing recorded */
+	merged = li_util_sorted_merge(entries, 4, 4, sizeof(*entries), int_cmp,
+				      &n_merged);
+	ASSERT(merged);
+	EXPECT(n_merged == 4 && merged[3] == 50);
+	free(merged);
+}
@@ -24,7 +24,8 @@ void li_util_timespec_subtract(const struct timespec *a,
 	}
 }
 
-DEFTEST("lithium.util.timespec.subtract", {})
+DEFTEST("lithium.util.timespec.subtract",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
 {
 	struct timespec t1 = { 1000, 123456 };
 	struct timespec t2 = { 1000, 456 };
@@ -53,7 +54,8 @@ bool li_util_timespec_lt(const struct timespec *a, const struct timespec *b)
 	return false;
 }
 
-DEFTEST("lithium.util.timespec.lt", {})
+DEFTEST("lithium.util.timespec.lt",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
 {
 	struct timespec t1 = { 1000, 123456 };
 	struct timespec t2 = { 1000, 456 };
@@ -65,3 +67,28 @@ DEFTEST("lithium.util.timespec.lt", {})
 	EXPECT(li_util_timespec_lt(&t3, &t3) == false);
 	EXPECT(li_util_timespec_lt(&t1, &t3) == true);
 }
+
+void li_util_timespec_add_ms(struct timespec *ts, long ms)
+{
+	ts->tv_sec += ms / MSEC_PER_SEC;
+	ts->tv_nsec += (ms % MSEC_PER_SEC) * NSEC_PER_MSEC;
+
+	if (ts->tv_nsec >= NSEC_PER_SEC) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= NSEC_PER_SEC;
+	}
+}
+
+DEFTEST("lithium.util.timespec.add_ms",
+	{ .isolation = LI_UNIT_ISOLATION_THREAD })
+{
+	struct timespec t = { 1000, 900000000 };
+
+	li_util_timespec_add_ms(&t, 50);
+	EXPECT(t.tv_sec == 1000);
+	EXPECT(t.tv_nsec == 950000000);
+
+	li_util_timespec_add_ms(&t, 2200);
+	EXPECT(t.tv_sec == 1003);
+	EXPECT(t.tv_nsec == 150000000);
+}